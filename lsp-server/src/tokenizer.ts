@@ -31,9 +31,10 @@ const TYPES = new Set([
 ]);
 
 const OPERATORS = new Set([
-	'=', ':', '+', '-', '&', '|', '^', '!',
+	'=', ':', '+', '-', '&', '|', '^', '!', '*', '/',
 	'==', '<>', '<', '>', '<=', '>=',
-	':=', '+=', '-=', '&=', '|=', '^=', '!=',
+	':=', '+=', '-=', '&=', '|=', '^=', '!=', '*=', '/=', '%=',
+	'<<=', '>>=', '<<<=', '>>>=',
 	'->', '<-'
 ]);
 
@@ -144,7 +145,7 @@ export function tokenize(text: string, knownSubroutines?: Set<string>): Token[]
 			continue;
 		}
 
-		if (ch === '%') {
+		if (ch === '%' && text[i + 1] !== '=') {
 			const start = i;
 			i++;
 			while (i < text.length && /[01]/.test(text[i])) {
@@ -208,7 +209,7 @@ export function tokenize(text: string, knownSubroutines?: Set<string>): Token[]
 		}
 
 		let operatorFound = false;
-		for (let len = 3; len >= 1; len--) {
+		for (let len = 4; len >= 1; len--) {
 			const substr = text.slice(i, i + len);
 			if (OPERATORS.has(substr)) {
 				tokens.push({
@@ -0,0 +1,1182 @@
+// Control-flow optimizations over the list of Instructions.
+//
+// The code list is split into basic blocks which are then cleaned up with jump
+// threading, unreachable block deletion, label alias collapsing and block
+// merging. Inline assembly is opaque: it may reference any label, branch
+// anywhere and fall through, so it is never changed or moved.
+//
+// This file is included by asm.c.
+
+#include <ctype.h>
+
+// Labels ---------------------------------------------------------------------
+
+struct LabelInfo {
+    char               *name;     // a copy, since passes free the Instruction
+    struct Instruction *at;
+    unsigned            refs;     // every mention, including inline assembly
+    unsigned            codeRefs; // mentions by generated instructions
+    unsigned            jumps;    // mentions that are the whole operand
+    unsigned            block;    // index of the block it starts (code only)
+    unsigned            segment;  // see relaxBranches
+    unsigned            offset;
+    unsigned            position; // see asm-reg.c
+};
+
+static struct {
+    unsigned          cap;
+    struct LabelInfo *items;
+    unsigned          next; // number for the next label made here
+} labels;
+
+static unsigned hashLabel(const char *name, size_t len)
+{
+    unsigned hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static struct LabelInfo *findLabel(const char *name, size_t len)
+{
+    if (labels.cap == 0 || len == 0) {
+        return NULL;
+    }
+    for (unsigned i = hashLabel(name, len) % labels.cap;; i = (i + 1) % labels.cap) {
+        struct LabelInfo *info = &labels.items[i];
+        if (!info->name) {
+            return NULL;
+        }
+        if (strlen(info->name) == len && strncmp(info->name, name, len) == 0) {
+            return info;
+        }
+    }
+}
+
+static struct LabelInfo *labelInfo(const char *name) { return findLabel(name, strlen(name)); }
+
+static void addLabel(struct Instruction *at)
+{
+    const char *name = at->label;
+    size_t      len  = strlen(name);
+    for (unsigned i = hashLabel(name, len) % labels.cap;; i = (i + 1) % labels.cap) {
+        struct LabelInfo *info = &labels.items[i];
+        if (!info->name) {
+            info->name = strcopy(name);
+            info->at   = at;
+            return;
+        }
+        if (strcmp(info->name, name) == 0) {
+            // Duplicates are the assembler's problem to report.
+            return;
+        }
+    }
+}
+
+static void forgetLabels(void)
+{
+    for (unsigned i = 0; i < labels.cap; i++) {
+        free(labels.items[i].name);
+    }
+    free(labels.items);
+    labels.items = NULL;
+    labels.cap   = 0;
+}
+
+static bool isLabelChar(char ch) { return isalnum((unsigned char)ch) || ch == '_' || ch == '.'; }
+
+// Calls fn for every label mentioned in text.
+static void forEachLabelIn(const char *text, void (*fn)(struct LabelInfo *, void *), void *arg)
+{
+    const char *p = text;
+    while (*p) {
+        if (!isLabelChar(*p)) {
+            p++;
+            continue;
+        }
+        const char *start = p;
+        while (isLabelChar(*p)) {
+            p++;
+        }
+        struct LabelInfo *info = findLabel(start, (size_t)(p - start));
+        if (info) {
+            fn(info, arg);
+        }
+    }
+}
+
+static void countRef(struct LabelInfo *info, void *isCode)
+{
+    info->refs++;
+    if (*(bool *)isCode) {
+        info->codeRefs++;
+    }
+}
+
+static bool isData(const struct Instruction *p) { return p->op == OP_ASC || p->op == OP_HEX; }
+
+static bool isCode(const struct Instruction *p) { return p->op && p->op != OP_EQU && !isData(p); }
+
+static void countRefs(struct Instruction *head)
+{
+    for (struct Instruction *p = head; p; p = p->next) {
+        bool isCodeRef = isCode(p);
+        if (p->assembly) {
+            forEachLabelIn(p->assembly, countRef, &isCodeRef);
+        } else if (p->op && !isData(p)) {
+            forEachLabelIn(p->operand, countRef, &isCodeRef);
+            struct LabelInfo *info = isCodeRef ? labelInfo(p->operand) : NULL;
+            if (info) {
+                info->jumps++;
+            }
+        }
+    }
+}
+
+// Returns true if label was made by MakeLocalLabel and so only generated code
+// can refer to it. Sets number to the count it was made with.
+static bool localLabelNumber(const char *label, unsigned *number)
+{
+    const char *suffix = strstr(label, "._");
+    if (suffix) {
+        suffix += 2;
+    } else if (strncmp(label, "A2_", 3) == 0) {
+        suffix = label + 3;
+    } else {
+        return false;
+    }
+    if (*suffix == '\0') {
+        return false;
+    }
+    unsigned n = 0;
+    for (; *suffix; suffix++) {
+        if (!isdigit((unsigned char)*suffix)) {
+            return false;
+        }
+        n = n * 10 + (unsigned)(*suffix - '0');
+    }
+    *number = n;
+    return true;
+}
+
+static bool isLocalLabel(const char *label)
+{
+    unsigned number;
+    return localLabelNumber(label, &number);
+}
+
+// Makes sure the next label made here won't collide with any in head.
+static void reserveLabels(struct Instruction *head)
+{
+    for (struct Instruction *p = head; p; p = p->next) {
+        unsigned number;
+        if (localLabelNumber(p->label, &number) && number >= labels.next) {
+            labels.next = number + 1;
+        }
+    }
+}
+
+// Labels p with a new local label unless it already has one.
+static const char *labelOf(struct Instruction *p)
+{
+    if (p->label[0] == '\0') {
+        snprintf(p->label, sizeof p->label, "A2_%u", labels.next++);
+    }
+    return p->label;
+}
+
+// Indexes the labels of the code list and counts the references to them.
+static void indexLabels(void)
+{
+    unsigned count = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        count++;
+    }
+
+    forgetLabels();
+    labels.cap   = count * 2 + 1;
+    labels.items = calloc(labels.cap, sizeof(*labels.items));
+    require(labels.items, "calloc failed");
+
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->op && p->label[0] != '\0') {
+            addLabel(p);
+        }
+    }
+
+    countRefs(codeHead.next);
+    countRefs(dataHead.next);
+    reserveLabels(codeHead.next);
+    reserveLabels(dataHead.next);
+}
+
+// Returns true if every reference to the label can be rewritten.
+static bool isMovable(const struct LabelInfo *info)
+{
+    return isLocalLabel(info->name) && info->refs == info->jumps;
+}
+
+// Follows EQU aliases to the Instruction the label is really on.
+static struct LabelInfo *resolveLabel(struct LabelInfo *info)
+{
+    for (unsigned hops = 0; info && info->at && info->at->op == OP_EQU; hops++) {
+        if (hops > 16) {
+            return NULL;
+        }
+        info = labelInfo(info->at->operand);
+    }
+    return info && info->at ? info : NULL;
+}
+
+// Returns the code label that operand jumps to, or NULL if it's external.
+static struct LabelInfo *jumpTarget(const char *operand)
+{
+    struct LabelInfo *info = labelInfo(operand);
+    return info ? resolveLabel(info) : NULL;
+}
+
+static void renameJumps(const char *from, const char *to)
+{
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (isCode(p) && strcmp(p->operand, from) == 0) {
+            strcpy(p->operand, to);
+        }
+    }
+}
+
+// Instructions ---------------------------------------------------------------
+
+static bool isBranch(Operation op)
+{
+    return op == OP_BCC || op == OP_BCS || op == OP_BEQ || op == OP_BNE
+        || op == OP_BMI || op == OP_BPL || op == OP_BVC || op == OP_BVS;
+}
+
+static Operation invertBranch(Operation op)
+{
+    if (op == OP_BCC) return OP_BCS;
+    if (op == OP_BCS) return OP_BCC;
+    if (op == OP_BEQ) return OP_BNE;
+    if (op == OP_BNE) return OP_BEQ;
+    if (op == OP_BMI) return OP_BPL;
+    if (op == OP_BPL) return OP_BMI;
+    if (op == OP_BVC) return OP_BVS;
+    return OP_BVC;
+}
+
+// Returns true if control never continues to the next instruction.
+static bool isUnconditional(const struct Instruction *p) { return p->op == OP_JMP || p->op == OP_RTS; }
+
+// Returns true if p is the 65C02's INC A or DEC A.
+static bool isAccumulatorStep(const struct Instruction *p)
+{
+    return (p->op == OP_INC || p->op == OP_DEC) && strcmp(p->operand, "A") == 0;
+}
+
+// Returns true if op shifts or rotates A, or memory when it has an operand.
+static bool isShift(Operation op) { return op == OP_ASL || op == OP_LSR || op == OP_ROL || op == OP_ROR; }
+
+static bool endsBlock(const struct Instruction *p)
+{
+    return p->assembly || isUnconditional(p) || isBranch(p->op);
+}
+
+// Returns true if the size of the code after prevCode is assumed by it, like
+// BCC *+2+1 does.
+static bool isPinned(const struct Instruction *prevCode)
+{
+    return prevCode && isCode(prevCode) && prevCode->operand[0] == '*';
+}
+
+// Returns the next code or inline assembly after p.
+static struct Instruction *nextCode(struct Instruction *p)
+{
+    for (p = p->next; p && !isCode(p) && !p->assembly; p = p->next) {
+    }
+    return p;
+}
+
+static const unsigned UNKNOWN_SIZE = 0xFFFF;
+
+// Returns the most bytes the assembler could use for p. Operands are assumed
+// to be absolute since only the assembler knows what is in the zero page.
+static unsigned sizeOf(const struct Instruction *p)
+{
+    if (p->assembly) {
+        return UNKNOWN_SIZE;
+    }
+    if (!isCode(p)) {
+        return 0;
+    }
+    if (isBranch(p->op) || p->op == OP_BRA) {
+        return 2;
+    }
+    if (isAccumulatorStep(p)) {
+        return 1;
+    }
+    switch (p->operand[0]) {
+    case '\0':
+        return 1;
+    case '#':
+        return 2;
+    case '(':
+        return p->op == OP_JMP ? 3 : 2;
+    default:
+        return 3;
+    }
+}
+
+// Basic blocks ---------------------------------------------------------------
+
+struct BasicBlock {
+    struct Instruction *first;  // including the comments before the leader
+    struct Instruction *leader; // first code or inline assembly
+    struct Instruction *last;
+
+    bool fallsThrough;
+    bool isOpaque;
+    bool isReachable;
+};
+
+static struct {
+    unsigned      len;
+    struct BasicBlock *items;
+} blocks;
+
+static struct {
+    unsigned  len;
+    unsigned *items;
+} worklist;
+
+static void buildBlocks(void)
+{
+    indexLabels();
+
+    unsigned count = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        count++;
+    }
+    free(blocks.items);
+    blocks.len   = 0;
+    blocks.items = calloc(count + 1, sizeof(*blocks.items));
+    require(blocks.items, "calloc failed");
+
+    free(worklist.items);
+    worklist.len   = 0;
+    worklist.items = calloc(count + 1, sizeof(*worklist.items));
+    require(worklist.items, "calloc failed");
+
+    struct Instruction *pending = NULL;
+    struct BasicBlock       *block   = NULL;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (!isCode(p) && !p->assembly) {
+            if (!pending) {
+                pending = p;
+            }
+            continue;
+        }
+        if (!block || endsBlock(block->last) || p->assembly || p->label[0] != '\0') {
+            block         = &blocks.items[blocks.len++];
+            block->first  = pending ? pending : p;
+            block->leader = p;
+            if (p->label[0] != '\0') {
+                labelInfo(p->label)->block = blocks.len - 1;
+            }
+        }
+        pending      = NULL;
+        block->last  = p;
+    }
+
+    for (unsigned i = 0; i < blocks.len; i++) {
+        block               = &blocks.items[i];
+        block->isOpaque     = block->leader->assembly != NULL;
+        block->fallsThrough = block->isOpaque || !isUnconditional(block->last);
+    }
+}
+
+static void markReachable(unsigned index)
+{
+    if (!blocks.items[index].isReachable) {
+        blocks.items[index].isReachable = true;
+        worklist.items[worklist.len++]  = index;
+    }
+}
+
+static void markMentioned(struct LabelInfo *info, void *arg)
+{
+    info = resolveLabel(info);
+    if (info && isCode(info->at)) {
+        markReachable(info->block);
+    }
+}
+
+// Marks the blocks that control can get to from the already marked ones.
+static void propagateReachable(void)
+{
+    while (worklist.len > 0) {
+        unsigned      index = worklist.items[--worklist.len];
+        struct BasicBlock *block = &blocks.items[index];
+        for (struct Instruction *p = block->leader;; p = p->next) {
+            if (isCode(p)) {
+                forEachLabelIn(p->operand, markMentioned, NULL);
+            }
+            if (p == block->last) {
+                break;
+            }
+        }
+        if (block->fallsThrough && index + 1 < blocks.len) {
+            markReachable(index + 1);
+        }
+    }
+}
+
+// Passes ---------------------------------------------------------------------
+
+// L1 EQU L2 => (references to L1 use L2)
+static bool collapseAliases(void)
+{
+    bool changed = false;
+    for (struct Instruction *prev = &codeHead, *p = prev->next; p; p = prev->next) {
+        struct LabelInfo *alias  = p->op == OP_EQU ? labelInfo(p->label) : NULL;
+        struct LabelInfo *target = alias ? jumpTarget(p->operand) : NULL;
+        if (!target || !isCode(target->at) || !isMovable(alias)) {
+            prev = p;
+            continue;
+        }
+        renameJumps(p->label, target->name);
+        alias->at = NULL;
+        removeNextInstruction(prev);
+        changed = true;
+    }
+    return changed;
+}
+
+//    CLV     => JMP L
+//    BVC L
+static bool replaceAlwaysBranches(void)
+{
+    bool changed = false;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        struct Instruction *succ = p->op == OP_CLV ? nextCode(p) : NULL;
+        if (!succ || succ->op != OP_BVC || succ->label[0] != '\0' || !jumpTarget(succ->operand)) {
+            continue;
+        }
+        p->op = OP_JMP;
+        strcpy(p->operand, succ->operand);
+        while (p->next != succ) {
+            p = p->next;
+        }
+        removeNextInstruction(p);
+        changed = true;
+    }
+    return changed;
+}
+
+//    JMP L1  =>    JMP L2      BEQ L1  =>    BEQ L2      JMP L1  =>    RTS
+// L1 JMP L2     L1 JMP L2   L1 JMP L2     L1 JMP L2   L1 RTS        L1 RTS
+static bool threadJumps(void)
+{
+    bool changed = false;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->op != OP_JMP && !isBranch(p->op)) {
+            continue;
+        }
+        for (unsigned hops = 0; hops < 16; hops++) {
+            struct LabelInfo *target = jumpTarget(p->operand);
+            if (!target || !isCode(target->at) || target->at == p) {
+                break;
+            }
+            struct Instruction *dest = target->at;
+            if (dest->op == OP_RTS && p->op == OP_JMP) {
+                p->op         = OP_RTS;
+                p->operand[0] = '\0';
+                changed       = true;
+                break;
+            }
+            if (dest->op != OP_JMP || strcmp(dest->operand, p->operand) == 0) {
+                break;
+            }
+            // Branches can only reach code that the range check can measure.
+            if (isBranch(p->op) && !jumpTarget(dest->operand)) {
+                break;
+            }
+            strcpy(p->operand, dest->operand);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+//    JMP L   =>
+// L  ...        L  ...
+static bool removeJumpsToNext(void)
+{
+    bool changed = false;
+    for (struct Instruction *prev = &codeHead, *prevCode = NULL, *p = prev->next; p; p = prev->next) {
+        struct LabelInfo   *target = NULL, *own = NULL;
+        struct Instruction *succ   = NULL;
+        if (p->op == OP_JMP || isBranch(p->op)) {
+            target = jumpTarget(p->operand);
+            succ   = nextCode(p);
+            own    = p->label[0] != '\0' ? labelInfo(p->label) : NULL;
+        }
+        if (!target || succ != target->at || isPinned(prevCode) || (own && !isMovable(own))) {
+            if (isCode(p) || p->assembly) {
+                prevCode = p;
+            }
+            prev = p;
+            continue;
+        }
+        if (own) {
+            renameJumps(p->label, target->name);
+            own->at = NULL;
+        }
+        removeNextInstruction(prev);
+        changed = true;
+    }
+    return changed;
+}
+
+//    BEQ L1  =>    BNE L2
+//    JMP L2
+// L1 ...        L1 ...
+static bool invertBranchesOverJumps(void)
+{
+    bool changed = false;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        struct Instruction *jump = isBranch(p->op) ? nextCode(p) : NULL;
+        if (!jump || jump->op != OP_JMP || jump->label[0] != '\0') {
+            continue;
+        }
+        struct LabelInfo *over = jumpTarget(p->operand);
+        if (!over || over->at != nextCode(jump) || !jumpTarget(jump->operand)) {
+            continue;
+        }
+        p->op = invertBranch(p->op);
+        strcpy(p->operand, jump->operand);
+        while (p->next != jump) {
+            p = p->next;
+        }
+        removeNextInstruction(p);
+        changed = true;
+    }
+    return changed;
+}
+
+// Deletes the code in blocks that nothing can reach.
+static bool removeUnreachable(void)
+{
+    for (unsigned i = 0; i < blocks.len; i++) {
+        struct BasicBlock *block = &blocks.items[i];
+        const char   *label = block->leader->label;
+        if (i == 0 || block->isOpaque) {
+            markReachable(i);
+        } else if (label[0] != '\0') {
+            struct LabelInfo *info = labelInfo(label);
+            if (!isLocalLabel(label) || info->refs > info->codeRefs) {
+                markReachable(i);
+            }
+        }
+    }
+    propagateReachable();
+
+    bool     changed = false;
+    unsigned index   = 0;
+    for (struct Instruction *prev = &codeHead, *p = prev->next; p; p = prev->next) {
+        while (index + 1 < blocks.len && blocks.items[index + 1].first == p) {
+            index++;
+        }
+        const struct BasicBlock *block = &blocks.items[index];
+        if (blocks.len == 0 || block->isReachable || p->op == OP_EQU || p->assembly) {
+            prev = p;
+            continue;
+        }
+        removeNextInstruction(prev);
+        changed = true;
+    }
+    return changed;
+}
+
+//    JMP L1  => ...
+//    ...        JMP L2
+// L1 ...
+//    JMP L2
+static bool mergeBlocks(void)
+{
+    for (unsigned i = 1; i < blocks.len; i++) {
+        struct BasicBlock *block = &blocks.items[i];
+        const char   *label = block->leader->label;
+        if (blocks.items[i - 1].fallsThrough || block->isOpaque || !isUnconditional(block->last)) {
+            continue;
+        }
+        struct LabelInfo *info = label[0] != '\0' ? labelInfo(label) : NULL;
+        if (!info || !isMovable(info) || info->jumps != 1) {
+            continue;
+        }
+
+        struct Instruction *prevJump = NULL, *prevFirst = NULL, *prevCode = NULL;
+        bool                isInside = false, isRelative = false;
+        for (struct Instruction *prev = &codeHead, *p = prev->next; p; prev = p, p = p->next) {
+            if (p == block->first) {
+                prevFirst = prev;
+                isInside  = true;
+            }
+            if (isInside && isCode(p) && p->operand[0] == '*') {
+                isRelative = true;
+            }
+            if (p->op == OP_JMP && strcmp(p->operand, label) == 0 && !isInside && !isPinned(prevCode)) {
+                prevJump = prev;
+            }
+            if (p == block->last) {
+                isInside = false;
+            }
+            if (isCode(p) || p->assembly) {
+                prevCode = p;
+            }
+        }
+        struct Instruction *jump = prevJump ? prevJump->next : NULL;
+        if (!jump || isRelative || nextCode(jump) == block->leader) {
+            continue;
+        }
+        if (jump->label[0] != '\0' && !isMovable(labelInfo(jump->label))) {
+            continue;
+        }
+
+        strcpy(block->leader->label, jump->label);
+        prevFirst->next   = block->last->next;
+        prevJump->next    = block->first;
+        block->last->next = jump;
+        removeNextInstruction(block->last);
+        return true;
+    }
+    return false;
+}
+
+// Drops labels that nothing refers to and the NOPs that only held them.
+static bool removeUnusedLabels(void)
+{
+    bool changed = false;
+    for (struct Instruction *prev = &codeHead, *prevCode = NULL, *p = prev->next; p; p = prev->next) {
+        struct LabelInfo *info = isCode(p) && p->label[0] != '\0' ? labelInfo(p->label) : NULL;
+        if (info && isLocalLabel(p->label) && info->refs == 0) {
+            p->label[0] = '\0';
+            changed     = true;
+        }
+
+        // L  NOP  => L  ...
+        //    ...
+        struct Instruction *succ = p->op == OP_NOP ? nextCode(p) : NULL;
+        if (p->op == OP_NOP && !isPinned(prevCode)) {
+            if (p->label[0] == '\0') {
+                removeNextInstruction(prev);
+                changed = true;
+                continue;
+            }
+            if (succ && isCode(succ) && isMovable(labelInfo(p->label))) {
+                if (succ->label[0] == '\0') {
+                    strcpy(succ->label, p->label);
+                } else {
+                    renameJumps(p->label, succ->label);
+                }
+                removeNextInstruction(prev);
+                return true;
+            }
+        }
+
+        if (isCode(p) || p->assembly) {
+            prevCode = p;
+        }
+        prev = p;
+    }
+    return changed;
+}
+
+// Records where the code of each label is. Code is measured from each inline
+// assembly since its size is unknown.
+static void measureLabels(void)
+{
+    unsigned segment = 0, offset = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->assembly) {
+            segment++;
+            offset = 0;
+            continue;
+        }
+        if (isCode(p) && p->label[0] != '\0') {
+            struct LabelInfo *info = labelInfo(p->label);
+            info->segment          = segment;
+            info->offset           = offset;
+        }
+        offset += sizeOf(p);
+    }
+}
+
+// Replaces branches that might not reach their label with a JMP.
+//
+//    BEQ L   =>    BNE *+5
+//                  JMP L
+static bool relaxBranches(void)
+{
+    measureLabels();
+
+    bool     changed = false;
+    unsigned segment = 0, offset = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->assembly) {
+            segment++;
+            offset = 0;
+            continue;
+        }
+        offset += sizeOf(p);
+
+        struct LabelInfo *target = isBranch(p->op) ? jumpTarget(p->operand) : NULL;
+        if (!target || !isCode(target->at)) {
+            continue;
+        }
+        long distance = (long)target->offset - (long)offset;
+        if (target->segment == segment && distance >= -128 && distance <= 127) {
+            continue;
+        }
+
+        struct Instruction *jump = Instruction(NULL, OP_JMP, strcopy(p->operand), NULL, NULL);
+        p->op = invertBranch(p->op);
+        strcpy(p->operand, "*+5");
+        jump->next = p->next;
+        p->next    = jump;
+        changed    = true;
+    }
+    return changed;
+}
+
+// Replaces the jumps that can reach their label with the 65C02's BRA, which
+// takes a byte less. Making a jump shorter only brings labels closer, so every
+// branch still reaches.
+//
+//    JMP L   =>    BRA L
+static void shortenJumps(void)
+{
+    measureLabels();
+
+    struct Instruction *prevCode = NULL;
+    unsigned            segment = 0, offset = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->assembly) {
+            segment++;
+            offset   = 0;
+            prevCode = p;
+            continue;
+        }
+        offset += sizeOf(p);
+
+        struct LabelInfo *target = p->op == OP_JMP ? jumpTarget(p->operand) : NULL;
+        if (target && isCode(target->at) && !isPinned(prevCode)) {
+            long distance = (long)target->offset - (long)offset;
+            if (target->segment == segment && distance >= -128 && distance <= 127) {
+                p->op = OP_BRA;
+                Tally("jumps shortened to BRA");
+            }
+        }
+        if (isCode(p)) {
+            prevCode = p;
+        }
+    }
+}
+
+// Cross-jumping --------------------------------------------------------------
+
+// Sharing a tail has to save at least this many bytes to be worth a JMP.
+static const unsigned MIN_TAIL_SAVING = 3;
+
+// Returns the code or inline assembly before p.
+static struct Instruction *previousCode(const struct Instruction *p)
+{
+    struct Instruction *prevCode = NULL;
+    for (struct Instruction *q = codeHead.next; q && q != p; q = q->next) {
+        if (isCode(q) || q->assembly) {
+            prevCode = q;
+        }
+    }
+    return prevCode;
+}
+
+// Returns a name for where control goes after the block or NULL if it goes to
+// more than one place or somewhere unnamed.
+static const char *exitOf(unsigned index)
+{
+    const struct BasicBlock  *block = &blocks.items[index];
+    const struct Instruction *last  = block->last;
+    if (block->isOpaque || isBranch(last->op)) {
+        return NULL;
+    }
+    if (last->op == OP_RTS) {
+        return OP_RTS;
+    }
+    if (last->op == OP_JMP) {
+        struct LabelInfo *target = jumpTarget(last->operand);
+        if (target) {
+            return target->name;
+        }
+        return last->operand[0] != '(' ? last->operand : NULL;
+    }
+    if (index + 1 < blocks.len && !blocks.items[index + 1].isOpaque) {
+        const char *label = blocks.items[index + 1].leader->label;
+        return label[0] != '\0' ? label : NULL;
+    }
+    return NULL;
+}
+
+static unsigned codeOf(const struct BasicBlock *block, struct Instruction **code)
+{
+    unsigned count = 0;
+    for (struct Instruction *p = block->leader;; p = p->next) {
+        if (isCode(p)) {
+            code[count++] = p;
+        }
+        if (p == block->last) {
+            return count;
+        }
+    }
+}
+
+static bool isSameInstruction(const struct Instruction *a, const struct Instruction *b)
+{
+    return a->op == b->op && strcmp(a->operand, b->operand) == 0 && a->operand[0] != '*';
+}
+
+//    ...     =>    ...
+//    STA X         JMP L
+//    JMP Z
+//    ...           ...
+//    STA X      L  STA X
+//    JMP Z         JMP Z
+static bool mergeTails(void)
+{
+    unsigned count = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        count++;
+    }
+    struct Instruction **a       = calloc(count + 1, sizeof(*a));
+    struct Instruction **b       = calloc(count + 1, sizeof(*b));
+    bool                *touched = calloc(blocks.len + 1, sizeof(*touched));
+    require(a && b && touched, "calloc failed");
+
+    bool changed = false;
+    for (unsigned i = 0; i < blocks.len; i++) {
+        struct BasicBlock *from = &blocks.items[i];
+        const char        *exit = exitOf(i);
+        if (touched[i] || !exit || !isUnconditional(from->last)) {
+            continue;
+        }
+        unsigned lenA = codeOf(from, a) - 1;
+
+        for (unsigned j = 0; j < blocks.len; j++) {
+            struct BasicBlock *to = &blocks.items[j];
+            if (j == i || touched[j] || !exitOf(j) || strcmp(exitOf(j), exit) != 0) {
+                continue;
+            }
+            unsigned lenB = codeOf(to, b);
+            if (isUnconditional(to->last)) {
+                lenB--;
+            }
+
+            unsigned common = 0, size = 0;
+            while (common < lenA && common < lenB
+                   && isSameInstruction(a[lenA - 1 - common], b[lenB - 1 - common])) {
+                size += sizeOf(a[lenA - 1 - common]);
+                common++;
+            }
+            if (common == 0 || size + sizeOf(from->last) < MIN_TAIL_SAVING + 3) {
+                continue;
+            }
+
+            struct Instruction *start = a[lenA - common];
+            if (isPinned(previousCode(start))) {
+                continue;
+            }
+            start->op = OP_JMP;
+            strcpy(start->operand, labelOf(b[lenB - common]));
+            while (start->next != from->last) {
+                removeNextInstruction(start);
+            }
+            removeNextInstruction(start);
+
+            touched[i] = touched[j] = true;
+            changed                 = true;
+            break;
+        }
+    }
+
+    free(a);
+    free(b);
+    free(touched);
+    return changed;
+}
+
+// Identical subroutines ------------------------------------------------------
+
+struct SubroutineCode {
+    struct Instruction *entry; // labeled with the subroutine's name
+    struct Instruction *last;
+    unsigned            hash;
+    bool                isComparable; // ends with JMP or RTS and has no storage
+    bool                isFoldable;   // nothing falls into it
+};
+
+// Returns which of sub's instructions p is, counting from 0, or -1 if it isn't
+// one of them.
+static long positionIn(const struct SubroutineCode *sub, const struct Instruction *p)
+{
+    long position = 0;
+    for (const struct Instruction *q = sub->entry;; q = q->next) {
+        if (q == p) {
+            return position;
+        }
+        if (q == sub->last) {
+            return -1;
+        }
+        if (isCode(q)) {
+            position++;
+        }
+    }
+}
+
+static bool isOwnedBy(const struct SubroutineCode *sub, const char *label)
+{
+    const char *name = sub->entry->label;
+    size_t      len  = strlen(name);
+    return strncmp(label, name, len) == 0 && label[len] == '.';
+}
+
+// Writes p's operand to out in a form that is the same for a copy of it in any
+// other subroutine. Returns false if it uses storage of its own.
+static bool normalizeOperand(const struct SubroutineCode *sub, const struct Instruction *p, char *out, size_t size)
+{
+    size_t used = 0;
+    out[0]      = '\0';
+    for (const char *q = p->operand; *q;) {
+        char        token[300];
+        const char *start = q;
+        if (isLabelChar(*q)) {
+            while (isLabelChar(*q)) {
+                q++;
+            }
+        } else {
+            q++;
+        }
+        snprintf(token, sizeof token, "%.*s", (int)(q - start), start);
+
+        struct LabelInfo *info     = labelInfo(token);
+        long              position = info && isCode(info->at) ? positionIn(sub, info->at) : -1;
+        if (strcmp(token, sub->entry->label) == 0) {
+            strcpy(token, "@");
+        } else if (position >= 0) {
+            snprintf(token, sizeof token, "@%ld", position);
+        } else if (isOwnedBy(sub, token)) {
+            // Parameters at fixed locations are compared by their location.
+            while (info && info->at && info->at->op == OP_EQU && labelInfo(info->at->operand)) {
+                info = labelInfo(info->at->operand);
+            }
+            if (!info || info->at->op != OP_EQU) {
+                return false;
+            }
+            snprintf(token, sizeof token, "%s", info->at->operand);
+        }
+
+        size_t len = strlen(token);
+        if (used + len + 1 > size) {
+            return false;
+        }
+        memcpy(out + used, token, len + 1);
+        used += len;
+    }
+    return true;
+}
+
+// Returns true if nothing outside of sub refers to the labels in it.
+static bool isSelfContained(const struct SubroutineCode *sub)
+{
+    for (struct Instruction *p = sub->entry;; p = p->next) {
+        bool              isLabeled = p != sub->entry && isCode(p) && p->label[0] != '\0';
+        struct LabelInfo *info      = isLabeled ? labelInfo(p->label) : NULL;
+        if (info) {
+            unsigned refs = 0;
+            for (struct Instruction *q = sub->entry; q != sub->last->next; q = q->next) {
+                if (isCode(q) && strcmp(q->operand, p->label) == 0) {
+                    refs++;
+                }
+            }
+            if (!isMovable(info) || refs != info->refs) {
+                return false;
+            }
+        }
+        if (p == sub->last) {
+            return true;
+        }
+    }
+}
+
+static unsigned hashSubroutine(const struct SubroutineCode *sub, bool *isComparable)
+{
+    unsigned hash = 2166136261u;
+    for (struct Instruction *p = sub->entry;; p = p->next) {
+        char operand[600];
+        if (isCode(p)) {
+            if (!normalizeOperand(sub, p, operand, sizeof operand)) {
+                *isComparable = false;
+                return 0;
+            }
+            hash = (hash ^ hashLabel(p->op, strlen(p->op))) * 16777619u;
+            hash = (hash ^ hashLabel(operand, strlen(operand))) * 16777619u;
+        }
+        if (p == sub->last) {
+            return hash;
+        }
+    }
+}
+
+static bool isSameSubroutine(const struct SubroutineCode *a, const struct SubroutineCode *b)
+{
+    struct Instruction *p = a->entry, *q = b->entry;
+    while (true) {
+        char operandA[600], operandB[600];
+        if (!normalizeOperand(a, p, operandA, sizeof operandA)
+            || !normalizeOperand(b, q, operandB, sizeof operandB)
+            || p->op != q->op || strcmp(operandA, operandB) != 0) {
+            return false;
+        }
+        if (p == a->last || q == b->last) {
+            return p == a->last && q == b->last;
+        }
+        p = nextCode(p);
+        q = nextCode(q);
+    }
+}
+
+// Fills subs with the subroutines of the code list and returns how many there
+// are. Subroutines start at a global label and only fall into themselves.
+static unsigned findSubroutines(struct SubroutineCode *subs)
+{
+    unsigned               count    = 0;
+    struct SubroutineCode *sub      = NULL;
+    struct Instruction    *prevCode = NULL;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (!isCode(p) && !p->assembly) {
+            continue;
+        }
+        if (p->assembly || (p->label[0] != '\0' && !isLocalLabel(p->label))) {
+            sub = NULL;
+        }
+        if (!sub && isCode(p) && p->label[0] != '\0' && !isLocalLabel(p->label)) {
+            sub             = &subs[count++];
+            sub->entry      = p;
+            sub->isFoldable = prevCode && isCode(prevCode) && isUnconditional(prevCode);
+        }
+        if (sub) {
+            sub->last = p;
+        }
+        prevCode = p;
+    }
+    return count;
+}
+
+// F1 ...  => F1 ...
+//    RTS        RTS
+// F2 ...     F2 EQU F1
+//    RTS
+static bool foldSubroutines(void)
+{
+    struct SubroutineCode *subs = calloc(blocks.len + 1, sizeof(*subs));
+    require(subs, "calloc failed");
+
+    unsigned               count = findSubroutines(subs);
+    struct SubroutineCode *sub   = NULL;
+    for (unsigned i = 0; i < count; i++) {
+        sub               = &subs[i];
+        sub->isComparable = isUnconditional(sub->last);
+        if (sub->isComparable) {
+            sub->hash = hashSubroutine(sub, &sub->isComparable);
+        }
+    }
+
+    bool changed = false;
+    for (unsigned j = 0; j < count; j++) {
+        sub = &subs[j];
+        if (!sub->isComparable || !sub->isFoldable || !isSelfContained(sub)) {
+            continue;
+        }
+        for (unsigned i = 0; i < j; i++) {
+            const struct SubroutineCode *same = &subs[i];
+            if (!same->isComparable || same->hash != sub->hash || !isSameSubroutine(same, sub)) {
+                continue;
+            }
+            // Keep its constants and parameters but none of its code.
+            struct Instruction *end = sub->last->next;
+            for (struct Instruction *p = sub->entry; p->next != end;) {
+                if (p->next->op == OP_EQU) {
+                    p = p->next;
+                } else {
+                    removeNextInstruction(p);
+                }
+            }
+            sub->entry->op = OP_EQU;
+            strcpy(sub->entry->operand, same->entry->label);
+            sub->isComparable = false;
+            changed           = true;
+            break;
+        }
+    }
+
+    free(subs);
+    return changed;
+}
+
+static void OptimizeControlFlow(void)
+{
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        bool (*passes[])(void) = {
+            collapseAliases,
+            replaceAlwaysBranches,
+            threadJumps,
+            removeUnreachable,
+            removeJumpsToNext,
+            invertBranchesOverJumps,
+            mergeBlocks,
+            removeUnusedLabels,
+            mergeTails,
+            foldSubroutines,
+        };
+        for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+            buildBlocks();
+            changed = passes[i]() || changed;
+        }
+    }
+}
+
+// Makes sure every branch reaches and frees what the passes used. This has to
+// be last since anything that moves code may put a label out of reach.
+static void FinishControlFlow(void)
+{
+    // Without the other passes, a branch may still name an alias defined after
+    // it, which an assembler only knows on its second pass.
+    buildBlocks();
+    collapseAliases();
+    for (buildBlocks(); relaxBranches(); buildBlocks()) {
+    }
+    if (TargetCpu() == CPU_65C02) {
+        shortenJumps();
+    }
+
+    forgetLabels();
+    free(blocks.items);
+    blocks.items = NULL;
+    blocks.len   = 0;
+    free(worklist.items);
+    worklist.items = NULL;
+
+    for (code = &codeHead; code->next; code = code->next) {
+    }
+}
@@ -0,0 +1,538 @@
+// Lists the program with what each instruction costs.
+//
+// Each line of code, including inline assembly, is listed after its address,
+// when that is known, how many bytes it takes and how many cycles. An indexed
+// read that may cross a page takes a cycle more, which is noted as +p, and a
+// branch takes one cycle more when it is taken, which is noted as 2/3. Where
+// the code is measured, a branch is known to cross a page or not.
+//
+// After each subroutine come the fewest and most cycles it takes to run, from
+// its entry to where it returns or jumps out, counting the subroutines it calls.
+// Those paths don't go back around loops, so each loop is listed with what one
+// time around it takes, without going around the loops inside it. Inline
+// assembly isn't followed, so a call to it is only noted.
+//
+// This file is included by asm.c after asm-layout.c.
+
+#include <limits.h>
+
+enum Addressing {
+    ADDRESSING_IMPLIED,
+    ADDRESSING_IMMEDIATE,
+    ADDRESSING_ZERO_PAGE,
+    ADDRESSING_ZERO_PAGE_INDEXED,
+    ADDRESSING_ABSOLUTE,
+    ADDRESSING_ABSOLUTE_INDEXED,
+    ADDRESSING_INDEXED_INDIRECT, // (zp,X)
+    ADDRESSING_INDIRECT_INDEXED, // (zp),Y
+    ADDRESSING_INDIRECT,
+    ADDRESSING_RELATIVE,
+};
+
+enum Crossing {
+    CROSS_NEVER,
+    CROSS_MAYBE,
+    CROSS_ALWAYS,
+};
+
+struct Timing {
+    unsigned      bytes;
+    unsigned      cycles; // without crossing a page or taking the branch
+    enum Crossing crossing;
+    bool          isBranch;
+    bool          isKnown;
+};
+
+// The fewest and most cycles something takes.
+struct Span {
+    unsigned best, worst;
+};
+
+static const struct Span NO_SPAN = { UINT_MAX, 0 };
+
+static const char *const READ_OPS[]
+    = { "ADC", "AND", "BIT", "CMP", "CPX", "CPY", "EOR", "LDA", "LDX", "LDY", "ORA", "SBC", NULL };
+static const char *const WRITE_OPS[]  = { "STA", "STX", "STY", "STZ", NULL };
+static const char *const MODIFY_OPS[] = { "ASL", "DEC", "INC", "LSR", "ROL", "ROR", "TRB", "TSB", NULL };
+static const char *const SHIFT_OPS[]  = { "ASL", "LSR", "ROL", "ROR", NULL };
+static const char *const PUSH_OPS[]   = { "PHA", "PHP", "PHX", "PHY", NULL };
+static const char *const PULL_OPS[]   = { "PLA", "PLP", "PLX", "PLY", NULL };
+
+static const uint8_t READ_CYCLES[ADDRESSING_RELATIVE + 1] = {
+    [ADDRESSING_IMMEDIATE]         = 2,
+    [ADDRESSING_ZERO_PAGE]         = 3,
+    [ADDRESSING_ZERO_PAGE_INDEXED] = 4,
+    [ADDRESSING_ABSOLUTE]          = 4,
+    [ADDRESSING_ABSOLUTE_INDEXED]  = 4,
+    [ADDRESSING_INDEXED_INDIRECT]  = 6,
+    [ADDRESSING_INDIRECT_INDEXED]  = 5,
+    [ADDRESSING_INDIRECT]          = 5,
+};
+static const uint8_t WRITE_CYCLES[ADDRESSING_RELATIVE + 1] = {
+    [ADDRESSING_ZERO_PAGE]         = 3,
+    [ADDRESSING_ZERO_PAGE_INDEXED] = 4,
+    [ADDRESSING_ABSOLUTE]          = 4,
+    [ADDRESSING_ABSOLUTE_INDEXED]  = 5,
+    [ADDRESSING_INDEXED_INDIRECT]  = 6,
+    [ADDRESSING_INDIRECT_INDEXED]  = 6,
+    [ADDRESSING_INDIRECT]          = 5,
+};
+static const uint8_t MODIFY_CYCLES[ADDRESSING_RELATIVE + 1] = {
+    [ADDRESSING_IMPLIED]           = 2,
+    [ADDRESSING_ZERO_PAGE]         = 5,
+    [ADDRESSING_ZERO_PAGE_INDEXED] = 6,
+    [ADDRESSING_ABSOLUTE]          = 6,
+    [ADDRESSING_ABSOLUTE_INDEXED]  = 7,
+};
+
+static enum Addressing addressingOf(const char *op, const char *operand, unsigned bytes)
+{
+    size_t len = strlen(operand);
+    if (len == 0 || strcmp(operand, "A") == 0) {
+        return ADDRESSING_IMPLIED;
+    }
+    if (operand[0] == '#') {
+        return ADDRESSING_IMMEDIATE;
+    }
+    if (isOneOf(op, RELATIVE_OPS)) {
+        return ADDRESSING_RELATIVE;
+    }
+    if (operand[0] == '(') {
+        if (len > 3 && strcasecmp(operand + len - 3, ",X)") == 0) {
+            return ADDRESSING_INDEXED_INDIRECT;
+        }
+        return len > 3 && strcasecmp(operand + len - 3, "),Y") == 0 ? ADDRESSING_INDIRECT_INDEXED : ADDRESSING_INDIRECT;
+    }
+    if (strchr(operand, ',')) {
+        return bytes == 2 ? ADDRESSING_ZERO_PAGE_INDEXED : ADDRESSING_ABSOLUTE_INDEXED;
+    }
+    return bytes == 2 ? ADDRESSING_ZERO_PAGE : ADDRESSING_ABSOLUTE;
+}
+
+// Returns whether the branch to operand, or the read indexed from it, crosses
+// a page when the instruction is at pc, if that's known.
+static enum Crossing crossingOf(enum Addressing mode, const char *operand, long pc)
+{
+    long target = evaluate(operand, pc);
+    if (mode == ADDRESSING_RELATIVE) {
+        return pc < 0 || target < 0 ? CROSS_MAYBE : ((pc + 2) ^ target) & 0xFF00 ? CROSS_ALWAYS : CROSS_NEVER;
+    }
+    // Nothing indexed from the start of a page leaves it.
+    return mode == ADDRESSING_ABSOLUTE_INDEXED && target >= 0 && (target & 0xFF) == 0 ? CROSS_NEVER : CROSS_MAYBE;
+}
+
+// Returns what op takes with operand at pc, which is -1 if that isn't known.
+static struct Timing timingOf(const char *op, const char *operand, long pc)
+{
+    struct Timing timing = { .isKnown = isOneOf(op, MNEMONICS) };
+    if (!timing.isKnown) {
+        return timing;
+    }
+    timing.bytes             = measureInstruction(op, operand, pc);
+    enum Addressing mode     = addressingOf(op, operand, timing.bytes);
+    bool            isCmos   = TargetCpu() == CPU_65C02;
+    bool            mayCross = false;
+    if (isOneOf(op, READ_OPS)) {
+        timing.cycles = READ_CYCLES[mode];
+        mayCross      = mode == ADDRESSING_ABSOLUTE_INDEXED || mode == ADDRESSING_INDIRECT_INDEXED;
+    } else if (isOneOf(op, WRITE_OPS)) {
+        timing.cycles = WRITE_CYCLES[mode];
+    } else if (isOneOf(op, MODIFY_OPS)) {
+        // The 65C02 only takes the extra cycle to shift across a page.
+        mayCross      = isCmos && mode == ADDRESSING_ABSOLUTE_INDEXED && isOneOf(op, SHIFT_OPS);
+        timing.cycles = MODIFY_CYCLES[mode] - mayCross;
+    } else if (mode == ADDRESSING_RELATIVE) {
+        timing.isBranch = strcmp(op, "BRA") != 0;
+        timing.cycles   = timing.isBranch ? 2 : 3;
+        mayCross        = true;
+    } else if (strcmp(op, "JMP") == 0) {
+        timing.cycles = mode == ADDRESSING_INDIRECT ? 5u + isCmos : mode == ADDRESSING_INDEXED_INDIRECT ? 6 : 3;
+    } else if (strcmp(op, "JSR") == 0 || strcmp(op, "RTS") == 0 || strcmp(op, "RTI") == 0) {
+        timing.cycles = 6;
+    } else if (strcmp(op, "BRK") == 0) {
+        timing.cycles = 7;
+    } else {
+        timing.cycles = isOneOf(op, PUSH_OPS) ? 3 : isOneOf(op, PULL_OPS) ? 4 : 2;
+    }
+    timing.crossing = mayCross ? crossingOf(mode, operand, pc) : CROSS_NEVER;
+    return timing;
+}
+
+// Returns what the instruction takes on its way to the one after it, or to the
+// branch's target when taken.
+static struct Span spanOf(const struct Timing *timing, bool isTaken)
+{
+    unsigned cycles   = timing->cycles + (timing->isBranch && isTaken);
+    bool     mayCross = !timing->isBranch || isTaken;
+    return (struct Span) {
+        cycles + (mayCross && timing->crossing == CROSS_ALWAYS),
+        cycles + (mayCross && timing->crossing != CROSS_NEVER),
+    };
+}
+
+static void formatTiming(char *out, size_t size, const struct Timing *timing)
+{
+    const char *penalty = timing->crossing == CROSS_MAYBE ? "+p" : "";
+    unsigned    crossed = timing->crossing == CROSS_ALWAYS;
+    if (!timing->isKnown) {
+        snprintf(out, size, "%s", "");
+    } else if (timing->isBranch) {
+        snprintf(out, size, "%u/%u%s", timing->cycles, timing->cycles + 1 + crossed, penalty);
+    } else {
+        snprintf(out, size, "%u%s", timing->cycles + crossed, penalty);
+    }
+}
+
+// Subroutines ----------------------------------------------------------------
+
+struct SubroutineTiming {
+    unsigned     first, last; // positions in flow
+    unsigned     bytes;
+    struct Span  cycles;
+    unsigned     unknownLen;
+    const char **unknowns; // calls to things that aren't timed, each once
+    enum { UNTIMED, TIMING, TIMED } state;
+};
+
+static struct {
+    unsigned                 len;
+    struct SubroutineTiming *items;
+    struct Timing           *timings; // of each code in flow
+    long                    *entries; // the subroutine starting at each, or -1
+} listing;
+
+static void timeSubroutine(struct SubroutineTiming *sub);
+
+static struct Span addSpans(struct Span a, struct Span b)
+{
+    return (struct Span) { a.best + b.best, a.worst + b.worst };
+}
+
+// Widens span to take in other.
+static void widenSpan(struct Span *span, struct Span other)
+{
+    span->best  = other.best < span->best ? other.best : span->best;
+    span->worst = other.worst > span->worst ? other.worst : span->worst;
+}
+
+// Notes that sub calls name, which isn't timed, unless it already has.
+static void addUnknown(struct SubroutineTiming *sub, const char *name)
+{
+    for (unsigned i = 0; i < sub->unknownLen; i++) {
+        if (strcmp(sub->unknowns[i], name) == 0) {
+            return;
+        }
+    }
+    sub->unknowns = realloc(sub->unknowns, (sub->unknownLen + 1) * sizeof(*sub->unknowns));
+    require(sub->unknowns, "realloc failed");
+    sub->unknowns[sub->unknownLen++] = name;
+}
+
+// Returns what the subroutine at position takes, noting in caller if that
+// isn't known.
+static struct Span calleeSpan(long position, const char *name, struct SubroutineTiming *caller)
+{
+    struct SubroutineTiming *callee = position >= 0 && listing.entries[position] >= 0
+        ? &listing.items[listing.entries[position]]
+        : NULL;
+    if (callee && callee->state == UNTIMED) {
+        timeSubroutine(callee);
+    }
+    if (!callee || callee->state != TIMED || callee->cycles.best == UINT_MAX) {
+        addUnknown(caller, name);
+        return (struct Span) { 0, 0 };
+    }
+    for (unsigned i = 0; i < callee->unknownLen && callee != caller; i++) {
+        addUnknown(caller, callee->unknowns[i]);
+    }
+    return callee->cycles;
+}
+
+// Returns what it takes to go from position k to position to, or to leave the
+// subroutine from k when to is -1.
+static struct Span edgeSpan(unsigned k, long to, struct SubroutineTiming *sub)
+{
+    const struct Instruction *p    = flow.items[k];
+    struct Span               span = spanOf(&listing.timings[k], to >= 0 && to != (long)k + 1);
+    if (p->op == OP_JSR) {
+        span = addSpans(span, calleeSpan(positionOf(p->operand), p->operand, sub));
+    }
+    return span;
+}
+
+// Finds the fewest and most cycles it takes to get from position from to each
+// one up to last without going back. Those it can't reach are NO_SPAN.
+static struct Span *timePaths(unsigned from, unsigned last, struct SubroutineTiming *sub)
+{
+    struct Span *at = calloc(last - from + 1, sizeof(*at));
+    require(at, "calloc failed");
+    for (unsigned k = from; k <= last; k++) {
+        at[k - from] = NO_SPAN;
+    }
+    at[0] = (struct Span) { 0, 0 };
+    for (unsigned k = from; k <= last; k++) {
+        unsigned succ[2], count = at[k - from].best == UINT_MAX ? 0 : successorsOf(k, succ);
+        for (unsigned i = 0; i < count; i++) {
+            if (succ[i] <= k || succ[i] > last) {
+                continue;
+            }
+            widenSpan(&at[succ[i] - from], addSpans(at[k - from], edgeSpan(k, succ[i], sub)));
+        }
+    }
+    return at;
+}
+
+static void timeSubroutine(struct SubroutineTiming *sub)
+{
+    sub->state      = TIMING;
+    sub->cycles     = NO_SPAN;
+    struct Span *at = timePaths(sub->first, sub->last, sub);
+    for (unsigned k = sub->first; k <= sub->last; k++) {
+        struct Span reached = at[k - sub->first];
+        if (reached.best == UINT_MAX) {
+            continue;
+        }
+        unsigned succ[2], count = successorsOf(k, succ);
+        if (count == 0) {
+            // Returns, or jumps to somewhere that isn't followed.
+            const struct Instruction *p = flow.items[k];
+            if (p->op == OP_JMP) {
+                addUnknown(sub, p->operand);
+            }
+            widenSpan(&sub->cycles, addSpans(reached, edgeSpan(k, -1, sub)));
+        }
+        for (unsigned i = 0; i < count; i++) {
+            if (succ[i] < sub->first || succ[i] > sub->last) {
+                // Goes on into another subroutine, like a JMP at the end.
+                struct Span span = addSpans(reached, edgeSpan(k, succ[i], sub));
+                widenSpan(&sub->cycles, addSpans(span, calleeSpan(succ[i], flow.items[succ[i]]->label, sub)));
+            }
+        }
+    }
+    free(at);
+    sub->state = TIMED;
+}
+
+static void findSubroutineTimings(void)
+{
+    struct SubroutineCode *subs = calloc(flow.len + 1, sizeof(*subs));
+    listing.entries             = calloc(flow.len + 1, sizeof(*listing.entries));
+    listing.timings             = calloc(flow.len + 1, sizeof(*listing.timings));
+    require(subs && listing.entries && listing.timings, "calloc failed");
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        listing.entries[k]          = -1;
+        if (!p->assembly) {
+            listing.timings[k] = timingOf(p->op, p->operand, layout.at[k]);
+        }
+    }
+
+    unsigned count = findSubroutines(subs);
+    listing.items  = calloc(count + 1, sizeof(*listing.items));
+    require(listing.items, "calloc failed");
+    unsigned k = 0;
+    for (unsigned i = 0; i < count; i++) {
+        struct SubroutineTiming *sub = &listing.items[listing.len++];
+        while (flow.items[k] != subs[i].entry) {
+            k++;
+        }
+        sub->first         = k;
+        listing.entries[k] = (long)i;
+        for (; flow.items[k] != subs[i].last; k++) {
+            sub->bytes += listing.timings[k].bytes;
+        }
+        sub->bytes += listing.timings[k].bytes;
+        sub->last = k;
+    }
+    free(subs);
+
+    for (unsigned i = 0; i < listing.len; i++) {
+        if (listing.items[i].state == UNTIMED) {
+            timeSubroutine(&listing.items[i]);
+        }
+    }
+}
+
+static void writeSpan(FILE *fp, struct Span span)
+{
+    if (span.best == span.worst) {
+        fprintf(fp, "%u", span.best);
+    } else {
+        fprintf(fp, "%u-%u", span.best, span.worst);
+    }
+}
+
+static void writeSubroutineTiming(FILE *fp, struct SubroutineTiming *sub)
+{
+    const char *name = flow.items[sub->first]->label;
+    if (sub->cycles.best == UINT_MAX) {
+        fprintf(fp, "* %s never returns; it takes %u bytes\n", name, sub->bytes);
+    } else {
+        fprintf(fp, "* %s takes ", name);
+        writeSpan(fp, sub->cycles);
+        fprintf(fp, " cycles and %u bytes", sub->bytes);
+        for (unsigned i = 0; i < sub->unknownLen; i++) {
+            const char *separator = i == 0 ? ", plus what " : i + 1 < sub->unknownLen ? ", " : " and ";
+            fprintf(fp, "%s%s", separator, sub->unknowns[i]);
+        }
+        if (sub->unknownLen > 0) {
+            fprintf(fp, " take%s", sub->unknownLen == 1 ? "s" : "");
+        }
+        fputc('\n', fp);
+    }
+
+    // Each loop, by where it goes back to, however many ways it gets there.
+    for (unsigned head = sub->first; head <= sub->last; head++) {
+        struct Span  around = NO_SPAN;
+        struct Span *at     = NULL;
+        for (unsigned k = head; k <= sub->last; k++) {
+            unsigned succ[2], count = successorsOf(k, succ);
+            for (unsigned i = 0; i < count; i++) {
+                if (succ[i] != head) {
+                    continue;
+                }
+                at = at ? at : timePaths(head, sub->last, sub);
+                if (at[k - head].best != UINT_MAX) {
+                    widenSpan(&around, addSpans(at[k - head], edgeSpan(k, head, sub)));
+                }
+            }
+        }
+        if (around.best != UINT_MAX) {
+            fprintf(fp, "*   each time around %s takes ", flow.items[head]->label);
+            writeSpan(fp, around);
+            fputs(" cycles\n", fp);
+        }
+        free(at);
+    }
+}
+
+// Listing --------------------------------------------------------------------
+
+static void writeListed(FILE *fp, long pc, unsigned bytes, const char *cycles, const char *line)
+{
+    char address[24] = "", size[16] = "";
+    if (pc >= 0 && bytes > 0) {
+        snprintf(address, sizeof address, "$%04lX", pc);
+    }
+    if (bytes > 0) {
+        snprintf(size, sizeof size, "%u", bytes);
+    }
+    fprintf(fp, "%-5s %2s %-7s %s\n", address, size, cycles, line);
+}
+
+// Lists each line of inline assembly, moving pc past them.
+static void writeListedAssembly(FILE *fp, const char *assembly, long *pc)
+{
+    for (const char *next = assembly; *next;) {
+        const char *end  = strchr(next, '\n');
+        size_t      len  = end ? (size_t)(end - next) : strlen(next);
+        char       *text = stringf("%.*s", (int)len, next);
+        next += len + (end != NULL);
+
+        long          at     = *pc;
+        struct Timing timing = { 0 };
+        size_t        labelLen;
+        char         *op, *operand, cycles[32];
+        if (!measureAssembly(text, pc)) {
+            *pc = -1;
+        }
+        char *line = strcopy(text);
+        if (splitAssemblyLine(line, &labelLen, &op, &operand)) {
+            timing = timingOf(op, operand, at);
+            if (!timing.isKnown) {
+                bool isPadding = at < 0 && strcmp(op, "DS") == 0;
+                long size      = at >= 0 && *pc >= at ? *pc - at : isPadding ? -1 : measureData(op, operand, at);
+                timing.bytes   = strcmp(op, "ORG") != 0 && size > 0 ? (unsigned)size : 0;
+            }
+        }
+        formatTiming(cycles, sizeof cycles, &timing);
+        writeListed(fp, at, timing.bytes, cycles, text);
+        free(line);
+        free(text);
+    }
+}
+
+static void writeListedInstruction(FILE *fp, const struct Instruction *p, long pc, const struct Timing *timing)
+{
+    char *line, cycles[32] = "";
+    if (p->comment) {
+        line = stringf("* %s", p->comment);
+    } else if (p->operand[0] != '\0') {
+        line = stringf("%s\t%s %s", p->label, p->op, p->operand);
+    } else {
+        line = stringf("%s\t%s", p->label, p->op);
+    }
+    if (timing) {
+        formatTiming(cycles, sizeof cycles, timing);
+    }
+    writeListed(fp, pc, timing ? timing->bytes : 0, cycles, line);
+    free(line);
+}
+
+void WriteCycles(FILE *fp)
+{
+    unsigned *depths;
+    long      end = measureFlow(&depths);
+    // Aliases are known even when the code isn't measured.
+    for (unsigned pass = 0; pass < 2; pass++) {
+        for (struct Instruction *p = codeHead.next; p; p = p->next) {
+            if (p->op == OP_EQU && addressOf(p->label, strlen(p->label)) < 0) {
+                defineAddress(p->label, strlen(p->label), evaluate(p->operand, -1));
+            }
+        }
+    }
+    long pc = end;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        defineAddress(p->label, strlen(p->label), p->op == OP_EQU ? evaluate(p->operand, pc) : pc);
+        if (pc >= 0 && p->op && p->op != OP_EQU) {
+            long size = measureData(p->op, p->operand, pc);
+            pc        = size >= 0 ? pc + size : -1;
+        }
+    }
+    findSubroutineTimings();
+
+    if (TargetCpu() == CPU_65C02) {
+        writeListed(fp, -1, 0, "", "\tXC");
+    }
+    unsigned sub = 0, k = 0;
+    pc           = -1;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->assembly) {
+            writeListedAssembly(fp, p->assembly, &pc);
+            k++;
+            continue;
+        }
+        if (!isCode(p)) {
+            writeListedInstruction(fp, p, -1, NULL);
+            continue;
+        }
+        pc = layout.at[k];
+        writeListedInstruction(fp, p, pc, &listing.timings[k]);
+        if (pc >= 0) {
+            pc += listing.timings[k].bytes;
+        }
+        if (sub < listing.len && listing.items[sub].last == k) {
+            writeSubroutineTiming(fp, &listing.items[sub++]);
+        }
+        k++;
+    }
+    pc = end;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        bool          isSized = p->op && p->op != OP_EQU && (pc >= 0 || p->op != OP_DS);
+        long          size    = isSized ? measureData(p->op, p->operand, pc) : -1;
+        struct Timing timing  = { .bytes = size > 0 ? (unsigned)size : 0 };
+        writeListedInstruction(fp, p, pc, p->op ? &timing : NULL);
+        if (pc >= 0 && size >= 0) {
+            pc += size;
+        }
+    }
+
+    for (unsigned i = 0; i < listing.len; i++) {
+        free(listing.items[i].unknowns);
+    }
+    free(listing.items);
+    free(listing.timings);
+    free(listing.entries);
+    memset(&listing, 0, sizeof listing);
+    forgetFlow(depths);
+}
@@ -0,0 +1,513 @@
+// Processor status flag dataflow.
+//
+// The macros set the carry before every ADC and SBC and compare before every
+// branch since they can't know what came before them. Following the C, N and Z
+// flags, and what A, X and Y were loaded with, through the code shows where that
+// is already done: a CLC after a branch that only falls through with the carry
+// clear, a CMP #0 after a load that set Z and N for the same register, or an
+// if that compares the same things as the one before it.
+//
+// This file is included by asm.c after asm-licm.c.
+
+enum Carry { CARRY_UNKNOWN, CARRY_CLEAR, CARRY_SET };
+
+struct FlagState {
+    bool        isKnown;  // control was found to get here
+    enum Carry  carry;
+    char        nz;       // the register that N and Z were set for, or 0
+    const char *compared; // what nz was compared with to set them, or NULL
+    const char *holds[3]; // the stable operand in A, X and Y, or NULL
+};
+
+static const char REGISTERS[] = "AXY";
+
+// The operand that a register holds after a branch on it being 0.
+static const char *ZERO = "#$00";
+
+static unsigned registerIndex(char reg) { return (unsigned)(strchr(REGISTERS, reg) - REGISTERS); }
+
+// Returns true if operand is an immediate number and sets value to it.
+static bool immediateValue(const char *operand, unsigned *value)
+{
+    char *end = NULL;
+    if (operand[0] != '#') {
+        return false;
+    }
+    if (operand[1] == '$') {
+        *value = (unsigned)strtoul(operand + 2, &end, 16);
+        return end != operand + 2 && *end == '\0';
+    }
+    if (operand[1] == '%') {
+        *value = (unsigned)strtoul(operand + 2, &end, 2);
+        return end != operand + 2 && *end == '\0';
+    }
+    *value = (unsigned)strtoul(operand + 1, &end, 10);
+    return end != operand + 1 && *end == '\0';
+}
+
+static bool isZero(const char *operand)
+{
+    unsigned value;
+    return immediateValue(operand, &value) && value == 0;
+}
+
+// Returns the register that p loads, transfers to or steps, or 0.
+static char registerWrittenBy(const struct Instruction *p)
+{
+    if (p->op == OP_LDA || p->op == OP_TXA || p->op == OP_TYA || p->op == OP_PLA || p->op == OP_ADC
+        || p->op == OP_SBC || p->op == OP_AND || p->op == OP_ORA || p->op == OP_EOR
+        || (isShift(p->op) && p->operand[0] == '\0') || isAccumulatorStep(p)) {
+        return 'A';
+    }
+    if (p->op == OP_LDX || p->op == OP_TAX || p->op == OP_INX || p->op == OP_DEX || p->op == OP_PLX) {
+        return 'X';
+    }
+    if (p->op == OP_LDY || p->op == OP_TAY || p->op == OP_INY || p->op == OP_DEY || p->op == OP_PLY) {
+        return 'Y';
+    }
+    return 0;
+}
+
+// Returns the register that p compares, or 0.
+static char registerComparedBy(const struct Instruction *p)
+{
+    if (p->op == OP_CMP) return 'A';
+    if (p->op == OP_CPX) return 'X';
+    if (p->op == OP_CPY) return 'Y';
+    return 0;
+}
+
+// Returns the register that p stores, or 0.
+static char registerStoredBy(const struct Instruction *p)
+{
+    if (p->op == OP_STA) return 'A';
+    if (p->op == OP_STX) return 'X';
+    if (p->op == OP_STY) return 'Y';
+    return 0;
+}
+
+// Returns true if nothing about the flags or registers changes over p.
+static bool isNeutral(const struct Instruction *p)
+{
+    return p->op == OP_NOP || p->op == OP_PHA || p->op == OP_PHX || p->op == OP_PHY || p->op == OP_CLV
+        || p->op == OP_JMP || p->op == OP_RTS || isBranch(p->op);
+}
+
+// Returns true if p may change what operand holds.
+static bool isChangedBy(const struct Instruction *p, const char *operand)
+{
+    if (operand[0] == '#') {
+        return false;
+    }
+    char name[sizeof p->operand];
+    variableOf(operand, name, sizeof name);
+    return isStoreTo(p, name);
+}
+
+static struct FlagState flagsAfter(const struct Instruction *p, struct FlagState state)
+{
+    const struct FlagState unknown = { .isKnown = true };
+    if (p->assembly || p->op == OP_JSR) {
+        return unknown;
+    }
+
+    for (unsigned i = 0; i < sizeof state.holds / sizeof state.holds[0]; i++) {
+        if (state.holds[i] && isChangedBy(p, state.holds[i])) {
+            state.holds[i] = NULL;
+        }
+    }
+    if (state.compared && isChangedBy(p, state.compared)) {
+        state.nz       = 0;
+        state.compared = NULL;
+    }
+
+    char reg = registerWrittenBy(p);
+    if (reg) {
+        const char *holds = NULL;
+        if (p->op == OP_LDA || p->op == OP_LDX || p->op == OP_LDY) {
+            holds = isStableOperand(p->operand) ? p->operand : NULL;
+        } else if (p->op == OP_TAX || p->op == OP_TAY) {
+            holds = state.holds[registerIndex('A')];
+        } else if (p->op == OP_TXA) {
+            holds = state.holds[registerIndex('X')];
+        } else if (p->op == OP_TYA) {
+            holds = state.holds[registerIndex('Y')];
+        }
+        state.holds[registerIndex(reg)] = holds;
+        state.nz                        = reg;
+        state.compared                  = NULL;
+        if (p->op == OP_ADC || p->op == OP_SBC || isShift(p->op)) {
+            state.carry = CARRY_UNKNOWN;
+        }
+        return state;
+    }
+
+    reg = registerComparedBy(p);
+    if (reg) {
+        // CMP #0 leaves the carry set and N and Z as they were loaded.
+        bool isStable  = isStableOperand(p->operand);
+        state.nz       = isStable ? reg : 0;
+        state.compared = isStable && !isZero(p->operand) ? p->operand : NULL;
+        state.carry    = isZero(p->operand) ? CARRY_SET : CARRY_UNKNOWN;
+        return state;
+    }
+
+    reg = registerStoredBy(p);
+    if (reg) {
+        if (isStableOperand(p->operand) && p->operand[0] != '#') {
+            state.holds[registerIndex(reg)] = p->operand;
+        }
+        return state;
+    }
+
+    if (p->op == OP_CLC || p->op == OP_SEC) {
+        state.carry = p->op == OP_CLC ? CARRY_CLEAR : CARRY_SET;
+        return state;
+    }
+    if (p->op == OP_STZ) {
+        return state;
+    }
+    if (p->op == OP_INC || p->op == OP_DEC || isShift(p->op) || p->op == OP_TSB || p->op == OP_TRB) {
+        state.nz       = 0;
+        state.compared = NULL;
+        state.carry    = isShift(p->op) ? CARRY_UNKNOWN : state.carry;
+        return state;
+    }
+    return isNeutral(p) ? state : unknown;
+}
+
+// Returns the state that control brings from k to succ, which a branch may
+// tell more about.
+static struct FlagState flagsAlong(unsigned k, unsigned succ, struct FlagState state)
+{
+    const struct Instruction *p = flow.items[k];
+    if (p->assembly || !isBranch(p->op)) {
+        return state;
+    }
+    long target = strcmp(p->operand, "*+2+1") == 0 ? (long)k + 2 : positionOf(p->operand);
+    if (target == (long)k + 1) {
+        return state;
+    }
+    bool isTaken = (long)succ == target;
+    if (p->op == OP_BCC || p->op == OP_BCS) {
+        state.carry = isTaken == (p->op == OP_BCS) ? CARRY_SET : CARRY_CLEAR;
+    }
+    bool isEqual = (p->op == OP_BEQ && isTaken) || (p->op == OP_BNE && !isTaken);
+    if (isEqual && state.nz) {
+        state.holds[registerIndex(state.nz)] = state.compared ? state.compared : ZERO;
+    }
+    return state;
+}
+
+static bool isSameOperand(const char *a, const char *b) { return a == b || (a && b && strcmp(a, b) == 0); }
+
+// Merges what is known along another way into state and returns true if that
+// changed it.
+static bool mergeFlags(struct FlagState *state, const struct FlagState *other)
+{
+    if (!state->isKnown) {
+        *state = *other;
+        return true;
+    }
+    struct FlagState before = *state;
+    if (state->carry != other->carry) {
+        state->carry = CARRY_UNKNOWN;
+    }
+    if (state->nz != other->nz || !isSameOperand(state->compared, other->compared)) {
+        state->nz       = 0;
+        state->compared = NULL;
+    }
+    for (unsigned i = 0; i < sizeof state->holds / sizeof state->holds[0]; i++) {
+        if (!isSameOperand(state->holds[i], other->holds[i])) {
+            state->holds[i] = NULL;
+        }
+    }
+    return memcmp(&before, state, sizeof before) != 0;
+}
+
+// Finds what is known about the flags and registers before each instruction.
+static struct FlagState *computeFlags(void)
+{
+    struct FlagState *in    = calloc(flow.len + 1, sizeof(*in));
+    unsigned         *stack = calloc(flow.len + 1, sizeof(*stack));
+    bool             *isOn  = calloc(flow.len + 1, sizeof(*isOn));
+    unsigned          len   = 0;
+    require(in && stack && isOn, "calloc failed");
+
+    const struct FlagState unknown = { .isKnown = true };
+    for (unsigned k = flow.len; k-- > 0;) {
+        if (isEntry(k)) {
+            in[k]         = unknown;
+            isOn[k]       = true;
+            stack[len++] = k;
+        }
+    }
+    while (len > 0) {
+        unsigned k = stack[--len];
+        isOn[k]    = false;
+
+        struct FlagState out = flagsAfter(flow.items[k], in[k]);
+        unsigned         succ[2], count = successorsOf(k, succ);
+        for (unsigned i = 0; i < count; i++) {
+            struct FlagState along = flagsAlong(k, succ[i], out);
+            if (mergeFlags(&in[succ[i]], &along) && !isOn[succ[i]]) {
+                isOn[succ[i]] = true;
+                stack[len++] = succ[i];
+            }
+        }
+    }
+    free(stack);
+    free(isOn);
+    return in;
+}
+
+enum Flag { FLAG_C, FLAG_NZ, FLAG_V };
+
+enum FlagUse { FLAG_KEPT, FLAG_READ, FLAG_SET };
+
+// Returns what p does with the flag.
+static enum FlagUse flagUseOf(const struct Instruction *p, enum Flag flag)
+{
+    if (p->assembly) {
+        return FLAG_READ;
+    }
+    // Subroutines take their inputs and give their outputs in registers and
+    // memory, never in the flags.
+    if (p->op == OP_RTS || p->op == OP_JMP || p->op == OP_JSR) {
+        return FLAG_KEPT;
+    }
+    switch (flag) {
+    case FLAG_C:
+        if (p->op == OP_ADC || p->op == OP_SBC || p->op == OP_ROL || p->op == OP_ROR || p->op == OP_BCC
+            || p->op == OP_BCS) {
+            return FLAG_READ;
+        }
+        if (p->op == OP_CLC || p->op == OP_SEC || p->op == OP_ASL || p->op == OP_LSR || registerComparedBy(p)) {
+            return FLAG_SET;
+        }
+        break;
+    case FLAG_NZ:
+        if (p->op == OP_BEQ || p->op == OP_BNE || p->op == OP_BMI || p->op == OP_BPL) {
+            return FLAG_READ;
+        }
+        if (registerWrittenBy(p) || registerComparedBy(p) || p->op == OP_INC || p->op == OP_DEC || isShift(p->op)) {
+            return FLAG_SET;
+        }
+        break;
+    case FLAG_V:
+        if (p->op == OP_BVC || p->op == OP_BVS) {
+            return FLAG_READ;
+        }
+        if (p->op == OP_CLV || p->op == OP_ADC || p->op == OP_SBC) {
+            return FLAG_SET;
+        }
+        break;
+    }
+    bool isKnown = registerWrittenBy(p) || registerComparedBy(p) || registerStoredBy(p) || isNeutral(p)
+        || p->op == OP_CLC || p->op == OP_SEC || p->op == OP_INC || p->op == OP_DEC || isShift(p->op)
+        || p->op == OP_STZ || p->op == OP_TSB || p->op == OP_TRB;
+    return isKnown ? FLAG_KEPT : FLAG_READ;
+}
+
+// Returns true if anything may read the flag that k leaves before something
+// else sets it.
+static bool isFlagUsedAfter(unsigned k, enum Flag flag)
+{
+    bool     *visited = calloc(flow.len + 1, sizeof(*visited));
+    unsigned *stack   = calloc(flow.len * 2 + 1, sizeof(*stack));
+    unsigned  len     = 0;
+    bool      isUsed  = false;
+    require(visited && stack, "calloc failed");
+
+    unsigned succ[2], count = successorsOf(k, succ);
+    for (unsigned i = 0; i < count; i++) {
+        stack[len++] = succ[i];
+    }
+    while (len > 0 && !isUsed) {
+        unsigned q = stack[--len];
+        if (visited[q]) {
+            continue;
+        }
+        visited[q] = true;
+
+        const struct Instruction *p   = flow.items[q];
+        enum FlagUse              use = flagUseOf(p, flag);
+        if (use == FLAG_READ) {
+            isUsed = true;
+        } else if (use == FLAG_KEPT) {
+            // A call keeps the flag for the subroutine, which may return it.
+            long callee = p->op == OP_JSR ? positionOf(p->operand) : -1;
+            if (callee >= 0 && !visited[callee]) {
+                stack[len++] = (unsigned)callee;
+            }
+            count = successorsOf(q, succ);
+            for (unsigned i = 0; i < count; i++) {
+                if (!visited[succ[i]]) {
+                    stack[len++] = succ[i];
+                }
+            }
+        }
+    }
+    free(visited);
+    free(stack);
+    return isUsed;
+}
+
+// Returns true if the instruction at k can go without moving what is after it.
+static bool isRemovable(unsigned k)
+{
+    const struct Instruction *p = flow.items[k];
+    if (k > 0 && isPinned(flow.items[k - 1])) {
+        return false;
+    }
+    if (p->label[0] != '\0') {
+        const struct Instruction *next = k + 1 < flow.len ? flow.items[k + 1] : NULL;
+        return isLocalLabel(p->label) && next && !next->assembly;
+    }
+    return true;
+}
+
+// Returns the carry that the SEC or CLC at k makes, if it leaves one.
+static enum Carry carryOf(const struct Instruction *p) { return p->op == OP_SEC ? CARRY_SET : CARRY_CLEAR; }
+
+// Returns the ADC or SBC of an immediate number that the CLC or SEC at k is for,
+// or NULL if there isn't one right after it.
+static struct Instruction *immediateMathAfter(unsigned k, unsigned *at)
+{
+    Operation math = flow.items[k]->op == OP_CLC ? OP_ADC : OP_SBC;
+    for (unsigned q = k + 1; q < flow.len; q++) {
+        struct Instruction *p = flow.items[q];
+        if (p->assembly || p->label[0] != '\0') {
+            return NULL;
+        }
+        unsigned value;
+        if (p->op == math && immediateValue(p->operand, &value) && value > 0 && value <= 0xFF) {
+            *at = q;
+            return p;
+        }
+        if (flagUseOf(p, FLAG_C) != FLAG_KEPT || isBranch(p->op) || isUnconditional(p)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Returns true if the instruction at k changes nothing given what is known
+// before it, so removing it leaves the state everywhere else the same.
+static bool isRedundant(unsigned k, const struct FlagState *state)
+{
+    const struct Instruction *p = flow.items[k];
+    if (p->op == OP_CLC || p->op == OP_SEC) {
+        return state->carry == carryOf(p);
+    }
+    char reg = registerComparedBy(p);
+    if (reg && state->nz == reg) {
+        // A CMP #0 after a load of the same register only sets the carry.
+        return isZero(p->operand) ? !state->compared && state->carry == CARRY_SET
+                                  : isSameOperand(state->compared, p->operand);
+    }
+    return false;
+}
+
+// Removes the instructions that don't change anything and returns true if
+// there were any.
+static bool removeRedundantFlags(const struct FlagState *in)
+{
+    bool *isRemoved = calloc(flow.len + 1, sizeof(*isRemoved));
+    require(isRemoved, "calloc failed");
+
+    bool changed = false;
+    for (unsigned k = 0; k < flow.len; k++) {
+        if (in[k].isKnown && !flow.items[k]->assembly && isRedundant(k, &in[k]) && isRemovable(k)) {
+            isRemoved[k] = true;
+            changed      = true;
+            Tally(registerComparedBy(flow.items[k]) ? "compares removed" : "carry changes removed");
+        }
+    }
+    unsigned k = 0;
+    for (struct Instruction *prev = &codeHead, *p = prev->next; p; p = prev->next) {
+        bool isItem = k < flow.len && flow.items[k] == p;
+        if (isItem && isRemoved[k++]) {
+            removeKeepingLabel(prev, p);
+        } else {
+            prev = p;
+        }
+    }
+    free(isRemoved);
+    return changed;
+}
+
+// Makes the first change that only holds with what is known before it and
+// returns true if there was one. Each of these can change what is known after
+// it so the flow has to be computed again.
+//
+//    BCS L    =>    BCS L        CMP #0   =>              LDA x    =>    ...
+//    ...            ...          BEQ L          BEQ L     ...
+// L  CLC         L  ADC #$01                              LDA x
+//    ADC #$02
+static bool simplifyFlags(const struct FlagState *in)
+{
+    for (unsigned k = 0; k < flow.len; k++) {
+        struct Instruction     *p     = flow.items[k];
+        const struct FlagState *state = &in[k];
+        if (!state->isKnown || p->assembly || !isRemovable(k)) {
+            continue;
+        }
+
+        // Adding with the carry set is adding one more.
+        unsigned            at;
+        struct Instruction *math = NULL;
+        if ((p->op == OP_CLC || p->op == OP_SEC) && state->carry != CARRY_UNKNOWN && state->carry != carryOf(p)) {
+            math = immediateMathAfter(k, &at);
+        }
+        bool isRemoved = math && !isFlagUsedAfter(at, FLAG_V);
+        if (isRemoved) {
+            unsigned value;
+            immediateValue(math->operand, &value);
+            snprintf(math->operand, sizeof math->operand, "#$%02X", value - 1);
+            Tally("carry changes removed");
+        }
+
+        char reg = registerComparedBy(p);
+        if (!isRemoved && reg && state->nz == reg && !state->compared && isZero(p->operand)
+            && !isFlagUsedAfter(k, FLAG_C)) {
+            Tally("compares removed");
+            isRemoved = true;
+        }
+
+        reg         = registerWrittenBy(p);
+        bool isLoad = p->op == OP_LDA || p->op == OP_LDX || p->op == OP_LDY;
+        if (!isRemoved && isLoad && isSameOperand(state->holds[registerIndex(reg)], p->operand)
+            && ((state->nz == reg && !state->compared) || !isFlagUsedAfter(k, FLAG_NZ))) {
+            Tally("loads removed");
+            isRemoved = true;
+        }
+
+        if (isRemoved) {
+            struct Instruction *prev = &codeHead;
+            while (prev->next != p) {
+                prev = prev->next;
+            }
+            removeKeepingLabel(prev, p);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void OptimizeFlags(void)
+{
+    indexLabels();
+    buildFlow();
+    while (!flow.isUnknown) {
+        struct FlagState *in      = computeFlags();
+        bool              changed = removeRedundantFlags(in) || simplifyFlags(in);
+        free(in);
+        if (!changed) {
+            break;
+        }
+        indexLabels();
+        buildFlow();
+    }
+    freeFlow();
+}
@@ -0,0 +1,364 @@
+// Inlining of subroutines at the JSRs that call them.
+//
+// A copy of a subroutine's code replaces a JSR to it when that doesn't make the
+// program bigger, like when it is the only call, or when the subroutine is a
+// small leaf and a few more bytes at each call are worth the 12 cycles of the
+// JSR and RTS. The arguments were already put in the parameters' locations and
+// registers before the JSR so the copy uses them where they are. The labels of
+// the copy are renamed, an RTS before its end becomes a JMP past it, and the
+// subroutine itself is deleted once nothing else refers to it.
+//
+// This file is included by asm.c after asm-reg.c.
+
+// Leaves with at most this many bytes of code are copied to every call, by
+// goal. For size, only copies that don't make the program bigger are made.
+static const unsigned MAX_INLINE_SIZE[] = {
+    [GOAL_BALANCED] = 16,
+    [GOAL_SIZE]     = 0,
+    [GOAL_SPEED]    = 32,
+};
+
+// The bytes that a JSR costs at the call.
+static const unsigned CALL_SIZE = 3;
+
+struct InlineHint {
+    char *name;
+    bool  isWanted; // inline rather than noinline
+    bool  isWarned;
+};
+
+static struct {
+    unsigned           len;
+    struct InlineHint *items;
+} inlineHints;
+
+static void addInlineHint(const char *subroutine, bool isWanted)
+{
+    inlineHints.items = realloc(inlineHints.items, (inlineHints.len + 1) * sizeof(*inlineHints.items));
+    require(inlineHints.items, "realloc failed");
+    inlineHints.items[inlineHints.len++] = (struct InlineHint) {
+        .name     = strcopy(subroutine),
+        .isWanted = isWanted,
+    };
+}
+
+void AlwaysInline(const char *subroutine) { addInlineHint(subroutine, true); }
+void NeverInline(const char *subroutine) { addInlineHint(subroutine, false); }
+
+// The subroutines whose code was deleted after being copied to every call.
+static struct {
+    unsigned len;
+    char   **items;
+} inlined;
+
+// Returns true if the subroutine named by the first len characters of name was
+// deleted after being inlined.
+static bool isInlined(const char *name, size_t len)
+{
+    for (unsigned i = 0; i < inlined.len; i++) {
+        if (strlen(inlined.items[i]) == len && strncmp(inlined.items[i], name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct InlineHint *inlineHintOf(const char *subroutine)
+{
+    for (unsigned i = 0; i < inlineHints.len; i++) {
+        if (strcmp(inlineHints.items[i].name, subroutine) == 0) {
+            return &inlineHints.items[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns why sub can't be copied or NULL if it can.
+static const char *checkInlinable(const struct SubroutineCode *sub)
+{
+    if (sub->last->op != OP_RTS) {
+        return "it doesn't end with RTS";
+    }
+    if (!isSelfContained(sub)) {
+        return "other code jumps into it";
+    }
+    for (struct Instruction *p = sub->entry;; p = p->next) {
+        if (p->assembly) {
+            return "it has inline assembly";
+        }
+        if (isCode(p) && p->operand[0] == '*') {
+            return "it has relative branches";
+        }
+        if (isCode(p) && isMentioned(p->operand, sub->entry->label)) {
+            return "it refers to itself";
+        }
+        if (isBranch(p->op) || p->op == OP_JMP) {
+            struct LabelInfo *target = jumpTarget(p->operand);
+            if (!target || positionIn(sub, target->at) < 0) {
+                return "it jumps out of itself";
+            }
+        }
+        if (p == sub->last) {
+            return NULL;
+        }
+    }
+}
+
+// Returns the bytes of sub's code, or of a copy of it where the last RTS is
+// dropped and any other becomes a JMP.
+static unsigned codeSizeOf(const struct SubroutineCode *sub, bool isCopy)
+{
+    unsigned size = 0;
+    for (struct Instruction *p = sub->entry; p != sub->last; p = p->next) {
+        size += isCopy && p->op == OP_RTS ? 3 : sizeOf(p);
+    }
+    return isCopy ? size : size + sizeOf(sub->last);
+}
+
+static bool isLeaf(const struct SubroutineCode *sub)
+{
+    for (struct Instruction *p = sub->entry;; p = p->next) {
+        if (p->op == OP_JSR) {
+            return false;
+        }
+        if (p == sub->last) {
+            return true;
+        }
+    }
+}
+
+// Returns true if p is a JSR to sub that a copy of it can replace.
+static bool isInlinableCall(const struct SubroutineCode *sub, const struct Instruction *p)
+{
+    return p->op == OP_JSR && strcmp(p->operand, sub->entry->label) == 0 && !isPinned(previousCode(p));
+}
+
+// Returns the number of references to sub that aren't from its own aliases.
+static unsigned outsideRefsTo(const struct SubroutineCode *sub)
+{
+    unsigned refs = labelInfo(sub->entry->label)->refs;
+    for (struct Instruction *p = sub->entry; p != sub->last; p = p->next) {
+        if (p->op == OP_EQU && isLocalLabel(p->label) && strcmp(p->operand, sub->entry->label) == 0) {
+            refs--;
+        }
+    }
+    return refs;
+}
+
+struct Rename {
+    const char *from;
+    char        to[16];
+};
+
+// Replaces the call after prev with a copy of sub.
+//
+//    JSR F    =>    ...
+//    ...            ...
+// F  ...
+//    RTS
+static void inlineCall(const struct SubroutineCode *sub, struct Instruction *prev)
+{
+    struct Instruction *call  = prev->next;
+    unsigned            count = 0;
+    for (struct Instruction *p = sub->entry; p != sub->last; p = p->next) {
+        count++;
+    }
+
+    // Only the labels that the copy jumps to are renamed.
+    struct Rename *renames = calloc(count + 1, sizeof(*renames));
+    require(renames, "calloc failed");
+    count = 0;
+    for (struct Instruction *p = sub->entry; p != sub->last; p = p->next) {
+        struct LabelInfo *target = isBranch(p->op) || p->op == OP_JMP ? jumpTarget(p->operand) : NULL;
+        bool              isNew  = target && target->at != sub->last;
+        for (unsigned i = 0; isNew && i < count; i++) {
+            isNew = strcmp(renames[i].from, target->name) != 0;
+        }
+        if (isNew) {
+            renames[count].from = target->name;
+            snprintf(renames[count].to, sizeof renames[count].to, "A2_%u", labels.next++);
+            count++;
+        }
+    }
+
+    // The call becomes a NOP to keep its label until the cleanup moves it.
+    call->op         = OP_NOP;
+    call->operand[0] = '\0';
+    // Returning, or jumping to the last RTS, goes to the end of the copy.
+    struct Instruction *end = Instruction(NULL, OP_NOP, NULL, NULL, NULL), *at = call;
+    for (struct Instruction *p = sub->entry; p != sub->last; p = p->next) {
+        struct Instruction *copy = NULL;
+        if (p->comment) {
+            copy = Instruction(NULL, NULL, NULL, NULL, strcopy(p->comment));
+        } else if (p->op == OP_RTS) {
+            copy = Instruction(NULL, OP_JMP, strcopy(labelOf(end)), NULL, NULL);
+        } else if (isCode(p)) {
+            copy = Instruction(NULL, p->op, strcopy(p->operand), NULL, NULL);
+            struct LabelInfo *target = isBranch(p->op) || p->op == OP_JMP ? jumpTarget(p->operand) : NULL;
+            if (target && target->at == sub->last) {
+                strcpy(copy->operand, labelOf(end));
+            }
+            for (unsigned i = 0; target && i < count; i++) {
+                if (strcmp(renames[i].from, target->name) == 0) {
+                    strcpy(copy->operand, renames[i].to);
+                }
+            }
+        }
+        if (!copy) {
+            continue;
+        }
+        for (unsigned i = 0; isCode(p) && i < count; i++) {
+            if (strcmp(renames[i].from, p->label) == 0) {
+                strcpy(copy->label, renames[i].to);
+            }
+        }
+        copy->next = at->next;
+        at->next   = copy;
+        at         = copy;
+    }
+    if (end->label[0] != '\0') {
+        end->next = at->next;
+        at->next  = end;
+    } else {
+        freeInstruction(end);
+        free(end);
+    }
+    if (call->label[0] == '\0') {
+        removeNextInstruction(prev);
+    }
+    free(renames);
+}
+
+// Returns the load that gets back what store just stored.
+static Operation reloadOf(const struct Instruction *store)
+{
+    if (store->op == OP_STA) return OP_LDA;
+    if (store->op == OP_STX) return OP_LDX;
+    if (store->op == OP_STY) return OP_LDY;
+    return NULL;
+}
+
+// Drops the load of an argument that was stored right before the copy of a
+// subroutine that starts by loading it.
+//
+//    STA F.x  =>    STA F.x
+//    LDA F.x
+static void removeReload(struct Instruction *store)
+{
+    struct Instruction *prev = store;
+    while (prev->next && !isCode(prev->next) && !prev->next->assembly) {
+        prev = prev->next;
+    }
+    struct Instruction *load = prev->next;
+    if (load && load->op == reloadOf(store) && load->label[0] == '\0'
+        && strcmp(load->operand, store->operand) == 0 && !areFlagsUsedAfter(load)) {
+        removeNextInstruction(prev);
+    }
+}
+
+// Deletes the code of sub, keeping its constants and parameters.
+static void deleteSubroutine(const struct SubroutineCode *sub)
+{
+    inlined.items = realloc(inlined.items, (inlined.len + 1) * sizeof(*inlined.items));
+    require(inlined.items, "realloc failed");
+    inlined.items[inlined.len++] = strcopy(sub->entry->label);
+
+    struct Instruction *prev = &codeHead;
+    while (prev->next != sub->entry) {
+        prev = prev->next;
+    }
+    struct Instruction *end = sub->last->next;
+    while (prev->next != end) {
+        struct Instruction *p = prev->next;
+        if (p->op == OP_EQU && !isLocalLabel(p->label)) {
+            prev = p;
+        } else {
+            removeNextInstruction(prev);
+        }
+    }
+}
+
+// Inlines the calls to the first subroutine worth it and returns true if there
+// was one.
+static bool inlineSubroutine(void)
+{
+    unsigned count = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        count++;
+    }
+    struct SubroutineCode *subs = calloc(count + 1, sizeof(*subs));
+    require(subs, "calloc failed");
+    count = findSubroutines(subs);
+
+    bool changed = false;
+    for (unsigned i = 0; i < count && !changed; i++) {
+        const struct SubroutineCode *sub  = &subs[i];
+        struct InlineHint           *hint = inlineHintOf(sub->entry->label);
+        if (hint && !hint->isWanted) {
+            continue;
+        }
+
+        unsigned calls = 0;
+        for (struct Instruction *p = codeHead.next; p; p = p->next) {
+            if (isInlinableCall(sub, p)) {
+                calls++;
+            }
+        }
+        if (calls == 0) {
+            continue;
+        }
+
+        const char *reason = checkInlinable(sub);
+        if (reason) {
+            if (hint && !hint->isWarned) {
+                warnf("Cannot inline %s since %s", sub->entry->label, reason);
+                hint->isWarned = true;
+            }
+            continue;
+        }
+
+        // Only a subroutine that nothing falls into can be deleted.
+        bool isDeleted = sub->isFoldable && outsideRefsTo(sub) == calls;
+        long size      = (long)codeSizeOf(sub, true);
+        long growth    = (long)calls * (size - CALL_SIZE) - (isDeleted ? (long)codeSizeOf(sub, false) : 0);
+        if (!hint && growth > 0 && !(isLeaf(sub) && size <= (long)MAX_INLINE_SIZE[OptimizationGoal()])) {
+            continue;
+        }
+
+        struct Instruction **stores = calloc(calls + 1, sizeof(*stores));
+        require(stores, "calloc failed");
+        unsigned storeCount = 0;
+        for (struct Instruction *prev = &codeHead; prev->next; prev = prev->next) {
+            if (!isInlinableCall(sub, prev->next)) {
+                continue;
+            }
+            struct Instruction *store = previousCode(prev->next);
+            bool                isSeam = prev->next->label[0] == '\0' && store && reloadOf(store);
+            inlineCall(sub, prev);
+            Tally("calls inlined");
+            if (isSeam) {
+                stores[storeCount++] = store;
+            }
+        }
+        if (isDeleted) {
+            deleteSubroutine(sub);
+        }
+
+        // The copies have to be indexed before following their jumps.
+        indexLabels();
+        for (unsigned j = 0; j < storeCount; j++) {
+            removeReload(stores[j]);
+        }
+        free(stores);
+        changed = true;
+    }
+
+    free(subs);
+    return changed;
+}
+
+static void InlineSubroutines(void)
+{
+    for (indexLabels(); inlineSubroutine(); indexLabels()) {
+    }
+}
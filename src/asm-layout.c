@@ -0,0 +1,850 @@
+// Lays out the data after the code so that indexing stays within a page.
+//
+// Reading or writing an address indexed by X or Y takes a cycle more when it
+// crosses into the next page, and so does a branch taken to another page. Each
+// array indexed in a loop, and each table declared with page, is kept within a
+// page, and each declared with align starts one. The rest of the data fills
+// the gaps left before the next page, which is padded with zeros.
+//
+// Where the pages start is only known when the program sets the origin with
+// ORG before the code and its inline assembly is simple enough to measure
+// here, the way the assembler will: an operand is in the zero page if it was
+// defined as one before it is used. Otherwise, only what was declared is laid
+// out, after a DS \ that pads to the next page.
+//
+// The variables can also be reserved after the program instead, so that their
+// zeros don't take up any of the image that has to be loaded. That storage,
+// starting at A2_BSS, is laid out the same way, but from a page of its own if
+// anything in it has to be, and is cleared by a loop at the start of the
+// program unless asked not to be.
+//
+// Before any of that, in a pass of its own, text literals that are the same, or
+// that end others, are pooled so that the program keeps one copy of their bytes.
+//
+// This file is included by asm.c after asm-math.c.
+
+#include <strings.h>
+
+// An address that the assembler would know at some point in the program.
+struct Address {
+    char name[256];
+    long value;
+};
+
+static struct {
+    unsigned        len;
+    struct Address *items;
+    long           *at; // of each code in flow, or -1
+} layout;
+
+static long addressOf(const char *name, size_t len)
+{
+    for (unsigned i = 0; i < layout.len; i++) {
+        if (strncmp(layout.items[i].name, name, len) == 0 && layout.items[i].name[len] == '\0') {
+            return layout.items[i].value;
+        }
+    }
+    return -1;
+}
+
+static void defineAddress(const char *name, size_t len, long value)
+{
+    if (len == 0 || len >= sizeof layout.items->name || value < 0) {
+        return;
+    }
+    for (unsigned i = 0; i < layout.len; i++) {
+        if (strncmp(layout.items[i].name, name, len) == 0 && layout.items[i].name[len] == '\0') {
+            layout.items[i].value = value;
+            return;
+        }
+    }
+    layout.items = realloc(layout.items, (layout.len + 1) * sizeof(*layout.items));
+    require(layout.items, "realloc failed");
+    struct Address *address = &layout.items[layout.len++];
+    snprintf(address->name, sizeof address->name, "%.*s", (int)len, name);
+    address->value = value;
+}
+
+// Returns the value of the expression at the start of text, like name+1 or
+// $3F8, or -1 if it isn't known yet. Merlin goes left to right, even for * and /.
+static long evaluate(const char *text, long pc)
+{
+    long value = 0;
+    char sign  = '+';
+    bool isLow = text[0] == '<', isHigh = text[0] == '>';
+    text += isLow || isHigh;
+    for (;;) {
+        long term = -1;
+        if (*text == '$') {
+            term = strtol(text + 1, (char **)&text, 16);
+        } else if (*text == '%') {
+            term = strtol(text + 1, (char **)&text, 2);
+        } else if (isdigit((unsigned char)*text)) {
+            term = strtol(text, (char **)&text, 10);
+        } else if (*text == '*') {
+            term = pc;
+            text++;
+        } else if (isLabelChar(*text)) {
+            const char *start = text;
+            while (isLabelChar(*text)) {
+                text++;
+            }
+            term = addressOf(start, (size_t)(text - start));
+        }
+        if (term < 0) {
+            return -1;
+        }
+        switch (sign) {
+        case '+':
+            value += term;
+            break;
+        case '-':
+            value -= term;
+            break;
+        case '*':
+            value *= term;
+            break;
+        case '/':
+            value = term ? value / term : 0;
+            break;
+        }
+        if (!strchr("+-*/", *text) || *text == '\0') {
+            break;
+        }
+        sign = *text++;
+    }
+    value &= 0xFFFF;
+    return isLow ? value & 0xFF : isHigh ? value >> 8 : value;
+}
+
+static bool isOneOf(const char *op, const char *const *ops)
+{
+    for (; *ops; ops++) {
+        if (strcmp(op, *ops) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *const MNEMONICS[] = {
+    "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRA", "BRK", "BVC", "BVS", "CLC",
+    "CLD", "CLI", "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR",
+    "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PHX", "PHY", "PLA", "PLP", "PLX", "PLY", "ROL",
+    "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "STZ", "TAX", "TAY", "TRB", "TSB",
+    "TSX", "TXA", "TXS", "TYA", NULL,
+};
+
+static const char *const RELATIVE_OPS[] = { "BCC", "BCS", "BEQ", "BMI", "BNE", "BPL", "BRA", "BVC", "BVS", NULL };
+
+// Returns true if op has a zero page mode for the index, which is '\0', 'X'
+// or 'Y'.
+static bool hasZeroPageMode(const char *op, char index)
+{
+    static const char *const NONE[]   = { "JMP", "JSR", NULL };
+    static const char *const NOT_X[]  = { "JMP", "JSR", "LDX", "STX", "CPX", "CPY", "TRB", "TSB", NULL };
+    static const char *const ONLY_Y[] = { "LDX", "STX", NULL };
+    switch (index) {
+    case 'X':
+        return !isOneOf(op, NOT_X) && (strcmp(op, "BIT") != 0 || TargetCpu() == CPU_65C02);
+    case 'Y':
+        return isOneOf(op, ONLY_Y);
+    default:
+        return !isOneOf(op, NONE);
+    }
+}
+
+// Returns how many bytes the assembler makes the instruction at pc.
+static unsigned measureInstruction(const char *op, const char *operand, long pc)
+{
+    if (operand[0] == '\0' || strcmp(operand, "A") == 0) {
+        return 1;
+    }
+    if (operand[0] == '#' || isOneOf(op, RELATIVE_OPS)) {
+        return 2;
+    }
+    if (operand[0] == '(') {
+        return strcmp(op, "JMP") == 0 ? 3 : 2;
+    }
+    const char *comma = strchr(operand, ',');
+    char        index = comma ? (char)toupper((unsigned char)comma[1]) : '\0';
+    long        value = evaluate(operand, pc);
+    return value >= 0 && value <= 0xFF && hasZeroPageMode(op, index) ? 2 : 3;
+}
+
+// Returns how many bytes of data the directive op makes, or -1 if it isn't one
+// that is known.
+static long measureData(const char *op, const char *operand, long pc)
+{
+    if (strcmp(op, "HEX") == 0) {
+        long digits = 0;
+        for (const char *ch = operand; isxdigit((unsigned char)*ch) || *ch == ','; ch++) {
+            digits += *ch != ',';
+        }
+        return digits / 2;
+    }
+    if (strcmp(op, "ASC") == 0 || strcmp(op, "STR") == 0) {
+        const char *end = operand[0] ? strchr(operand + 1, operand[0]) : NULL;
+        return end ? (long)(end - operand - 1) + (op[0] == 'S') : -1;
+    }
+    if (strcmp(op, "DS") == 0) {
+        return strcmp(operand, "\\") == 0 ? (0x100 - (pc & 0xFF)) & 0xFF : evaluate(operand, pc);
+    }
+    if (strcmp(op, "DFB") == 0 || strcmp(op, "DB") == 0 || strcmp(op, "DA") == 0 || strcmp(op, "DW") == 0) {
+        long count = 1;
+        for (const char *ch = operand; *ch; ch++) {
+            count += *ch == ',';
+        }
+        return op[1] == 'A' || op[1] == 'W' ? 2 * count : count;
+    }
+    return -1;
+}
+
+// Splits a line of inline assembly, label <tab> op <tab> operand ; comment,
+// upper-casing the op. Returns false if the whole line is a comment.
+static bool splitAssemblyLine(char *line, size_t *labelLen, char **op, char **operand)
+{
+    if (line[0] == '*' || line[0] == ';') {
+        return false;
+    }
+    const char *blank = " \t";
+    *labelLen         = strcspn(line, blank);
+    *op               = line + *labelLen + strspn(line + *labelLen, blank);
+    *operand          = *op + strcspn(*op, blank);
+    if (**operand) {
+        *(*operand)++ = '\0';
+        *operand += strspn(*operand, blank);
+    }
+    for (char *ch = *op; *ch; ch++) {
+        *ch = (char)toupper((unsigned char)*ch);
+    }
+    if (strcmp(*op, "ASC") != 0 && strcmp(*op, "STR") != 0) {
+        (*operand)[strcspn(*operand, blank)] = '\0';
+    }
+    return true;
+}
+
+// Follows the lines of inline assembly, moving pc past them. Returns false if
+// one is not understood.
+static bool measureAssembly(const char *assembly, long *pc)
+{
+    char line[256];
+    for (const char *text = assembly; *text;) {
+        const char *end = strchr(text, '\n');
+        size_t      len = end ? (size_t)(end - text) : strlen(text);
+        snprintf(line, sizeof line, "%.*s", (int)len, text);
+        text += len + (end != NULL);
+
+        const char *label = line;
+        size_t      labelLen;
+        char       *op, *operand;
+        if (!splitAssemblyLine(line, &labelLen, &op, &operand)) {
+            continue;
+        }
+
+        if (strcmp(op, "EQU") == 0 || strcmp(op, "=") == 0) {
+            defineAddress(label, labelLen, evaluate(operand, *pc));
+            continue;
+        }
+        if (strcmp(op, "ORG") == 0) {
+            *pc = evaluate(operand, *pc);
+            if (*pc < 0) {
+                return false;
+            }
+            continue;
+        }
+        if (op[0] == '\0' || strcmp(op, "XC") == 0) {
+            defineAddress(label, labelLen, *pc);
+            continue;
+        }
+        if (*pc < 0) {
+            return false;
+        }
+        defineAddress(label, labelLen, *pc);
+        long size = isOneOf(op, MNEMONICS) ? measureInstruction(op, operand, *pc) : measureData(op, operand, *pc);
+        if (size < 0) {
+            return false;
+        }
+        *pc += size;
+    }
+    return true;
+}
+
+// Finds the address of each code in flow and returns where the code ends, or
+// -1 if that isn't known.
+static long measureCode(void)
+{
+    long pc = -1;
+    for (unsigned k = 0; k < flow.len; k++) {
+        layout.at[k] = -1;
+    }
+    unsigned k = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->op == OP_EQU) {
+            defineAddress(p->label, strlen(p->label), evaluate(p->operand, pc));
+            continue;
+        }
+        if (p->assembly) {
+            k++;
+            if (!measureAssembly(p->assembly, &pc)) {
+                return -1;
+            }
+            continue;
+        }
+        if (!isCode(p)) {
+            continue;
+        }
+        if (pc < 0) {
+            return -1;
+        }
+        defineAddress(p->label, strlen(p->label), pc);
+        layout.at[k++] = pc;
+        pc += measureInstruction(p->op, p->operand, pc);
+    }
+    // Aliases of code that comes after them.
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->op == OP_EQU && addressOf(p->label, strlen(p->label)) < 0) {
+            defineAddress(p->label, strlen(p->label), evaluate(p->operand, pc));
+        }
+    }
+    return pc;
+}
+
+// Data -----------------------------------------------------------------------
+
+enum DataPlacement {
+    DATA_ANYWHERE,
+    DATA_IN_PAGE,
+    DATA_ON_PAGE,
+};
+
+// A variable or table and the lines of the data list that it takes.
+struct DataBlock {
+    struct Instruction *first, *last;
+    unsigned            size;
+    unsigned            order;
+    enum DataPlacement  placement;
+    bool                isIndexed;  // in a loop
+    bool                isReserved; // after the program
+};
+
+static struct {
+    unsigned len;
+    struct {
+        char name[256];
+        bool isAligned;
+    } *items;
+} placements;
+
+void PAGE(const char *name, bool isAligned)
+{
+    placements.items = realloc(placements.items, (placements.len + 1) * sizeof(*placements.items));
+    require(placements.items, "realloc failed");
+    snprintf(placements.items[placements.len].name, sizeof placements.items->name, "%s", name);
+    placements.items[placements.len++].isAligned = isAligned;
+}
+
+static unsigned dataSize(const struct Instruction *p)
+{
+    if (p->op == OP_HEX) {
+        return (unsigned)strlen(p->operand) / 2;
+    }
+    if (p->op == OP_ASC) {
+        return (unsigned)strlen(p->operand) - 2;
+    }
+    return 0;
+}
+
+// Splits the data list into blocks, each starting at a label.
+static struct DataBlock *findDataBlocks(unsigned *count)
+{
+    *count = 0;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        *count += isData(p) && p->label[0] != '\0';
+    }
+    struct DataBlock *blocks = calloc(*count + 1, sizeof(*blocks));
+    require(blocks, "calloc failed");
+
+    struct DataBlock *block = NULL;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (isData(p) && p->label[0] != '\0') {
+            block        = &blocks[block ? block - blocks + 1 : 0];
+            block->first = p;
+            block->order = (unsigned)(block - blocks);
+        }
+        if (block) {
+            block->last = p;
+            block->size += dataSize(p);
+        }
+    }
+    return blocks;
+}
+
+static struct DataBlock *findDataBlock(struct DataBlock *blocks, unsigned count, const char *name, size_t len)
+{
+    for (unsigned i = 0; i < count; i++) {
+        if (strncmp(blocks[i].first->label, name, len) == 0 && blocks[i].first->label[len] == '\0') {
+            return &blocks[i];
+        }
+    }
+    // It may have been overlaid with another.
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op == OP_EQU && strncmp(p->label, name, len) == 0 && p->label[len] == '\0') {
+            return findDataBlock(blocks, count, p->operand, strlen(p->operand));
+        }
+    }
+    return NULL;
+}
+
+// Marks the blocks that code in a loop indexes with X or Y.
+static void findIndexedBlocks(struct DataBlock *blocks, unsigned count, const unsigned *depths)
+{
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        if (depths[k] == 0 || !isCode(p) || p->operand[0] == '(' || p->operand[0] == '#') {
+            continue;
+        }
+        if (!strchr(p->operand, ',')) {
+            continue;
+        }
+        size_t            len   = strcspn(p->operand, "+-,");
+        struct DataBlock *block = findDataBlock(blocks, count, p->operand, len);
+        if (block) {
+            block->isIndexed = true;
+        }
+    }
+}
+
+static bool fitsAt(const struct DataBlock *block, long pc)
+{
+    switch (block->placement) {
+    case DATA_ON_PAGE:
+        return (pc & 0xFF) == 0;
+    case DATA_IN_PAGE:
+        return (pc & 0xFF) + block->size <= 0x100;
+    case DATA_ANYWHERE:
+        break;
+    }
+    return true;
+}
+
+static struct Instruction *appendBlock(struct Instruction *tail, struct DataBlock *block)
+{
+    tail->next        = block->first;
+    block->last->next = NULL;
+    block->first      = NULL; // laid out
+    return block->last;
+}
+
+static struct Instruction *appendZeros(struct Instruction *tail, unsigned count)
+{
+    static const unsigned maxPerLine = 16;
+    for (unsigned n; count > 0; count -= n) {
+        n    = count < maxPerLine ? count : maxPerLine;
+        tail = tail->next = Instruction(NULL, OP_HEX, stringf("%.*x", 2 * n, 0), NULL, NULL);
+    }
+    return tail;
+}
+
+// Appends the blocks from pc on, placing the ones that need to be first and
+// filling the rest of each page with the others in their order.
+static struct Instruction *placeDataBlocks(struct DataBlock *blocks, unsigned count, struct Instruction *tail, long *pc)
+{
+    for (;;) {
+        struct DataBlock *next      = NULL;
+        bool              isWaiting = false;
+        for (unsigned i = 0; i < count && !next; i++) {
+            struct DataBlock *block = &blocks[i];
+            if (block->first && block->placement != DATA_ANYWHERE) {
+                isWaiting = true;
+                next      = fitsAt(block, *pc) ? block : NULL;
+            }
+        }
+        for (unsigned i = 0; i < count && !next && isWaiting; i++) {
+            struct DataBlock *block = &blocks[i];
+            if (block->first && block->placement == DATA_ANYWHERE && (*pc & 0xFF) + block->size <= 0x100) {
+                next = block;
+            }
+        }
+        if (next) {
+            if (next->placement != DATA_ANYWHERE) {
+                Tally("arrays kept in a page");
+            }
+            tail = appendBlock(tail, next);
+            *pc += next->size;
+        } else if (isWaiting) {
+            unsigned pad = (unsigned)(0x100 - (*pc & 0xFF));
+            tail         = appendZeros(tail, pad);
+            *pc += pad;
+        } else {
+            break;
+        }
+    }
+    for (unsigned i = 0; i < count; i++) {
+        if (blocks[i].first) {
+            tail = appendBlock(tail, &blocks[i]);
+            *pc += blocks[i].size;
+        }
+    }
+    return tail;
+}
+
+// What's in the image comes first, and the biggest of what has to be placed
+// comes first of that, so the small ones fill in after it.
+static int byPlacement(const void *a, const void *b)
+{
+    const struct DataBlock *x = a, *y = b;
+    if (x->isReserved != y->isReserved) {
+        return x->isReserved ? 1 : -1;
+    }
+    if ((x->placement == DATA_ANYWHERE) != (y->placement == DATA_ANYWHERE)) {
+        return x->placement == DATA_ANYWHERE ? 1 : -1;
+    }
+    if (x->placement != DATA_ANYWHERE && x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// Text pooling ---------------------------------------------------------------
+
+// A text literal from TXT: its ASC, which the HEX 00 that ends it follows.
+struct Text {
+    struct Instruction *asc;
+    size_t              len; // without the quotes
+    bool                isPlaced;
+    bool                isShared;
+};
+
+static bool isText(const struct Instruction *p)
+{
+    return p->op == OP_ASC && p->label[0] != '\0' && p->next && p->next->op == OP_HEX && p->next->label[0] == '\0'
+        && strcmp(p->next->operand, "00") == 0;
+}
+
+static bool isPlacedByName(const char *name)
+{
+    for (unsigned i = 0; i < placements.len; i++) {
+        if (strcmp(placements.items[i].name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the text of y ends with that of x, zero and all.
+static bool endsWith(const struct Text *y, const struct Text *x)
+{
+    return y->len >= x->len && memcmp(y->asc->operand + 1 + y->len - x->len, x->asc->operand + 1, x->len) == 0;
+}
+
+// Shares the text literals across the program: each that is the same as
+// another, or ends it, becomes an EQU into the longest of those, since both end
+// with the same zero. A text kept in a page keeps its own bytes.
+static void PoolText(void)
+{
+    unsigned count = 0;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        count += isText(p);
+    }
+    struct Text *texts = calloc(count + 1, sizeof(*texts));
+    require(texts, "calloc failed");
+    count = 0;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (isText(p)) {
+            texts[count++] = (struct Text) {
+                .asc      = p,
+                .len      = strlen(p->operand) - 2,
+                .isPlaced = isPlacedByName(p->label),
+            };
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct Text *text = &texts[i], *root = NULL;
+        if (text->isPlaced) {
+            continue;
+        }
+        for (unsigned j = 0; j < count; j++) {
+            struct Text *other = &texts[j];
+            bool isLonger = other->len > text->len || (other->len == text->len && j < i);
+            if (!other->isShared && isLonger && endsWith(other, text) && (!root || other->len > root->len)) {
+                root = other;
+            }
+        }
+        if (!root) {
+            continue;
+        }
+        size_t              offset = root->len - text->len;
+        struct Instruction *zero   = text->asc->next;
+        text->asc->op              = OP_EQU;
+        if (offset > 0) {
+            setOperand(text->asc, stringf("%s+%zu", root->asc->label, offset));
+        } else {
+            setOperand(text->asc, strcopy(root->asc->label));
+        }
+        // It's defined after the root, so the assembler knows it on its first pass.
+        struct Instruction *prev = &dataHead;
+        while (prev->next != text->asc) {
+            prev = prev->next;
+        }
+        prev->next = zero->next;
+        data       = data == zero ? prev : data;
+
+        struct Instruction *after = root->asc->next;
+        while (after->next && after->next->op == OP_EQU) {
+            after = after->next;
+        }
+        text->asc->next = after->next;
+        after->next     = text->asc;
+        data            = data == after ? text->asc : data;
+        freeInstruction(zero);
+        free(zero);
+        text->isShared = true;
+        Tally("texts shared");
+        TallyBy("bytes of text saved by sharing", (unsigned)text->len + 1);
+    }
+    free(texts);
+}
+
+// Reserved storage -----------------------------------------------------------
+
+// Returns where the program starts: after the ORG in the inline assembly that
+// comes first, which is split there, or else before the first code.
+static struct Instruction *programStart(void)
+{
+    struct Instruction *prev = &codeHead;
+    while (prev->next && !prev->next->assembly && !isCode(prev->next)) {
+        prev = prev->next;
+    }
+    struct Instruction *first = prev->next;
+    if (!first || !first->assembly) {
+        return prev;
+    }
+    for (char *line = first->assembly; *line;) {
+        size_t      len = strcspn(line, "\n");
+        const char *op  = line + strcspn(line, " \t\n");
+        op += strspn(op, " \t");
+        line += len + (line[len] == '\n');
+        if (strncasecmp(op, "ORG", 3) != 0 || !strchr(" \t\n", op[3]) || op[3] == '\0') {
+            continue;
+        }
+        if (*line) {
+            struct Instruction *rest = Instruction(NULL, NULL, NULL, strcopy(line), NULL);
+            rest->next               = first->next;
+            first->next              = rest;
+            *line                    = '\0';
+            code                     = code == first ? rest : code;
+        }
+        return first;
+    }
+    return prev;
+}
+
+// Clears the size bytes at A2_BSS when the program starts: each whole page in
+// one loop over X, then what's left in another.
+static void clearStorage(unsigned size)
+{
+    struct Instruction  head = { 0 }, *tail = &head;
+    bool                isC02 = TargetCpu() == CPU_65C02;
+    Operation           store = isC02 ? OP_STZ : OP_STA;
+    unsigned            pages = size / 0x100, rest = size % 0x100;
+
+    if (!isC02) {
+        tail = tail->next = Instruction(NULL, OP_LDA, strcopy("#$00"), NULL, NULL);
+    }
+    if (pages > 0) {
+        tail = tail->next = isC02 ? Instruction(NULL, OP_LDX, strcopy("#$00"), NULL, NULL)
+                                  : Instruction(NULL, OP_TAX, NULL, NULL, NULL);
+        struct Instruction *top = NULL;
+        for (unsigned page = 0; page < pages; page++) {
+            char *operand = page ? stringf("A2_BSS+%u,X", page * 0x100) : strcopy("A2_BSS,X");
+            tail          = tail->next = Instruction(NULL, store, operand, NULL, NULL);
+            top           = top ? top : tail;
+        }
+        tail = tail->next = Instruction(NULL, OP_INX, NULL, NULL, NULL);
+        tail = tail->next = Instruction(NULL, OP_BNE, strcopy(labelOf(top)), NULL, NULL);
+    }
+    if (rest > 0) {
+        char *operand = pages ? stringf("A2_BSS+%u,X", pages * 0x100 - 1) : strcopy("A2_BSS-1,X");
+        tail          = tail->next = Instruction(NULL, OP_LDX, stringf("#$%02X", rest), NULL, NULL);
+        struct Instruction *top = tail = tail->next = Instruction(NULL, store, operand, NULL, NULL);
+        tail = tail->next = Instruction(NULL, OP_DEX, NULL, NULL, NULL);
+        tail = tail->next = Instruction(NULL, OP_BNE, strcopy(labelOf(top)), NULL, NULL);
+    }
+
+    struct Instruction *start = programStart();
+    tail->next                = start->next;
+    start->next               = head.next;
+    code                      = code == start ? tail : code;
+}
+
+// Takes the blocks out of the data list and lays them out after A2_BSS, which
+// is on a page of its own if any of them need to be. Returns the labels that
+// take their place.
+static struct Instruction *reserveStorage(struct DataBlock *blocks, unsigned count)
+{
+    bool isPlaced = false;
+    for (unsigned i = 0; i < count; i++) {
+        isPlaced = isPlaced || blocks[i].placement != DATA_ANYWHERE;
+    }
+    struct Instruction  head = { 0 };
+    long                pc   = 0;
+    placeDataBlocks(blocks, count, &head, &pc);
+
+    struct Instruction *labels = Instruction("A2_BSS", OP_EQU, strcopy(isPlaced ? "*+255/256*256" : "*"), NULL, NULL);
+    struct Instruction *tail   = labels;
+    unsigned            offset = 0;
+    for (struct Instruction *p = head.next, *next; p; p = next) {
+        next = p->next;
+        if (p->op == OP_EQU) {
+            // Another variable that overlays this one.
+            tail = tail->next = p;
+            continue;
+        }
+        if (p->label[0] != '\0') {
+            char *operand = offset ? stringf("A2_BSS+%u", offset) : strcopy("A2_BSS");
+            tail = tail->next = Instruction(p->label, OP_EQU, operand, NULL, NULL);
+            Tally("variables reserved after the program");
+        }
+        offset += dataSize(p);
+        freeInstruction(p);
+        free(p);
+    }
+    tail->next = NULL;
+
+    if (VariableStorage() == STORAGE_CLEARED && offset > 0) {
+        clearStorage(offset);
+    }
+    return labels;
+}
+
+// Warns about the arrays and branches in loops that cross a page when the code
+// is measured, since each time they do takes a cycle more.
+static void warnAboutPages(const struct DataBlock *blocks, unsigned count, const unsigned *depths)
+{
+    for (unsigned i = 0; i < count; i++) {
+        long at        = addressOf(blocks[i].first->label, strlen(blocks[i].first->label));
+        bool isFitting = blocks[i].size <= 0x100;
+        if (blocks[i].isIndexed && isFitting && at >= 0 && (at & 0xFF) + blocks[i].size > 0x100) {
+            warnf("%s crosses a page at $%04lX and is indexed in a loop", blocks[i].first->label, (at | 0xFF) + 1);
+        }
+    }
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        if (depths[k] == 0 || layout.at[k] < 0 || !(isBranch(p->op) || p->op == OP_BRA)) {
+            continue;
+        }
+        long target = evaluate(p->operand, layout.at[k]);
+        long next   = layout.at[k] + 2;
+        if (target >= 0 && (target & 0xFF00) != (next & 0xFF00)) {
+            warnf("branch at $%04lX to %s crosses a page in a loop", layout.at[k], p->operand);
+        }
+    }
+}
+
+// Measures the code, finding where each of it is, and the loops around it.
+static long measureFlow(unsigned **depths)
+{
+    buildFlow();
+    layout.len = 0;
+    layout.at  = calloc(flow.len + 1, sizeof(*layout.at));
+    require(layout.at, "calloc failed");
+    *depths = loopDepths();
+    return measureCode();
+}
+
+static void forgetFlow(unsigned *depths)
+{
+    free(depths);
+    free(layout.at);
+    free(layout.items);
+    memset(&layout, 0, sizeof layout);
+    freeFlow();
+}
+
+static void LayOutData(void)
+{
+    unsigned *depths;
+    long      end = measureFlow(&depths);
+
+    unsigned          count;
+    struct DataBlock *blocks = findDataBlocks(&count);
+    if (OptimizationGoal() != GOAL_SIZE) {
+        findIndexedBlocks(blocks, count, depths);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        blocks[i].isReserved = VariableStorage() != STORAGE_IN_IMAGE && blocks[i].first->isReserved;
+        if (blocks[i].isIndexed && blocks[i].size <= 0x100 && (end >= 0 || blocks[i].isReserved)) {
+            blocks[i].placement = DATA_IN_PAGE;
+        }
+    }
+    for (unsigned i = 0; i < placements.len; i++) {
+        const char       *name  = placements.items[i].name;
+        struct DataBlock *block = findDataBlock(blocks, count, name, strlen(name));
+        if (block) {
+            bool isAligned   = placements.items[i].isAligned || block->size > 0x100;
+            block->placement = isAligned ? DATA_ON_PAGE : DATA_IN_PAGE;
+        }
+    }
+    qsort(blocks, count, sizeof(*blocks), byPlacement);
+    unsigned images   = 0;
+    bool     isPlaced = false;
+    for (; images < count && !blocks[images].isReserved; images++) {
+        isPlaced = isPlaced || blocks[images].placement != DATA_ANYWHERE;
+    }
+
+    // Whatever comes before the first label stays first.
+    struct Instruction *tail = &dataHead;
+    long                pc   = end;
+    while (tail->next && !(isData(tail->next) && tail->next->label[0] != '\0')) {
+        tail = tail->next;
+        pc += dataSize(tail);
+    }
+
+    struct Instruction *reserved = NULL;
+    if (images < count) {
+        reserved = reserveStorage(blocks + images, count - images);
+        // The code that clears it moved everything after, so it's measured
+        // again, with the rest of the data as it was.
+        struct Instruction *last = tail;
+        for (unsigned i = 0; i < images; i++) {
+            last->next = blocks[i].first;
+            last       = blocks[i].last;
+        }
+        last->next = reserved;
+        forgetFlow(depths);
+        end = measureFlow(&depths);
+        pc  = end;
+        for (struct Instruction *p = dataHead.next; p != tail->next; p = p->next) {
+            pc += dataSize(p);
+        }
+    }
+    if (isPlaced || reserved) {
+        if (end < 0 && isPlaced) {
+            tail = tail->next = Instruction(NULL, OP_DS, strcopy("\\"), NULL, NULL);
+            pc                = 0;
+        }
+        tail       = placeDataBlocks(blocks, images, tail, &pc);
+        tail->next = reserved;
+        while (tail->next) {
+            tail = tail->next;
+        }
+        data = tail;
+    }
+    free(blocks);
+
+    if (end >= 0 && OptimizationGoal() == GOAL_SPEED) {
+        // The data moved, so it's measured again.
+        pc = end;
+        for (struct Instruction *p = dataHead.next; p; p = p->next) {
+            defineAddress(p->label, strlen(p->label), p->op == OP_EQU ? evaluate(p->operand, pc) : pc);
+            pc += p->op == OP_DS ? measureData(p->op, p->operand, pc) : dataSize(p);
+        }
+        blocks = findDataBlocks(&count);
+        findIndexedBlocks(blocks, count, depths);
+        warnAboutPages(blocks, count, depths);
+        free(blocks);
+    }
+    forgetFlow(depths);
+}
@@ -0,0 +1,300 @@
+// Loop-invariant code motion for the index registers.
+//
+// The offset of a subscript or the high byte of an address is often loaded
+// into X or Y on every pass of a loop even though it can't change there. When
+// every load of the register in a loop is the same and nothing in the loop
+// changes what it loads, one load on the way into the loop is enough. The
+// register must not be needed where the loop is entered and nothing else in the
+// loop may use it, so what the register allocator kept there stays put.
+//
+// This file is included by asm.c after asm-inline.c.
+
+// Returns true if p may change the variable name.
+static bool isStoreTo(const struct Instruction *p, const char *name)
+{
+    bool isStore = p->op == OP_STA || p->op == OP_STX || p->op == OP_STY || p->op == OP_STZ
+        || p->op == OP_INC || p->op == OP_DEC || p->op == OP_TSB || p->op == OP_TRB
+        || (isShift(p->op) && p->operand[0] != '\0');
+    return isStore && (p->operand[0] == '(' || isMentioned(p->operand, name));
+}
+
+// Copies the variable that operand names, without any offset, into name.
+static void variableOf(const char *operand, char *name, size_t size)
+{
+    snprintf(name, size, "%.*s", (int)strcspn(operand, "+"), operand);
+}
+
+// Returns true if loading operand gets the same value for as long as the
+// variable it names doesn't change, unlike a soft switch would.
+static bool isStableOperand(const char *operand)
+{
+    if (operand[0] == '#') {
+        return true;
+    }
+    if (operand[0] == '\0' || strpbrk(operand, ",()")) {
+        return false;
+    }
+    char name[sizeof dataHead.operand];
+    variableOf(operand, name, sizeof name);
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op == OP_HEX && strcmp(p->label, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Removes the loads of an index register that get what it already has.
+//
+//    LDY i    =>    LDY i
+//    LDA a,Y        LDA a,Y
+//    LDY i          STA b,Y
+//    STA b,Y
+static void removeRepeatedLoads(void)
+{
+    const char *registers[] = { "Y", "X" };
+    for (unsigned i = 0; i < sizeof registers / sizeof registers[0]; i++) {
+        struct IndexRegister reg = indexRegister(registers[i][0]);
+        for (struct Instruction *load = codeHead.next; load; load = load->next) {
+            if (load->op != reg.load || !isStableOperand(load->operand)) {
+                continue;
+            }
+            char name[sizeof load->operand];
+            variableOf(load->operand, name, sizeof name);
+
+            struct Instruction *prev = load;
+            for (struct Instruction *p = nextCode(prev); p && p->label[0] == '\0'; p = nextCode(prev)) {
+                if (p->op == reg.load && strcmp(p->operand, load->operand) == 0 && !isPinned(previousCode(p))
+                    && !areFlagsUsedAfter(p)) {
+                    while (prev->next != p) {
+                        prev = prev->next;
+                    }
+                    removeNextInstruction(prev);
+                    continue;
+                }
+                if (endsBlock(p) || p->op == OP_JSR || writesDirectly(p, &reg) || isStoreTo(p, name)) {
+                    break;
+                }
+                prev = p;
+            }
+        }
+    }
+}
+
+struct LoopEntry {
+    unsigned from, to;
+};
+
+// Returns true if a load can go before p without changing where it goes, since
+// the load only changes the N and Z flags.
+static bool isLoadableBefore(const struct Instruction *p)
+{
+    return p->op == OP_JMP || p->op == OP_BCC || p->op == OP_BCS || p->op == OP_BVC || p->op == OP_BVS;
+}
+
+// Finds the ways into the code from top to bottom and returns how many there
+// are, or 0 if a load can't be put on one of them. Falling into top, and
+// jumping or branching on C or V from outside are the only ways that can get
+// one.
+static unsigned entriesOf(unsigned top, unsigned bottom, struct LoopEntry *entries)
+{
+    if (top == 0 || isPinned(flow.items[top - 1])) {
+        return 0;
+    }
+    for (unsigned k = top; k <= bottom; k++) {
+        if (isEntry(k)) {
+            return 0;
+        }
+    }
+    unsigned count = 0;
+    for (unsigned k = 0; k < flow.len; k++) {
+        if (k >= top && k <= bottom) {
+            continue;
+        }
+        unsigned succ[2], n = successorsOf(k, succ);
+        for (unsigned i = 0; i < n; i++) {
+            if (succ[i] < top || succ[i] > bottom) {
+                continue;
+            }
+            bool isFall = k + 1 == top && succ[i] == top;
+            bool isJump = isLoadableBefore(flow.items[k]) && k > 0 && !isPinned(flow.items[k - 1]);
+            if (!isFall && !isJump) {
+                return 0;
+            }
+            entries[count++] = (struct LoopEntry) { k, succ[i] };
+        }
+    }
+    return count;
+}
+
+// Returns the operand that the loop loads the register with everywhere it
+// changes it, or NULL if there isn't one that stays the same.
+static const char *invariantLoadIn(unsigned top, unsigned bottom, const struct IndexRegister *reg)
+{
+    const char *operand = NULL;
+    bool        hasCall = false;
+    for (unsigned k = top; k <= bottom; k++) {
+        struct Instruction *p = flow.items[k];
+        if (p->op == reg->load && !p->assembly) {
+            if (operand && strcmp(operand, p->operand) != 0) {
+                return NULL;
+            }
+            if (isPinned(flow.items[k - 1]) || areFlagsUsedAfter(p)) {
+                return NULL;
+            }
+            operand = p->operand;
+            continue;
+        }
+        if (writesRegister(k, reg)) {
+            return NULL;
+        }
+        hasCall = hasCall || p->op == OP_JSR;
+    }
+    if (!operand || !isStableOperand(operand)) {
+        return NULL;
+    }
+    if (operand[0] == '#') {
+        return operand;
+    }
+    if (hasCall) {
+        return NULL;
+    }
+
+    char name[sizeof flow.items[0]->operand];
+    variableOf(operand, name, sizeof name);
+    for (unsigned k = top; k <= bottom; k++) {
+        if (isStoreTo(flow.items[k], name)) {
+            return NULL;
+        }
+    }
+    return operand;
+}
+
+// Returns true if the load for the entry goes after where it comes from rather
+// than before.
+static bool isFallEntry(const struct LoopEntry *entry) { return entry->from + 1 == entry->to; }
+
+// Returns the instruction that a load on the entry goes after.
+static struct Instruction *preheaderOf(const struct LoopEntry *entry)
+{
+    struct Instruction *from = flow.items[entry->from];
+    if (isFallEntry(entry)) {
+        return from;
+    }
+    struct Instruction *prev = flow.items[entry->from - 1];
+    while (prev->next != from) {
+        prev = prev->next;
+    }
+    return prev;
+}
+
+// Moves the loads of the register in the loop to its entries.
+//
+//    ...          =>    ...
+//                       LDY x
+// L  LDY x           L  LDA a,Y
+//    LDA a,Y            ...
+//    ...                BNE L
+//    BNE L
+static void hoistLoad(unsigned top, unsigned bottom, const struct LoopEntry *entries, unsigned count,
+    const struct IndexRegister *reg, const char *operand)
+{
+    struct Instruction *first = flow.items[top], *last = flow.items[bottom];
+    char               *value = strcopy(operand);
+
+    // The places are found first since the loads change what comes before.
+    struct Instruction **befores = calloc(count + 1, sizeof(*befores));
+    require(befores, "calloc failed");
+    for (unsigned i = 0; i < count; i++) {
+        befores[i] = preheaderOf(&entries[i]);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        // A branch to top that also falls into it needs only the one load.
+        bool isDone = false;
+        for (unsigned j = 0; j < i; j++) {
+            isDone = isDone || befores[j] == befores[i];
+        }
+        if (!isDone) {
+            struct Instruction *load = Instruction(NULL, reg->load, strcopy(value), NULL, NULL);
+            load->next               = befores[i]->next;
+            befores[i]->next         = load;
+        }
+    }
+    free(befores);
+
+    struct Instruction *prev = &codeHead;
+    while (prev->next != first) {
+        prev = prev->next;
+    }
+    for (struct Instruction *p = prev->next; p; p = prev->next) {
+        bool isLast = p == last;
+        if (p->op == reg->load && strcmp(p->operand, value) == 0) {
+            removeKeepingLabel(prev, p);
+        } else {
+            prev = p;
+        }
+        if (isLast) {
+            break;
+        }
+    }
+    free(value);
+}
+
+// Hoists an invariant load out of the first loop that has one and returns true
+// if there was one.
+static bool hoistInvariant(void)
+{
+    struct LoopEntry *entries = calloc(flow.len + 1, sizeof(*entries));
+    require(entries, "calloc failed");
+
+    bool changed = false;
+    for (unsigned top = 0; top < flow.len && !changed; top++) {
+        // The loop goes from top to the last branch back to it.
+        unsigned bottom = top;
+        for (unsigned k = top; k < flow.len; k++) {
+            struct Instruction *p = flow.items[k];
+            if (!p->assembly && (isBranch(p->op) || p->op == OP_JMP) && positionOf(p->operand) == (long)top) {
+                bottom = k;
+            }
+        }
+        unsigned count  = bottom > top ? entriesOf(top, bottom, entries) : 0;
+        bool     isSafe = count > 0;
+        for (unsigned i = 0; i < count && isSafe; i++) {
+            isSafe = !areFlagsUsedAfter(preheaderOf(&entries[i]));
+        }
+
+        const char *registers[] = { "Y", "X" };
+        for (unsigned i = 0; i < sizeof registers / sizeof registers[0] && isSafe && !changed; i++) {
+            struct IndexRegister reg     = indexRegister(registers[i][0]);
+            const char          *operand = invariantLoadIn(top, bottom, &reg);
+            if (!operand) {
+                continue;
+            }
+            computeLiveness("", &reg);
+            bool isLive = false;
+            for (unsigned j = 0; j < count; j++) {
+                const struct LoopEntry *entry = &entries[j];
+                isLive = isLive || flow.regIn[isFallEntry(entry) ? entry->to : entry->from];
+            }
+            if (!isLive) {
+                hoistLoad(top, bottom, entries, count, &reg, operand);
+                Tally("loads hoisted out of loops");
+                changed = true;
+            }
+        }
+    }
+    free(entries);
+    return changed;
+}
+
+static void HoistInvariants(void)
+{
+    removeRepeatedLoads();
+    indexLabels();
+    buildFlow();
+    while (!flow.isUnknown && hoistInvariant()) {
+        indexLabels();
+        buildFlow();
+    }
+    freeFlow();
+}
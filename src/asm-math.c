@@ -0,0 +1,1211 @@
+// Multiplication, division and modulo.
+//
+// The 6502 can't multiply or divide, so by a constant the macros here shift
+// and add. Horner's rule goes through the digits of the constant from the top,
+// doubling for each one and adding the number for each 1, so x*10 is
+// ((x*2)*2+x)*2. Signed digits turn a run of 1s into a subtraction, so x*15 is
+// x*16-x, and whichever of the two takes fewer cycles is used. A byte is
+// divided by a constant by multiplying it by the reciprocal scaled up by 2^s,
+// for an s where that is exact for every byte, and keeping the bits above s,
+// which ROR gets by shifting each partial sum down as it goes. Powers of 2 only
+// take shifts or a mask.
+//
+// Variables call a routine instead. Bytes are multiplied with a table of n*n/4
+// since a*b is (a+b)*(a+b)/4 - (a-b)*(a-b)/4, words with three of those, and
+// dividing shifts and subtracts a bit at a time. LinkRuntime appends only the
+// routines that were called, and their tables, after the code.
+//
+// Shifts and rotates by a constant pick the quickest way around for the number
+// of bits, like moving bytes for 8 or swapping nibbles for 4, and by a variable
+// loop a bit at a time.
+//
+// This file is included by asm.c after asm-overlay.c.
+
+// Where a macro keeps the number it started with, and a word it works on.
+static const char *const SCRATCH = "A2_MATH";
+
+static struct {
+    bool scratch;
+    bool multiply, multiplyWords;
+    bool divide, divideWords;
+} runtime;
+
+// Shifting a byte in memory takes 6 cycles, and loading it, shifting A and
+// storing it back takes 8 more, so up to 2 shifts are done in place.
+static const unsigned MAX_MEMORY_SHIFTS = 2;
+
+// About how many cycles Horner's rule takes for a doubling or an addition.
+// Adding a word takes a CLC and two each of LDA, ADC and STA. Shifting it 8 or
+// more moves the low byte to the high one and shifts that in A instead.
+static const unsigned BYTE_SHIFT_CYCLES = 2;
+static const unsigned BYTE_ADD_CYCLES   = 6;
+static const unsigned WORD_SHIFT_CYCLES = 12;
+static const unsigned WORD_MOVE_CYCLES  = 14;
+static const unsigned WORD_ADD_CYCLES   = 26;
+
+static struct Operand *scratch(unsigned offset, uint8_t size)
+{
+    runtime.scratch = true;
+    if (offset == 0) {
+        return OpAbsolute(SCRATCH, size);
+    }
+    return OpOffset(SCRATCH, stringf("%u", offset), false, size);
+}
+
+// Returns true if operand is in memory that can be read and changed in place
+// without loading an index register.
+static bool isPlainMemory(const struct Operand *operand)
+{
+    return operand->mode == MODE_ABSOLUTE || operand->mode == MODE_OFFSET;
+}
+
+static bool isConstant(const struct Operand *operand)
+{
+    return operand->mode == MODE_IMMEDIATE && operand->number.valid;
+}
+
+static bool isPowerOf2(uint16_t number) { return (number & (number - 1)) == 0; }
+
+static unsigned log2Of(uint16_t number)
+{
+    unsigned bits = 0;
+    while (number > 1) {
+        number >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+// Returns the byte at offset 0 or 1 of the word in plain memory.
+static struct Operand *byteOf(const struct Operand *word, unsigned offset)
+{
+    if (word->mode == MODE_ABSOLUTE) {
+        return offset == 0 ? OpAbsolute(word->base, 1) : OpOffset(word->base, strcopy("1"), false, 1);
+    }
+    return OpOffset(word->base, offset == 0 ? strcopy(word->offset) : stringf("%s+1", word->offset), false, 1);
+}
+
+// Stores A to the byte dst, which may be a register.
+static void storeAccumulator(const struct Operand *dst)
+{
+    if (dst->mode == MODE_REGISTER) {
+        transfer(regLow(dst), 'A');
+        return;
+    }
+    storeByte(dst);
+}
+
+// Returns the plain memory that the word dst is worked on in, copying it into
+// the scratch variable if it isn't there already.
+static struct Operand *workOn(const struct Operand *dst)
+{
+    if (isPlainMemory(dst)) {
+        return (struct Operand *)dst;
+    }
+    struct Operand *work = scratch(2, 2);
+    COPY(work, dst);
+    return work;
+}
+
+// Copies work back to dst if workOn had to copy it.
+static void finishWork(const struct Operand *dst, struct Operand *work)
+{
+    if (work != dst) {
+        COPY(dst, work);
+        FreeOperand(work);
+    }
+}
+
+// Shifts the word in plain memory left by n bits.
+//
+//    ASL w    =>    LDA w        for 9
+//    ROL w+1        ASL
+//    ...            STA w+1
+//                   LDA #0
+//                   STA w
+static void shiftWordLeft(const struct Operand *word, unsigned n)
+{
+    struct Operand *lo = byteOf(word, 0), *hi = byteOf(word, 1);
+    if (n >= 8) {
+        loadByte('A', lo);
+        for (unsigned i = 8; i < n; i++) {
+            ASL(NULL);
+        }
+        storeByte(hi);
+        copyByte(lo, &ZEROB);
+    } else {
+        char *lsb = operandString(lo), *msb = operandString(hi);
+        for (unsigned i = 0; i < n; i++) {
+            ASL(strcopy(lsb));
+            ROL(strcopy(msb));
+        }
+        free(msb);
+        free(lsb);
+    }
+    FreeOperand(hi);
+    FreeOperand(lo);
+}
+
+// Shifts the word in plain memory right by n bits.
+static void shiftWordRight(const struct Operand *word, unsigned n)
+{
+    struct Operand *lo = byteOf(word, 0), *hi = byteOf(word, 1);
+    if (n >= 8) {
+        loadByte('A', hi);
+        for (unsigned i = 8; i < n; i++) {
+            LSR(NULL);
+        }
+        storeByte(lo);
+        copyByte(hi, &ZEROB);
+    } else {
+        char *lsb = operandString(lo), *msb = operandString(hi);
+        for (unsigned i = 0; i < n; i++) {
+            LSR(strcopy(msb));
+            ROR(strcopy(lsb));
+        }
+        free(msb);
+        free(lsb);
+    }
+    FreeOperand(hi);
+    FreeOperand(lo);
+}
+
+// Shifts the byte dst by n bits with shift, in place when that's cheaper.
+static void shiftByte(const struct Operand *dst, unsigned n, void (*shift)(char *))
+{
+    if (isPlainMemory(dst) && n <= MAX_MEMORY_SHIFTS) {
+        char *operand = operandString(dst);
+        for (unsigned i = 0; i < n; i++) {
+            shift(strcopy(operand));
+        }
+        free(operand);
+        return;
+    }
+    loadByte('A', dst);
+    for (unsigned i = 0; i < n; i++) {
+        shift(NULL);
+    }
+    storeAccumulator(dst);
+}
+
+// Constant factors ----------------------------------------------------------
+
+// The digits of a factor, most significant first, each -1, 0 or 1.
+struct Digits {
+    unsigned len;
+    int8_t   items[17];
+};
+
+static struct Digits binaryDigits(uint16_t factor)
+{
+    struct Digits digits = { 0 };
+    for (unsigned bit = 16; bit-- > 0;) {
+        int8_t digit = (factor >> bit) & 1;
+        if (digits.len > 0 || digit) {
+            digits.items[digits.len++] = digit;
+        }
+    }
+    return digits;
+}
+
+// Returns the signed digits of factor with no two nonzero ones together, which
+// has the fewest of them. Those above the bits of a number width bytes wide
+// are dropped since they only carry out of it. There are none if the top digit
+// left would be -1.
+static struct Digits signedDigits(uint16_t factor, uint8_t width)
+{
+    int8_t   low[17];
+    unsigned count = 0;
+    for (uint32_t n = factor; n > 0; n /= 2) {
+        int8_t digit = 0;
+        if (n & 1) {
+            digit = (n & 3) == 1 ? 1 : -1;
+            n     = digit > 0 ? n - 1 : n + 1;
+        }
+        low[count++] = digit;
+    }
+    if (count > 8u * width) {
+        count = 8u * width;
+    }
+    while (count > 0 && low[count - 1] == 0) {
+        count--;
+    }
+
+    struct Digits digits = { 0 };
+    if (count == 0 || low[count - 1] < 0) {
+        return digits;
+    }
+    while (count > 0) {
+        digits.items[digits.len++] = low[--count];
+    }
+    return digits;
+}
+
+static unsigned nonzeroDigits(const struct Digits *digits)
+{
+    unsigned count = 0;
+    for (unsigned i = 0; i < digits->len; i++) {
+        count += digits->items[i] != 0;
+    }
+    return count;
+}
+
+static unsigned shiftCycles(unsigned n, uint8_t width)
+{
+    if (width == 1) {
+        return n * BYTE_SHIFT_CYCLES;
+    }
+    return n < 8 ? n * WORD_SHIFT_CYCLES : WORD_MOVE_CYCLES + (n - 8) * BYTE_SHIFT_CYCLES;
+}
+
+// Returns about how many cycles Horner's rule takes over digits.
+static unsigned hornerCycles(const struct Digits *digits, uint8_t width)
+{
+    unsigned cycles = 0, run = 0;
+    for (unsigned i = 1; i < digits->len; i++) {
+        run++;
+        if (digits->items[i] != 0) {
+            cycles += shiftCycles(run, width) + (width == 1 ? BYTE_ADD_CYCLES : WORD_ADD_CYCLES);
+            run = 0;
+        }
+    }
+    return cycles + shiftCycles(run, width);
+}
+
+// Returns the digits of factor that are quickest to multiply a number width
+// bytes wide by.
+static struct Digits factorDigits(uint16_t factor, uint8_t width)
+{
+    struct Digits binary = binaryDigits(factor), sign = signedDigits(factor, width);
+    if (sign.len > 0 && hornerCycles(&sign, width) < hornerCycles(&binary, width)) {
+        return sign;
+    }
+    return binary;
+}
+
+// A *= digits, where x is what A starts as.
+static void multiplyAccumulator(const struct Digits *digits, const char *x)
+{
+    for (unsigned i = 1; i < digits->len; i++) {
+        ASL(NULL);
+        if (digits->items[i] > 0) {
+            CLC();
+            ADC(strcopy(x));
+        } else if (digits->items[i] < 0) {
+            SEC();
+            SBC(strcopy(x));
+        }
+    }
+}
+
+// Multiplies the byte dst by a constant.
+//
+//    x *= 10   =>    LDA x
+//                    ASL
+//                    ASL
+//                    CLC
+//                    ADC x
+//                    ASL
+//                    STA x
+static void timesByte(const struct Operand *dst, uint8_t factor)
+{
+    if (factor == 0) {
+        COPY(dst, &ZEROB);
+        return;
+    }
+    if (factor == 1) {
+        REM(strcopy("Optimized out *= 1"));
+        return;
+    }
+    Tally("multiplies done by shifts and adds");
+    struct Digits digits = factorDigits(factor, 1);
+    if (nonzeroDigits(&digits) == 1) {
+        shiftByte(dst, digits.len - 1, ASL);
+        return;
+    }
+
+    loadByte('A', dst);
+    struct Operand *x = NULL;
+    if (!isPlainMemory(dst)) {
+        x = scratch(0, 1);
+        storeByte(x);
+    }
+    char *operand = operandString(x ? x : dst);
+    multiplyAccumulator(&digits, operand);
+    storeAccumulator(dst);
+    free(operand);
+    FreeOperand(x);
+}
+
+// Multiplies the word dst by a constant.
+//
+//    w *= 10   =>    (copy w to A2_MATH)
+//                    ASL w
+//                    ROL w+1
+//                    ASL w
+//                    ROL w+1
+//                    (add A2_MATH to w)
+//                    ASL w
+//                    ROL w+1
+static void timesWord(const struct Operand *dst, uint16_t factor)
+{
+    if (factor == 0) {
+        COPY(dst, &ZEROB);
+        return;
+    }
+    if (factor == 1) {
+        REM(strcopy("Optimized out *= 1"));
+        return;
+    }
+    Tally("multiplies done by shifts and adds");
+    struct Digits   digits = factorDigits(factor, 2);
+    struct Operand *work   = workOn(dst),
+                   *x      = NULL;
+    if (nonzeroDigits(&digits) > 1) {
+        x = scratch(0, 2);
+        COPY(x, work);
+    }
+    unsigned run = 0;
+    for (unsigned i = 1; i < digits.len; i++) {
+        run++;
+        if (digits.items[i] != 0) {
+            shiftWordLeft(work, run);
+            mathMacro(digits.items[i] > 0 ? &addition : &subtract, work, work, x);
+            run = 0;
+        }
+    }
+    if (run > 0) {
+        shiftWordLeft(work, run);
+    }
+    finishWork(dst, work);
+    FreeOperand(x);
+}
+
+// Returns about how many cycles dividing a byte by the reciprocal of divisor
+// scaled up by 2^shift takes, or 0 if that isn't exact for every byte, and sets
+// factor to it.
+static unsigned reciprocalCycles(uint8_t divisor, unsigned shift, uint32_t *factor)
+{
+    uint32_t m = ((1u << shift) + divisor - 1) / divisor;
+    if (m >= 1u << shift) {
+        return 0;
+    }
+    for (uint32_t x = 0; x <= 0xFF; x++) {
+        if ((x * m) >> shift != x / divisor) {
+            return 0;
+        }
+    }
+    *factor = m;
+
+    unsigned bit = 0;
+    while (!((m >> bit) & 1)) {
+        bit++;
+    }
+    unsigned cycles = 4 + BYTE_SHIFT_CYCLES;
+    for (bit++; bit < shift; bit++) {
+        cycles += (m >> bit) & 1 ? BYTE_ADD_CYCLES + BYTE_SHIFT_CYCLES : BYTE_SHIFT_CYCLES;
+    }
+    return cycles;
+}
+
+// A := x / divisor by multiplying x by factor/2^shift a bit at a time from the
+// bottom, shifting out what is below 2^shift as it goes.
+//
+//    x / 3     =>    LDA x        for factor 171 (%10101011), shift 9
+//                    LSR
+//                    CLC
+//                    ADC x
+//                    ROR
+//                    LSR
+//                    CLC
+//                    ADC x
+//                    ROR
+//                    ...
+static void divideAccumulator(const char *x, uint32_t factor, unsigned shift)
+{
+    unsigned bit = 0;
+    while (!((factor >> bit) & 1)) {
+        bit++;
+    }
+    LDA(strcopy(x));
+    LSR(NULL);
+    for (bit++; bit < shift; bit++) {
+        if ((factor >> bit) & 1) {
+            CLC();
+            ADC(strcopy(x));
+            ROR(NULL);
+        } else {
+            LSR(NULL);
+        }
+    }
+}
+
+// Divides the byte dst by a constant, or takes the remainder, which is
+// x - x/divisor*divisor.
+static void divideByte(const struct Operand *dst, uint8_t divisor, bool isModulo)
+{
+    require(divisor != 0, "division by zero");
+    if (divisor == 1) {
+        if (isModulo) {
+            COPY(dst, &ZEROB);
+        } else {
+            REM(strcopy("Optimized out /= 1"));
+        }
+        return;
+    }
+    if (isPowerOf2(divisor)) {
+        if (isModulo) {
+            struct Operand *mask = OpImmediateNumber((uint16_t)(divisor - 1u));
+            BITAND(dst, mask);
+            FreeOperand(mask);
+        } else {
+            shiftByte(dst, log2Of(divisor), LSR);
+        }
+        return;
+    }
+
+    Tally("divisions done by reciprocals");
+    unsigned best = 0, shift = 0;
+    uint32_t factor = 0;
+    for (unsigned s = 1; s <= 16; s++) {
+        uint32_t m;
+        unsigned cycles = reciprocalCycles(divisor, s, &m);
+        if (cycles > 0 && (best == 0 || cycles < best)) {
+            best   = cycles;
+            factor = m;
+            shift  = s;
+        }
+    }
+
+    struct Operand *x = NULL;
+    if (!isPlainMemory(dst)) {
+        x = scratch(0, 1);
+        loadByte('A', dst);
+        storeByte(x);
+    }
+    char *operand = operandString(x ? x : dst);
+    divideAccumulator(operand, factor, shift);
+    if (isModulo) {
+        struct Operand *quotient = scratch(1, 1), *product = scratch(2, 1);
+        struct Digits   digits   = factorDigits(divisor, 1);
+        char           *q        = operandString(quotient);
+        storeByte(quotient);
+        multiplyAccumulator(&digits, q);
+        storeByte(product);
+        LDA(strcopy(operand));
+        SEC();
+        SBC(operandString(product));
+        free(q);
+        FreeOperand(product);
+        FreeOperand(quotient);
+    }
+    storeAccumulator(dst);
+    free(operand);
+    FreeOperand(x);
+}
+
+// Divides the word dst by a power of 2, or takes the remainder with a mask.
+static void divideWord(const struct Operand *dst, uint16_t divisor, bool isModulo)
+{
+    if (divisor == 1) {
+        if (isModulo) {
+            COPY(dst, &ZEROB);
+        } else {
+            REM(strcopy("Optimized out /= 1"));
+        }
+        return;
+    }
+    struct Operand *work = workOn(dst);
+    if (isModulo) {
+        uint16_t        mask = (uint16_t)(divisor - 1u);
+        struct Operand *lo = byteOf(work, 0), *hi = byteOf(work, 1);
+        if ((mask & 0xFF) != 0xFF) {
+            struct Operand *bits = OpImmediateNumber(mask & 0xFF);
+            BITAND(lo, bits);
+            FreeOperand(bits);
+        }
+        if (mask >> 8 == 0) {
+            copyByte(hi, &ZEROB);
+        } else if (mask >> 8 != 0xFF) {
+            struct Operand *bits = OpImmediateNumber(mask >> 8);
+            BITAND(hi, bits);
+            FreeOperand(bits);
+        }
+        FreeOperand(hi);
+        FreeOperand(lo);
+    } else {
+        shiftWordRight(work, log2Of(divisor));
+    }
+    finishWork(dst, work);
+}
+
+// Shifts and rotates --------------------------------------------------------
+
+enum Shift {
+    SHIFT_LEFT,
+    SHIFT_RIGHT,
+    ROTATE_LEFT,
+    ROTATE_RIGHT,
+};
+
+// Shifting a byte 6 or 7 bits is quicker done the other way through the carry
+// and masking off what came around. Going 9-n bits the other way around A and
+// the carry, which is 9 bits, leaves the byte as if it went n bits this way.
+//
+//    x <<= 7   =>    LDA x
+//                    ROR
+//                    ROR
+//                    AND #$80
+//                    STA x
+static const unsigned MIN_MASKED_SHIFT = 6;
+
+// Rotates A left by 2 bits: ASL puts bit 7 in the carry, ADC #$80 brings it to
+// bit 0 and carries bit 6 out, and ROL puts that in bit 0.
+static void rotateAccumulator2(void)
+{
+    ASL(NULL);
+    ADC(strcopy("#$80"));
+    ROL(NULL);
+}
+
+static void rotateAccumulatorRight(void)
+{
+    char *skip = MakeLabel();
+    LSR(NULL);
+    BCC(strcopy(skip));
+    ORA(strcopy("#$80"));
+    Label(skip);
+    free(skip);
+}
+
+// Rotates the byte dst left by n bits, from 1 to 7. Two bits at a time take
+// 6 cycles, so 4 swaps the nibbles in 12.
+//
+//    x <<<= 4  =>    LDA x
+//                    ASL
+//                    ADC #$80
+//                    ROL
+//                    ASL
+//                    ADC #$80
+//                    ROL
+//                    STA x
+static void rotateByte(const struct Operand *dst, unsigned n)
+{
+    loadByte('A', dst);
+    if (n >= 6) {
+        for (unsigned i = n; i < 8; i++) {
+            rotateAccumulatorRight();
+        }
+    } else {
+        for (; n >= 2; n -= 2) {
+            rotateAccumulator2();
+        }
+        if (n == 1) {
+            CMP(strcopy("#$80"));
+            ROL(NULL);
+        }
+    }
+    storeAccumulator(dst);
+}
+
+// Shifts the byte dst by n bits, from 1 to 7.
+static void shiftByteBy(const struct Operand *dst, enum Shift kind, unsigned n)
+{
+    if (n < MIN_MASKED_SHIFT) {
+        shiftByte(dst, n, kind == SHIFT_LEFT ? ASL : LSR);
+        return;
+    }
+    loadByte('A', dst);
+    for (unsigned i = n; i < 9; i++) {
+        if (kind == SHIFT_LEFT) {
+            ROR(NULL);
+        } else {
+            ROL(NULL);
+        }
+    }
+    AND(stringf("#$%02X", (kind == SHIFT_LEFT ? 0xFF << n : 0xFF >> n) & 0xFF));
+    storeAccumulator(dst);
+}
+
+// Swaps the bytes of the word in plain memory.
+static void swapBytes(const struct Operand *word)
+{
+    struct Operand *lo = byteOf(word, 0), *hi = byteOf(word, 1);
+    loadByte('A', lo);
+    PHA();
+    loadByte('A', hi);
+    storeByte(lo);
+    PLA();
+    storeByte(hi);
+    FreeOperand(hi);
+    FreeOperand(lo);
+}
+
+// Shifts the word in plain memory 6 or 7 bits by shifting it the other way
+// into A, which becomes the byte moved in, and moving the bytes over.
+//
+//    w <<= 7   =>    LDA #0
+//                    LSR w+1
+//                    ROR w
+//                    ROR
+//                    PHA
+//                    LDA w
+//                    STA w+1
+//                    PLA
+//                    STA w
+static void shiftWordAcross(const struct Operand *word, enum Shift kind, unsigned n)
+{
+    struct Operand *lo = byteOf(word, 0), *hi = byteOf(word, 1);
+    char           *lsb = operandString(lo), *msb = operandString(hi);
+    LDA(strcopy("#0"));
+    for (unsigned i = n; i < 8; i++) {
+        if (kind == SHIFT_LEFT) {
+            LSR(strcopy(msb));
+            ROR(strcopy(lsb));
+            ROR(NULL);
+        } else {
+            ASL(strcopy(lsb));
+            ROL(strcopy(msb));
+            ROL(NULL);
+        }
+    }
+    PHA();
+    if (kind == SHIFT_LEFT) {
+        loadByte('A', lo);
+        storeByte(hi);
+        PLA();
+        storeByte(lo);
+    } else {
+        loadByte('A', hi);
+        storeByte(lo);
+        PLA();
+        storeByte(hi);
+    }
+    free(msb);
+    free(lsb);
+    FreeOperand(hi);
+    FreeOperand(lo);
+}
+
+// Shifts or rotates the byte or word in plain memory by 1 bit. Rotating gets
+// the bit that goes around into the carry first.
+//
+//    w >>>= 1  =>    LDA w
+//                    LSR
+//                    ROR w+1
+//                    ROR w
+static void shiftOnce(const struct Operand *work, enum Shift kind)
+{
+    struct Operand *lo = byteOf(work, 0), *hi = work->size == 2 ? byteOf(work, 1) : NULL;
+    char           *lsb = operandString(lo), *msb = operandString(hi ? hi : lo);
+    switch (kind) {
+    case SHIFT_LEFT:
+        ASL(strcopy(lsb));
+        if (hi) {
+            ROL(strcopy(msb));
+        }
+        break;
+    case SHIFT_RIGHT:
+        LSR(strcopy(msb));
+        if (hi) {
+            ROR(strcopy(lsb));
+        }
+        break;
+    case ROTATE_LEFT:
+        LDA(strcopy(msb));
+        ASL(NULL);
+        ROL(strcopy(lsb));
+        if (hi) {
+            ROL(strcopy(msb));
+        }
+        break;
+    case ROTATE_RIGHT:
+        LDA(strcopy(lsb));
+        LSR(NULL);
+        if (hi) {
+            ROR(strcopy(msb));
+        }
+        ROR(strcopy(lsb));
+        break;
+    }
+    free(msb);
+    free(lsb);
+    FreeOperand(hi);
+    FreeOperand(lo);
+}
+
+// Rotates the word in plain memory left by n bits, from 1 to 15, swapping its
+// bytes for 8 and going whichever way is shorter from there.
+static void rotateWord(const struct Operand *word, unsigned n)
+{
+    if (n > 4 && n < 12) {
+        swapBytes(word);
+        n += 8;
+    }
+    n %= 16;
+    enum Shift kind = n <= 4 ? ROTATE_LEFT : ROTATE_RIGHT;
+    for (unsigned i = kind == ROTATE_LEFT ? n : 16 - n; i > 0; i--) {
+        shiftOnce(word, kind);
+    }
+}
+
+// Shifts or rotates dst by a constant number of bits. Shifting all of its bits
+// out leaves 0, and rotating goes around as many times as it takes.
+static void shiftBy(const struct Operand *dst, enum Shift kind, uint16_t count)
+{
+    unsigned bits = 8u * dst->size;
+    bool     isRotate = kind == ROTATE_LEFT || kind == ROTATE_RIGHT;
+    unsigned n        = isRotate ? count % bits : count;
+    if (n == 0) {
+        REM(strcopy("Optimized out a shift by 0"));
+        return;
+    }
+    if (n >= bits) {
+        COPY(dst, &ZEROB);
+        return;
+    }
+    if (kind == ROTATE_RIGHT) {
+        n = bits - n;
+    }
+
+    Tally("shifts by constants");
+    if (dst->size == 1) {
+        if (isRotate) {
+            rotateByte(dst, n);
+        } else {
+            shiftByteBy(dst, kind, n);
+        }
+        return;
+    }
+
+    struct Operand *work = workOn(dst);
+    if (isRotate) {
+        rotateWord(work, n);
+    } else if (n == 6 || n == 7) {
+        shiftWordAcross(work, kind, n);
+    } else if (kind == SHIFT_LEFT) {
+        shiftWordLeft(work, n);
+    } else {
+        shiftWordRight(work, n);
+    }
+    finishWork(dst, work);
+}
+
+// Shifts or rotates dst a bit at a time, as many times as the byte count says,
+// which is counted up to 0 from its complement in the scratch variable.
+//
+//    x <<= n   =>    LDA n
+//                    EOR #$FF
+//                    STA A2_MATH
+//              L1    INC A2_MATH
+//                    BEQ L2
+//                    ASL x
+//                    JMP L1
+//              L2
+static void shiftByLoop(const struct Operand *dst, enum Shift kind, const struct Operand *count)
+{
+    require(count->size == 1, "shift count is not byte size");
+    Tally("shifts by loops");
+
+    // Getting the count into the counter or dst into memory could change A,
+    // so a count in a register is put away first.
+    struct Operand *counter = scratch(0, 1), *work;
+    if (count->mode == MODE_REGISTER) {
+        COPY(counter, count);
+    }
+    if (dst->size == 1 && !isPlainMemory(dst)) {
+        work = scratch(1, 1);
+        COPY(work, dst);
+    } else {
+        work = workOn(dst);
+    }
+    loadByte('A', count->mode == MODE_REGISTER ? counter : count);
+    EOR(strcopy("#$FF"));
+    storeByte(counter);
+
+    char *top = MakeLabel(), *done = MakeLabel(), *operand = operandString(counter);
+    Label(top);
+    INC(strcopy(operand));
+    BEQ(strcopy(done));
+    shiftOnce(work, kind);
+    JMP(strcopy(top));
+    Label(done);
+    free(operand);
+    free(done);
+    free(top);
+
+    if (dst->size == 1) {
+        if (work != dst) {
+            COPY(dst, work);
+            FreeOperand(work);
+        }
+    } else {
+        finishWork(dst, work);
+    }
+    FreeOperand(counter);
+}
+
+static void shiftMacro(const struct Operand *dst, enum Shift kind, const struct Operand *src)
+{
+    if (isConstant(src)) {
+        shiftBy(dst, kind, src->number.value);
+    } else {
+        shiftByLoop(dst, kind, src);
+    }
+}
+
+void SHIFTL(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    shiftMacro(dst, SHIFT_LEFT, src);
+}
+
+void SHIFTR(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    shiftMacro(dst, SHIFT_RIGHT, src);
+}
+
+void ROTL(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    shiftMacro(dst, ROTATE_LEFT, src);
+}
+
+void ROTR(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    shiftMacro(dst, ROTATE_RIGHT, src);
+}
+
+// Runtime routines ----------------------------------------------------------
+
+// Copies left and right to the inputs of routine, which are size bytes each,
+// and calls it.
+static void callRoutine(
+    const char           *routine,
+    const char           *leftInput,
+    const struct Operand *left,
+    const char           *rightInput,
+    const struct Operand *right,
+    uint8_t               size)
+{
+    struct Operand *a = OpAbsolute(leftInput, size), *b = OpAbsolute(rightInput, size);
+    // Copying left could change A.
+    bool isRightInA = right->mode == MODE_REGISTER && regLow(right) == 'A';
+    if (isRightInA) {
+        COPY(b, right);
+    }
+    COPY(a, left);
+    if (!isRightInA) {
+        COPY(b, right);
+    }
+    JSR(strcopy(routine));
+    FreeOperand(b);
+    FreeOperand(a);
+}
+
+// Returns the low byte of word without copying it.
+static struct Operand lowByteOf(const struct Operand *word)
+{
+    struct Operand byte = *word;
+    byte.size           = 1;
+    byte.immhi          = word->mode == MODE_REGISTER ? NULL : word->immhi;
+    return byte;
+}
+
+static void multiplyByRoutine(const struct Operand *dst, const struct Operand *src)
+{
+    struct Operand *product;
+    if (dst->size == 1) {
+        // Only the low byte of src changes the low byte of the product.
+        struct Operand low = src->size == 1 ? *src : lowByteOf(src);
+        runtime.multiply   = true;
+        callRoutine("A2_MUL", "A2_MUL.a", dst, "A2_MUL.b", &low, 1);
+        product = OpAbsolute("A2_MUL.p", 1);
+    } else {
+        runtime.multiplyWords = true;
+        callRoutine("A2_MULW", "A2_MULW.a", dst, "A2_MULW.b", src, 2);
+        product = OpAbsolute("A2_MULW.p", 2);
+    }
+    COPY(dst, product);
+    FreeOperand(product);
+}
+
+static void divideByRoutine(const struct Operand *dst, const struct Operand *src, bool isModulo)
+{
+    struct Operand *result;
+    if (dst->size == 1 && src->size == 1) {
+        runtime.divide = true;
+        callRoutine("A2_DIV", "A2_DIV.n", dst, "A2_DIV.d", src, 1);
+        result = OpAbsolute(isModulo ? "A2_DIV.r" : "A2_DIV.n", 1);
+    } else {
+        runtime.divideWords = true;
+        callRoutine("A2_DIVW", "A2_DIVW.n", dst, "A2_DIVW.d", src, 2);
+        result = OpAbsolute(isModulo ? "A2_DIVW.r" : "A2_DIVW.n", dst->size);
+    }
+    COPY(dst, result);
+    FreeOperand(result);
+}
+
+void TIMES(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    if (!isConstant(src)) {
+        multiplyByRoutine(dst, src);
+    } else if (dst->size == 1) {
+        timesByte(dst, (uint8_t)src->number.value);
+    } else {
+        timesWord(dst, src->number.value);
+    }
+}
+
+static void divideMacro(const struct Operand *dst, const struct Operand *src, bool isModulo)
+{
+    if (!isConstant(src)) {
+        divideByRoutine(dst, src, isModulo);
+        return;
+    }
+    uint16_t divisor = src->number.value;
+    if (divisor == 0) {
+        // What the routine gives: all ones and the remainder left alone.
+        if (isModulo) {
+            REM(strcopy("Optimized out %= 0"));
+        } else {
+            struct Operand *ones = OpImmediateNumber(dst->size == 1 ? 0xFF : 0xFFFF);
+            COPY(dst, ones);
+            FreeOperand(ones);
+        }
+    } else if (dst->size == 1 && divisor > 0xFF) {
+        // A byte is less than any divisor that is wider.
+        if (isModulo) {
+            REM(strcopy("Optimized out %= a bigger number"));
+        } else {
+            COPY(dst, &ZEROB);
+        }
+    } else if (dst->size == 1) {
+        divideByte(dst, (uint8_t)divisor, isModulo);
+    } else if (isPowerOf2(divisor)) {
+        divideWord(dst, divisor, isModulo);
+    } else {
+        divideByRoutine(dst, src, isModulo);
+    }
+}
+
+void DIVIDE(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    divideMacro(dst, src, false);
+}
+
+void MODULO(const struct Operand *dst, const struct Operand *src)
+{
+    REM(macroString(__func__, dst, NULL, src));
+    divideMacro(dst, src, true);
+}
+
+// Loads the difference of the quarter squares of Y and X from tables at lo and
+// hi as the product and returns.
+static void differenceOfSquares(const char *lo, const char *hi)
+{
+    LDA(stringf("%s,Y", lo));
+    SEC();
+    SBC(strcopy("A2_MUL.sqlo,X"));
+    STA(strcopy("A2_MUL.p"));
+    LDA(stringf("%s,Y", hi));
+    SBC(strcopy("A2_MUL.sqhi,X"));
+    STA(strcopy("A2_MUL.p+1"));
+    RTS();
+}
+
+// A2_MUL.p := A2_MUL.a * A2_MUL.b
+static void linkMultiply(void)
+{
+    char *positive = MakeLabel(), *carried = MakeLabel();
+    Label("A2_MUL");
+    // X := |a - b|
+    LDA(strcopy("A2_MUL.a"));
+    SEC();
+    SBC(strcopy("A2_MUL.b"));
+    BCS(strcopy(positive));
+    EOR(strcopy("#$FF"));
+    ADC(strcopy("#$01"));
+    Label(positive);
+    TAX();
+    // Y := a + b, which is in the second half of the tables when it carries.
+    LDA(strcopy("A2_MUL.a"));
+    CLC();
+    ADC(strcopy("A2_MUL.b"));
+    TAY();
+    BCS(strcopy(carried));
+    differenceOfSquares("A2_MUL.sqlo", "A2_MUL.sqhi");
+    Label(carried);
+    differenceOfSquares("A2_MUL.sqlo+256", "A2_MUL.sqhi+256");
+    free(carried);
+    free(positive);
+
+    uint8_t lo[512], hi[512];
+    for (unsigned n = 0; n < sizeof lo; n++) {
+        unsigned square = n * n / 4;
+        lo[n]           = (uint8_t)square;
+        hi[n]           = (uint8_t)(square >> 8);
+    }
+    HEX("A2_MUL.sqlo", lo, sizeof lo);
+    HEX("A2_MUL.sqhi", hi, sizeof hi);
+    if (OptimizationGoal() != GOAL_SIZE) {
+        // Each product indexes both with X and Y.
+        PAGE("A2_MUL.sqlo", true);
+        PAGE("A2_MUL.sqhi", true);
+    }
+    VAR("A2_MUL.a", 1);
+    VAR("A2_MUL.b", 1);
+    VAR("A2_MUL.p", 2);
+}
+
+// Adds the low byte of A2_MUL.p to the high byte of the product.
+static void addCrossProduct(void)
+{
+    JSR(strcopy("A2_MUL"));
+    LDA(strcopy("A2_MULW.p+1"));
+    CLC();
+    ADC(strcopy("A2_MUL.p"));
+    STA(strcopy("A2_MULW.p+1"));
+}
+
+// A2_MULW.p := A2_MULW.a * A2_MULW.b, keeping the low word. The high bytes
+// only add their products to the high byte, so those that are 0 are skipped.
+static void linkMultiplyWords(void)
+{
+    char *skip = MakeLabel(), *done = MakeLabel();
+    Label("A2_MULW");
+    LDA(strcopy("A2_MULW.a"));
+    STA(strcopy("A2_MUL.a"));
+    LDA(strcopy("A2_MULW.b"));
+    STA(strcopy("A2_MUL.b"));
+    JSR(strcopy("A2_MUL"));
+    LDA(strcopy("A2_MUL.p"));
+    STA(strcopy("A2_MULW.p"));
+    LDA(strcopy("A2_MUL.p+1"));
+    STA(strcopy("A2_MULW.p+1"));
+    LDA(strcopy("A2_MULW.a+1"));
+    BEQ(strcopy(skip));
+    STA(strcopy("A2_MUL.a"));
+    addCrossProduct();
+    Label(skip);
+    LDA(strcopy("A2_MULW.b+1"));
+    BEQ(strcopy(done));
+    STA(strcopy("A2_MUL.b"));
+    LDA(strcopy("A2_MULW.a"));
+    STA(strcopy("A2_MUL.a"));
+    addCrossProduct();
+    Label(done);
+    RTS();
+    free(done);
+    free(skip);
+
+    VAR("A2_MULW.a", 2);
+    VAR("A2_MULW.b", 2);
+    VAR("A2_MULW.p", 2);
+}
+
+// A2_DIV.n, A2_DIV.r := A2_DIV.n / A2_DIV.d, A2_DIV.n % A2_DIV.d
+//
+// Each bit of n is shifted into the remainder in A, which takes the divisor
+// away when it's big enough and shifts a 1 into the quotient for that bit
+// where n was. Dividing by 0 gives $FF and leaves n as the remainder.
+static void linkDivide(void)
+{
+    char *loop = MakeLabel(), *subtract = MakeLabel(), *next = MakeLabel();
+    Label("A2_DIV");
+    LDA(strcopy("#$00"));
+    LDX(strcopy("#$08"));
+    ASL(strcopy("A2_DIV.n"));
+    Label(loop);
+    ROL(NULL);
+    // A bit carried out of A is more than any divisor.
+    BCS(strcopy(subtract));
+    CMP(strcopy("A2_DIV.d"));
+    BCC(strcopy(next));
+    Label(subtract);
+    SBC(strcopy("A2_DIV.d"));
+    SEC();
+    Label(next);
+    ROL(strcopy("A2_DIV.n"));
+    DEX();
+    BNE(strcopy(loop));
+    STA(strcopy("A2_DIV.r"));
+    RTS();
+    free(next);
+    free(subtract);
+    free(loop);
+
+    VAR("A2_DIV.n", 1);
+    VAR("A2_DIV.d", 1);
+    VAR("A2_DIV.r", 1);
+}
+
+// A2_DIVW.n, A2_DIVW.r := A2_DIVW.n / A2_DIVW.d, A2_DIVW.n % A2_DIVW.d
+//
+// The same as A2_DIV for words, with the remainder in memory. Dividing by 0
+// gives $FFFF and leaves n as the remainder.
+static void linkDivideWords(void)
+{
+    char *loop = MakeLabel(), *subtract = MakeLabel(), *next = MakeLabel();
+    Label("A2_DIVW");
+    LDA(strcopy("#$00"));
+    STA(strcopy("A2_DIVW.r"));
+    STA(strcopy("A2_DIVW.r+1"));
+    LDX(strcopy("#$10"));
+    Label(loop);
+    ASL(strcopy("A2_DIVW.n"));
+    ROL(strcopy("A2_DIVW.n+1"));
+    ROL(strcopy("A2_DIVW.r"));
+    ROL(strcopy("A2_DIVW.r+1"));
+    LDA(strcopy("A2_DIVW.r"));
+    BCS(strcopy(subtract));
+    CMP(strcopy("A2_DIVW.d"));
+    LDA(strcopy("A2_DIVW.r+1"));
+    SBC(strcopy("A2_DIVW.d+1"));
+    BCC(strcopy(next));
+    LDA(strcopy("A2_DIVW.r"));
+    Label(subtract);
+    SEC();
+    SBC(strcopy("A2_DIVW.d"));
+    STA(strcopy("A2_DIVW.r"));
+    LDA(strcopy("A2_DIVW.r+1"));
+    SBC(strcopy("A2_DIVW.d+1"));
+    STA(strcopy("A2_DIVW.r+1"));
+    INC(strcopy("A2_DIVW.n"));
+    Label(next);
+    DEX();
+    BNE(strcopy(loop));
+    RTS();
+    free(next);
+    free(subtract);
+    free(loop);
+
+    VAR("A2_DIVW.n", 2);
+    VAR("A2_DIVW.d", 2);
+    VAR("A2_DIVW.r", 2);
+}
+
+void LinkRuntime(void)
+{
+    endLabel();
+    if (runtime.multiplyWords) {
+        linkMultiplyWords();
+        runtime.multiply = true;
+    }
+    if (runtime.multiply) {
+        linkMultiply();
+    }
+    if (runtime.divide) {
+        linkDivide();
+    }
+    if (runtime.divideWords) {
+        linkDivideWords();
+    }
+    if (runtime.scratch) {
+        VAR(SCRATCH, 4);
+    }
+}
@@ -1,6 +1,7 @@
 #include "asm.h"
 
 #include "io.h"
+#include "symbols.h"
 #include "text.h"
 
 enum Mode {
@@ -68,6 +69,44 @@ static struct Operand *Operand(
 static inline char regLow(const struct Operand *reg) { return reg->immlo[0]; }
 static inline char regHigh(const struct Operand *reg) { return reg->immhi[0]; }
 
+// Returns true if text is a number that is 0, like #$00 or 0.
+static bool isZeroText(const char *text)
+{
+    text += text[0] == '#';
+    int base = 10;
+    if (text[0] == '$' || text[0] == '%') {
+        base = text[0] == '$' ? 16 : 2;
+        text++;
+    }
+    char *end = NULL;
+    return strtoul(text, &end, base) == 0 && end != text && *end == '\0';
+}
+
+static bool isZeroByte(const struct Operand *operand)
+{
+    return operand->mode == MODE_IMMEDIATE && isZeroText(operand->immlo);
+}
+
+// Returns the operand that reaches the byte through the pointer, loading Y with
+// the offset unless the 65C02 can go through the pointer without one.
+//
+//    LDY #0   =>    LDA (p)
+//    LDA (p),Y
+static char *indirectOperand(const struct Operand *operand)
+{
+    if (TargetCpu() == CPU_65C02 && operand->size == 1 && isZeroText(operand->offset)) {
+        return stringf("(%s)", operand->base);
+    }
+    if (operand->offset[0] == '@') {
+        require(operand->offset[1] == 'Y' && operand->offset[2] == '\0',
+            "only Y can be used as the offset register: got %s",
+            &operand->offset[1]);
+    } else {
+        LDY(stringf("%s", operand->offset));
+    }
+    return stringf("(%s),Y", operand->base);
+}
+
 static char *operandString(const struct Operand *operand)
 {
     if (operand) {
@@ -205,6 +244,12 @@ static void transfer(char dst, char src)
     case 'X':
         switch (src) {
         case 'Y':
+            // The 65C02 can move between X and Y without changing A.
+            if (TargetCpu() == CPU_65C02) {
+                PHY();
+                PLX();
+                return;
+            }
             TYA();
             TAX();
             return;
@@ -220,6 +265,11 @@ static void transfer(char dst, char src)
     case 'Y':
         switch (src) {
         case 'X':
+            if (TargetCpu() == CPU_65C02) {
+                PHX();
+                PLY();
+                return;
+            }
             TXA();
             TAY();
             return;
@@ -264,14 +314,7 @@ static void loadByte(char dstRegister, const struct Operand *src)
         }
         return;
     case MODE_INDIRECT_OFFSET:
-        if (src->offset[0] == '@') {
-            require(src->offset[1] == 'Y',
-                "only Y can be used as the offset register: got %s",
-                &src->offset[1]);
-        } else {
-            LDY(stringf("%s", src->offset));
-        }
-        LDA(stringf("(%s),Y", src->base));
+        LDA(indirectOperand(src));
         if (dstRegister == 'Y') {
             TAY();
         } else if (dstRegister == 'X') {
@@ -404,14 +447,7 @@ static void storeByte(const struct Operand *dst)
         STA(stringf("%s,Y", dst->base));
         return;
     case MODE_INDIRECT_OFFSET:
-        if (dst->offset[0] == '@') {
-            require(dst->offset[1] == 'Y' && dst->offset[2] == '\0',
-                "only Y can be used as the offset register: got %s",
-                &dst->offset[1]);
-        } else {
-            LDY(stringf("%s", dst->offset));
-        }
-        STA(stringf("(%s),Y", dst->base));
+        STA(indirectOperand(dst));
         return;
     case MODE_REGISTER:
         fatalf("%s: logic error MODE_REGISTER %s", __func__, dst->immhi);
@@ -470,14 +506,7 @@ static void mathByte(const struct Operand *src, MathOp MATH)
         return;
 
     case MODE_INDIRECT_OFFSET:
-        if (src->offset[0] == '@') {
-            require(src->offset[1] == 'Y' && src->offset[2] == '\0',
-                "only Y can be used as the offset register: got %s",
-                &src->offset[1]);
-        } else {
-            LDY(stringf("%s", src->offset));
-        }
-        MATH(stringf("(%s),Y", src->base));
+        MATH(indirectOperand(src));
         return;
 
     case MODE_REGISTER:
@@ -501,6 +530,8 @@ struct Arithmetic {
     void (*ClearFlag)(void);
     void (*IncrementX)(void);
     void (*IncrementY)(void);
+    void (*Increment)(char *);
+    Branch SkipCarry;
 };
 
 static struct Arithmetic addition = {
@@ -509,6 +540,8 @@ static struct Arithmetic addition = {
     .ClearFlag  = CLC,
     .IncrementX = INX,
     .IncrementY = INY,
+    .Increment  = INC,
+    .SkipCarry  = BCC,
 };
 
 static struct Arithmetic subtract = {
@@ -517,6 +550,8 @@ static struct Arithmetic subtract = {
     .ClearFlag  = SEC,
     .IncrementX = DEX,
     .IncrementY = DEY,
+    .Increment  = DEC,
+    .SkipCarry  = BCS,
 };
 
 static struct Arithmetic bitwiseAnd = {
@@ -525,6 +560,8 @@ static struct Arithmetic bitwiseAnd = {
     .ClearFlag  = doNothing,
     .IncrementX = NULL,
     .IncrementY = NULL,
+    .Increment  = NULL,
+    .SkipCarry  = NULL,
 };
 
 static struct Arithmetic bitwiseOr = {
@@ -533,6 +570,8 @@ static struct Arithmetic bitwiseOr = {
     .ClearFlag  = doNothing,
     .IncrementX = NULL,
     .IncrementY = NULL,
+    .Increment  = NULL,
+    .SkipCarry  = NULL,
 };
 
 static struct Arithmetic bitwiseXor = {
@@ -541,6 +580,8 @@ static struct Arithmetic bitwiseXor = {
     .ClearFlag  = doNothing,
     .IncrementX = NULL,
     .IncrementY = NULL,
+    .Increment  = NULL,
+    .SkipCarry  = NULL,
 };
 
 static inline char *mathMacroString(
@@ -556,10 +597,150 @@ static inline char *mathMacroString(
     return string;
 }
 
+// Adding or subtracting a few is cheaper one at a time with INC or DEC, or with
+// INX or INY, than through the accumulator. LDA, CLC, ADC #n and STA take 9
+// bytes and 12 cycles, which two INCs match, and TXA, CLC, ADC #n and TAX take 5
+// bytes and 8 cycles, which four INXs match. CLC and ADC #n take 3 bytes and 4
+// cycles, which two of the 65C02's INC A match. In the zero page, three INCs
+// still take a byte less than the accumulator's 7, which is worth it for size.
+static const unsigned MAX_MEMORY_STEPS[] = {
+    [GOAL_BALANCED] = 2,
+    [GOAL_SIZE]     = 3,
+    [GOAL_SPEED]    = 2,
+};
+static const unsigned MAX_REGISTER_STEPS    = 4;
+static const unsigned MAX_ACCUMULATOR_STEPS = 2;
+
+// Returns true if op changes dst in place by a known number.
+static bool isStep(const struct Arithmetic *op, const struct Operand *dst, const struct Operand *left, const struct Operand *right)
+{
+    return op->Increment && dst == left && right->mode == MODE_IMMEDIATE && right->number.valid
+        && IsPassEnabled("steps");
+}
+
+// Returns the most times that dst is worth stepping by one.
+static unsigned maxStepsOf(const struct Operand *dst)
+{
+    switch (dst->mode) {
+    case MODE_ABSOLUTE:
+    case MODE_OFFSET:
+        return MAX_MEMORY_STEPS[OptimizationGoal()];
+    case MODE_VARIABLE_OFFSET:
+        // INC a,X takes a cycle more than STA a,Y and X has to be loaded.
+        return OptimizationGoal() == GOAL_SPEED ? 1 : MAX_MEMORY_STEPS[OptimizationGoal()];
+    case MODE_REGISTER:
+        if (regLow(dst) == 'A') {
+            return TargetCpu() == CPU_65C02 ? MAX_ACCUMULATOR_STEPS : 0;
+        }
+        return MAX_REGISTER_STEPS;
+    case MODE_IMMEDIATE:
+    case MODE_INDIRECT_OFFSET:
+        return 0;
+    }
+    fatalf("%s: unhandled mode type: %d", __func__, dst->mode);
+}
+
+// Returns the operand that INC, DEC or STZ changes dst through, loading X with a
+// variable offset.
+static char *stepOperand(const struct Operand *dst)
+{
+    switch (dst->mode) {
+    case MODE_ABSOLUTE:
+        return stringf("%s", dst->base);
+    case MODE_OFFSET:
+        return stringf("%s+%s", dst->base, dst->offset);
+    case MODE_VARIABLE_OFFSET:
+        LDX(stringf("%s", dst->offset));
+        return stringf("%s,X", dst->base);
+    case MODE_IMMEDIATE:
+    case MODE_INDIRECT_OFFSET:
+    case MODE_REGISTER:
+        fatalf("%s: invalid mode type: %d", __func__, dst->mode);
+    }
+    fatalf("%s: unhandled mode type: %d", __func__, dst->mode);
+}
+
+// Changes the byte dst by one the number of times.
+//
+//    LDA x    =>    INC x
+//    CLC            INC x
+//    ADC #2
+//    STA x
+static void stepByte(const struct Arithmetic *op, const struct Operand *dst, unsigned times)
+{
+    Tally("additions done by steps");
+    if (dst->mode == MODE_REGISTER && regLow(dst) == 'A') {
+        for (unsigned i = 0; i < times; i++) {
+            op->Increment(strcopy("A"));
+        }
+        return;
+    }
+    if (dst->mode == MODE_REGISTER) {
+        for (unsigned i = 0; i < times; i++) {
+            regLow(dst) == 'X' ? op->IncrementX() : op->IncrementY();
+        }
+        return;
+    }
+    char *operand = stepOperand(dst);
+    for (unsigned i = 0; i < times; i++) {
+        op->Increment(strcopy(operand));
+    }
+    free(operand);
+}
+
+// Returns true if the 65C02 can set or clear the bits of dst in place.
+static bool isBitsInPlace(const struct Arithmetic *op, const struct Operand *dst, const struct Operand *left, const struct Operand *right)
+{
+    if (TargetCpu() != CPU_65C02 || dst != left || (dst->mode != MODE_ABSOLUTE && dst->mode != MODE_OFFSET)) {
+        return false;
+    }
+    if (op == &bitwiseOr) {
+        return right->mode == MODE_IMMEDIATE || right->mode == MODE_ABSOLUTE || right->mode == MODE_OFFSET
+            || (right->mode == MODE_REGISTER && regLow(right) == 'A');
+    }
+    return op == &bitwiseAnd && right->mode == MODE_IMMEDIATE && right->number.valid;
+}
+
+// Sets the bits of dst that are set in right with TSB, or clears the ones that
+// are clear in it with TRB, which leaves A with the mask rather than the result.
+//
+//    LDA x    =>    LDA #n
+//    ORA #n         TSB x
+//    STA x
+static void changeBits(const struct Arithmetic *op, const struct Operand *dst, const struct Operand *right)
+{
+    Tally("bits changed in place");
+    char *operand = stepOperand(dst);
+    if (op == &bitwiseOr) {
+        if (right->mode != MODE_REGISTER) {
+            loadByte('A', right);
+        }
+        TSB(operand);
+        return;
+    }
+    LDA(immediate(hex2((uint8_t)~right->number.value)));
+    TRB(operand);
+}
+
 static void MATHBB(const struct Arithmetic *op, const struct Operand *dst, const struct Operand *left, const struct Operand *right)
 {
     REM(mathMacroString(op, "BB", dst, left, right));
 
+    if (isBitsInPlace(op, dst, left, right)) {
+        changeBits(op, dst, right);
+        return;
+    }
+
+    if (isStep(op, dst, left, right)) {
+        if (right->number.value == 0) {
+            REM(strcopy("Optimized out += 0"));
+            return;
+        }
+        if (right->number.value <= maxStepsOf(dst)) {
+            stepByte(op, dst, right->number.value);
+            return;
+        }
+    }
     if (dst->mode != MODE_REGISTER) {
         loadByte('A', left);
         op->ClearFlag();
@@ -567,34 +748,6 @@ static void MATHBB(const struct Arithmetic *op, const struct Operand *dst, const
         storeByte(dst);
         return;
     }
-    // Optimize += 0, += 1, += 2
-    if (right->mode == MODE_IMMEDIATE && right->number.valid && op->IncrementX && op->IncrementY) {
-        switch (right->number.value) {
-        case 0:
-            REM("Optimized out += 0");
-            return;
-        case 2:
-            if (regLow(dst) == 'X') {
-                op->IncrementX();
-            } else if (regLow(dst) == 'Y') {
-                op->IncrementY();
-            } else {
-                break;
-            }
-            // fallthru
-        case 1:
-            if (regLow(dst) == 'X') {
-                op->IncrementX();
-            } else if (regLow(dst) == 'Y') {
-                op->IncrementY();
-            } else {
-                break;
-            }
-            return;
-        default:
-            break;
-        }
-    }
     // Handle adding into a register
     if (regLow(dst) == 'X') {
         TXA();
@@ -616,6 +769,74 @@ static void MATHBB(const struct Arithmetic *op, const struct Operand *dst, const
     return;
 }
 
+// Returns true if dst is a word that INC, DEC and a branch can change in place.
+static bool isSteppableWord(const struct Operand *dst) { return dst->mode == MODE_ABSOLUTE || dst->mode == MODE_OFFSET; }
+
+// Changes the word dst by one, carrying into the high byte only when the low
+// one wraps.
+//
+//    CLC      =>    INC w
+//    LDA w          BNE L
+//    ADC #1         INC w+1
+//    STA w       L
+//    LDA w+1
+//    ADC #0
+//    STA w+1
+static void stepWord(const struct Arithmetic *op, const struct Operand *dst)
+{
+    Tally("additions done by steps");
+    struct Operand *msbDst = highByte(dst);
+    char           *lsb    = stepOperand(dst),
+                   *msb    = stepOperand(msbDst),
+                   *skip   = MakeLabel();
+    if (op->Increment == INC) {
+        INC(strcopy(lsb));
+        BNE(strcopy(skip));
+        INC(strcopy(msb));
+        Label(skip);
+    } else {
+        // The low byte borrows when it is 0 before the DEC.
+        LDA(strcopy(lsb));
+        BNE(strcopy(skip));
+        DEC(strcopy(msb));
+        Label(skip);
+        DEC(strcopy(lsb));
+    }
+    free(skip);
+    free(msb);
+    free(lsb);
+    FreeOperand(msbDst);
+}
+
+// Adds or subtracts the byte right to or from the word dst, changing the high
+// byte only when there is a carry or a borrow.
+//
+//    CLC      =>    CLC
+//    LDA w          LDA w
+//    ADC b          ADC b
+//    STA w          STA w
+//    LDA w+1        BCC L
+//    ADC #0         INC w+1
+//    STA w+1     L
+static void carryWord(const struct Arithmetic *op, const struct Operand *dst, const struct Operand *right)
+{
+    Tally("additions done by steps");
+    op->ClearFlag();
+    loadByte('A', dst);
+    op->Operation(right);
+    storeByte(dst);
+
+    struct Operand *msbDst = highByte(dst);
+    char           *msb    = stepOperand(msbDst),
+                   *skip   = MakeLabel();
+    op->SkipCarry(strcopy(skip));
+    op->Increment(strcopy(msb));
+    Label(skip);
+    free(skip);
+    free(msb);
+    FreeOperand(msbDst);
+}
+
 static void MATHWB(
     const struct Arithmetic *op,
     const struct Operand    *dst,
@@ -624,6 +845,16 @@ static void MATHWB(
 {
     REM(mathMacroString(op, "WB", dst, left, right));
 
+    if (op->Increment && dst == left && isSteppableWord(dst) && right->mode != MODE_REGISTER
+        && IsPassEnabled("steps")) {
+        if (isStep(op, dst, left, right) && right->number.value == 1) {
+            stepWord(op, dst);
+        } else {
+            carryWord(op, dst, right);
+        }
+        return;
+    }
+
     op->ClearFlag();
     loadByte('A', left);
     op->Operation(right);
@@ -648,6 +879,15 @@ static void MATHWW(
 {
     REM(mathMacroString(op, "WW", dst, left, right));
 
+    if (isStep(op, dst, left, right) && isSteppableWord(dst) && right->number.value <= 0xFF) {
+        if (right->number.value == 1) {
+            stepWord(op, dst);
+        } else {
+            carryWord(op, dst, right);
+        }
+        return;
+    }
+
     op->ClearFlag();
     loadByte('A', left);
     op->Operation(right);
@@ -713,6 +953,33 @@ void FreeOperand(struct Operand *operand)
     free(operand);
 }
 
+// Returns true if the 65C02 can store 0 to dst with STZ.
+static bool isClearable(const struct Operand *dst)
+{
+    return TargetCpu() == CPU_65C02
+        && (dst->mode == MODE_ABSOLUTE || dst->mode == MODE_OFFSET || dst->mode == MODE_VARIABLE_OFFSET);
+}
+
+// Stores 0 to the byte dst without going through A.
+//
+//    LDA #0   =>    STZ x
+//    STA x
+static void clearByte(const struct Operand *dst)
+{
+    Tally("zeros stored by STZ");
+    STZ(stepOperand(dst));
+}
+
+static void copyByte(const struct Operand *dst, const struct Operand *src)
+{
+    if (isClearable(dst) && isZeroByte(src)) {
+        clearByte(dst);
+        return;
+    }
+    loadByte('A', src);
+    storeByte(dst);
+}
+
 static void COPYBB(const struct Operand *dst, const struct Operand *src)
 {
     REM(macroString(__func__, dst, src, NULL));
@@ -720,8 +987,7 @@ static void COPYBB(const struct Operand *dst, const struct Operand *src)
         loadByte(regLow(dst), src);
         return;
     }
-    loadByte('A', src);
-    storeByte(dst);
+    copyByte(dst, src);
 }
 
 static void COPYWB(const struct Operand *dst, const struct Operand *src)
@@ -732,6 +998,13 @@ static void COPYWB(const struct Operand *dst, const struct Operand *src)
         loadByte(regHigh(dst), &ZEROB);
         return;
     }
+    if (isClearable(dst) && isSteppableWord(dst)) {
+        struct Operand *msbDst = highByte(dst);
+        copyByte(dst, src);
+        clearByte(msbDst);
+        FreeOperand(msbDst);
+        return;
+    }
     loadByte('A', src);
     loadByte('X', &ZEROB);
     storeWord(dst);
@@ -744,6 +1017,22 @@ static void COPYWW(const struct Operand *dst, const struct Operand *src)
         loadWord(regHigh(dst), regLow(dst), src);
         return;
     }
+    if (src->mode == MODE_REGISTER) {
+        // storeWord takes the word from XA.
+        require(regHigh(src) == 'X' && regLow(src) == 'A', "TODO: store words from @%s%s", src->immhi, src->immlo);
+        storeWord(dst);
+        return;
+    }
+    // Storing the bytes one at a time lets STZ store the ones that are 0.
+    bool isZeroInside = src->mode == MODE_IMMEDIATE && (isZeroText(src->immlo) || isZeroText(src->immhi));
+    if (isClearable(dst) && isSteppableWord(dst) && isZeroInside) {
+        struct Operand *msbDst = highByte(dst), *msbSrc = highByte(src);
+        copyByte(dst, src);
+        copyByte(msbDst, msbSrc);
+        FreeOperand(msbSrc);
+        FreeOperand(msbDst);
+        return;
+    }
     loadWord('X', 'A', src);
     storeWord(dst);
 }
@@ -765,6 +1054,264 @@ void COPY(const struct Operand *dst, const struct Operand *src)
     }
 }
 
+// The most bytes of a block that are copied or filled one at a time rather than
+// in a loop over X, by goal. Each byte saves 6 cycles that way. Fewer bytes
+// are still done one at a time when that's no bigger than the loop, which is
+// 11 bytes for a copy and 8 for a fill.
+static const unsigned MAX_UNROLLED_BYTES[] = {
+    [GOAL_BALANCED] = 4,
+    [GOAL_SIZE]     = 0,
+    [GOAL_SPEED]    = 16,
+};
+
+static bool isUnrolled(uint16_t size, unsigned bytesEach, unsigned loopBytes)
+{
+    bool isWorthIt = size <= MAX_UNROLLED_BYTES[OptimizationGoal()] && IsPassEnabled("unroll");
+    return isWorthIt || size * bytesEach <= loopBytes;
+}
+
+// Returns the operand for the byte offset bytes from base, indexed by X if
+// isIndexed.
+static char *blockOperand(const char *base, long offset, bool isIndexed)
+{
+    const char *index = isIndexed ? ",X" : "";
+    if (offset == 0) {
+        return stringf("%s%s", base, index);
+    }
+    return stringf("%s%c%ld%s", base, offset < 0 ? '-' : '+', labs(offset), index);
+}
+
+// How a loop over X goes through a block. Whole pages go up from 0 until X
+// wraps, doing a byte of each page per pass. What's left counts down to 0 and,
+// when X starts below $80, stops once it goes negative so that the bytes are
+// named without going before the block.
+struct BlockLoop {
+    long     offset; // of the byte that X indexes when it is 0
+    unsigned pages;  // or 0 if counting down
+    uint8_t  width;  // bytes per pass
+    char    *top;
+};
+
+// Starts a loop over size bytes at offset, or over every whole page of them if
+// isPaged.
+static struct BlockLoop startBlockLoop(long offset, uint16_t size, uint8_t width, bool isPaged)
+{
+    struct BlockLoop loop = { .offset = offset, .width = width, .top = MakeLabel() };
+    if (isPaged) {
+        loop.pages = size / 0x100;
+        LDX(strcopy("#0"));
+    } else if (size - width < 0x80) {
+        LDX(stringf("#%u", size - width));
+    } else {
+        loop.offset -= width;
+        LDX(stringf("#%u", size % 0x100));
+    }
+    Label(loop.top);
+    return loop;
+}
+
+// Returns the operands of the byte at offset in each pass of the loop, which
+// there is one of for each page. The list ends with NULL.
+static char **blockLoopOperands(const struct BlockLoop *loop, const char *base, long offset)
+{
+    unsigned count    = loop->pages ? loop->pages : 1;
+    char   **operands = calloc(count + 1, sizeof(*operands));
+    require(operands, "calloc failed");
+    for (unsigned i = 0; i < count; i++) {
+        operands[i] = blockOperand(base, loop->offset + offset + (long)i * 0x100, true);
+    }
+    return operands;
+}
+
+static void endBlockLoop(struct BlockLoop *loop, bool isCountingToZero)
+{
+    for (uint8_t i = 0; i < loop->width; i++) {
+        if (loop->pages) {
+            INX();
+        } else {
+            DEX();
+        }
+    }
+    if (loop->pages || isCountingToZero) {
+        BNE(strcopy(loop->top));
+    } else {
+        BPL(strcopy(loop->top));
+    }
+    free(loop->top);
+}
+
+// Copies size bytes from src to dst, one at a time when there are few of them,
+// in a loop over X when there are at most 256, and with a pass over X doing a
+// byte of each page when there are more.
+//
+//    LDX #$02       =>    LDA src
+// L  LDA src,X            STA dst
+//    STA dst,X            LDA src+1
+//    DEX                  STA dst+1
+//    BPL L                LDA src+2
+//                         STA dst+2
+static void copyBytes(const char *dst, const char *src, long offset, uint16_t size)
+{
+    if (isUnrolled(size, 6, 11)) {
+        Tally("block moves unrolled");
+        for (long i = offset; i < offset + size; i++) {
+            LDA(blockOperand(src, i, false));
+            STA(blockOperand(dst, i, false));
+        }
+        return;
+    }
+    struct BlockLoop loop = startBlockLoop(offset, size, 1, false);
+    LDA(blockOperand(src, loop.offset, true));
+    STA(blockOperand(dst, loop.offset, true));
+    endBlockLoop(&loop, loop.offset < offset);
+}
+
+void COPYBLOCK(const char *dst, const char *src, uint16_t size)
+{
+    REM(stringf("COPYBLOCK %s %s %u", dst, src, size));
+    if (size < 0x100) {
+        copyBytes(dst, src, 0, size);
+        return;
+    }
+
+    struct BlockLoop loop = startBlockLoop(0, size, 1, true);
+    char           **from = blockLoopOperands(&loop, src, 0),
+                   **to   = blockLoopOperands(&loop, dst, 0);
+    for (unsigned i = 0; from[i]; i++) {
+        LDA(from[i]);
+        STA(to[i]);
+    }
+    endBlockLoop(&loop, true);
+    free(from);
+    free(to);
+
+    if (size % 0x100) {
+        copyBytes(dst, src, (long)loop.pages * 0x100, size % 0x100);
+    }
+}
+
+// The bytes of a fill that repeat in each item of width bytes.
+struct FillPattern {
+    uint8_t width;
+    uint8_t bytes[2];
+    int     loaded; // the byte in A, or -1
+};
+
+// Returns true if the 65C02 stores the byte of the pattern at lane with STZ.
+static bool isClearedLane(const struct FillPattern *pattern, uint8_t lane)
+{
+    return TargetCpu() == CPU_65C02 && pattern->bytes[lane] == 0;
+}
+
+// Loads the A register with the byte of the pattern at lane unless it's there.
+static void loadLane(struct FillPattern *pattern, uint8_t lane)
+{
+    if (pattern->loaded != pattern->bytes[lane]) {
+        LDA(immediate(hex2(pattern->bytes[lane])));
+        pattern->loaded = pattern->bytes[lane];
+    }
+}
+
+// Stores the byte of the pattern at lane to each of operands, which it frees.
+static void storeLane(struct FillPattern *pattern, uint8_t lane, char **operands)
+{
+    for (unsigned i = 0; operands[i]; i++) {
+        if (isClearedLane(pattern, lane)) {
+            Tally("zeros stored by STZ");
+            STZ(operands[i]);
+        } else {
+            loadLane(pattern, lane);
+            STA(operands[i]);
+        }
+    }
+    free(operands);
+}
+
+// Returns the lane that A can be loaded for once before a loop, or -1 if the
+// lanes need different bytes.
+static int loopInvariantLane(const struct FillPattern *pattern)
+{
+    int lane = -1;
+    for (uint8_t i = 0; i < pattern->width; i++) {
+        if (isClearedLane(pattern, i)) {
+            continue;
+        }
+        if (lane >= 0 && pattern->bytes[lane] != pattern->bytes[i]) {
+            return -1;
+        }
+        lane = i;
+    }
+    return lane;
+}
+
+// Stores the pattern over the bytes of a loop, loading A before it when every
+// pass needs the same byte there.
+static void fillLoop(struct FillPattern *pattern, const char *dst, long offset, uint16_t size, bool isPaged)
+{
+    int lane = loopInvariantLane(pattern);
+    if (lane >= 0) {
+        loadLane(pattern, (uint8_t)lane);
+    } else {
+        pattern->loaded = -1;
+    }
+    struct BlockLoop loop = startBlockLoop(offset, size, pattern->width, isPaged);
+    for (uint8_t i = 0; i < pattern->width; i++) {
+        storeLane(pattern, i, blockLoopOperands(&loop, dst, i));
+    }
+    endBlockLoop(&loop, isPaged || loop.offset < offset);
+    if (lane < 0) {
+        pattern->loaded = -1;
+    }
+}
+
+// Fills size bytes at offset from dst with the pattern, a byte at a time when
+// there are few of them and in a loop over X otherwise.
+//
+//    LDA #$FF
+//    LDX #$09
+// L  STA dst,X
+//    DEX
+//    BPL L
+static void fillBytes(struct FillPattern *pattern, const char *dst, long offset, uint16_t size)
+{
+    if (!isUnrolled(size, 3, 8)) {
+        fillLoop(pattern, dst, offset, size, false);
+        return;
+    }
+    Tally("block moves unrolled");
+    for (uint8_t lane = 0; lane < pattern->width; lane++) {
+        for (long i = lane; i < size; i += pattern->width) {
+            char **operands = calloc(2, sizeof(*operands));
+            require(operands, "calloc failed");
+            operands[0] = blockOperand(dst, offset + i, false);
+            storeLane(pattern, lane, operands);
+        }
+    }
+}
+
+void FILL(const char *dst, uint16_t size, uint16_t value, uint8_t width)
+{
+    char *hex = width == 2 ? hex4(value) : hex2((uint8_t)value);
+    REM(stringf("FILL %s %u #%s", dst, size, hex));
+    free(hex);
+    struct FillPattern pattern = {
+        .width  = width,
+        .bytes  = { (uint8_t)value, (uint8_t)(value >> 8) },
+        .loaded = -1,
+    };
+    require(width == 1 || (width == 2 && size % 2 == 0), "%s: %u bytes are not items of %u", __func__, size, width);
+    if (width == 2 && pattern.bytes[0] == pattern.bytes[1]) {
+        pattern.width = 1;
+    }
+
+    if (size >= 0x100) {
+        fillLoop(&pattern, dst, 0, size, true);
+    }
+    if (size % 0x100) {
+        fillBytes(&pattern, dst, (long)(size / 0x100) * 0x100, size % 0x100);
+    }
+}
+
 static void compareByte(char reg, const struct Operand *val)
 {
     Compare Compare = CMP;
@@ -798,18 +1345,12 @@ static void compareByte(char reg, const struct Operand *val)
         return;
 
     case MODE_INDIRECT_OFFSET:
-        if (val->offset[0] == '@') {
-            require(val->offset[1] == 'Y',
-                "only Y can be used as the offset register: got %s",
-                &val->offset[1]);
-        }
         if (reg == 'Y') {
             TYA();
         } else if (reg == 'X') {
             TXA();
         }
-        LDY(stringf("%s", val->offset));
-        CMP(stringf("(%s),Y", val->base));
+        CMP(indirectOperand(val));
         return;
 
     case MODE_REGISTER:
@@ -819,6 +1360,8 @@ static void compareByte(char reg, const struct Operand *val)
     fatalf("%s: unhandled mode type: %d", __func__, val->mode);
 }
 
+// Only for testing Z: the load before it already set Z but not C, which a
+// CMP #0 would.
 static void compareByteUnless0(char reg, const struct Operand *val) {
     if (val->mode == MODE_IMMEDIATE) {
         if (val->number.valid && val->number.value == 0) {
@@ -911,7 +1454,7 @@ void IFGE(const struct Operand *left, const struct Operand *right, const char *t
             JMP(strcopy(done));
         } else {
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCS(strcopy(then));
             JMP(strcopy(done));
         }
@@ -929,7 +1472,7 @@ void IFGE(const struct Operand *left, const struct Operand *right, const char *t
             loadByte('A', msb);
             BNE(strcopy(done));
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCS(strcopy(then));
             JMP(strcopy(done));
 
@@ -939,7 +1482,7 @@ void IFGE(const struct Operand *left, const struct Operand *right, const char *t
         if (left->mode == MODE_REGISTER) {
             compareByte(regHigh(left), &ZEROB);
             BNE(strcopy(then)); // leftH is >0 so left >0xFF > right
-            compareByteUnless0(regLow(left), right);
+            compareByte(regLow(left), right);
             BCS(strcopy(then));
             JMP(strcopy(done));
         } else {
@@ -950,7 +1493,7 @@ void IFGE(const struct Operand *left, const struct Operand *right, const char *t
             // No need to BCC(done) because it will ALWAYS be false (u8 cannot be < 0)
             BNE(strcopy(then)); // leftH >0 so left >0xff > right
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCS(strcopy(then));
             JMP(strcopy(done));
 
@@ -968,11 +1511,11 @@ void IFGE(const struct Operand *left, const struct Operand *right, const char *t
             struct Operand *lmsb = highByte(left);
 
             loadByte('A', lmsb);
-            compareByteUnless0('A', rmsb);
+            compareByte('A', rmsb);
             BCC(strcopy(done));
             BNE(strcopy(then));
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCS(strcopy(then));
             JMP(strcopy(done));
 
@@ -1009,7 +1552,7 @@ void IFLT(const struct Operand *left, const struct Operand *right, const char *t
             JMP(strcopy(done));
         } else {
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCC(strcopy(then));
             JMP(strcopy(done));
         }
@@ -1024,10 +1567,9 @@ void IFLT(const struct Operand *left, const struct Operand *right, const char *t
             struct Operand *msb = highByte(left);
 
             loadByte('A', msb);
-            BCC(strcopy(then)); // leftH < rightH so left < right
-            BNE(strcopy(done)); // leftH <> rightH so leftH > rightH (left >= right)
+            BNE(strcopy(done)); // leftH is >0 so left >0xFF and cannot be < right
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCC(strcopy(then));
             JMP(strcopy(done));
 
@@ -1045,11 +1587,11 @@ void IFLT(const struct Operand *left, const struct Operand *right, const char *t
             struct Operand *lmsb = highByte(left);
 
             loadByte('A', lmsb);
-            compareByteUnless0('A', rmsb);
+            compareByte('A', rmsb);
             BCC(strcopy(then));
             BNE(strcopy(done));
             loadByte('A', left);
-            compareByteUnless0('A', right);
+            compareByte('A', right);
             BCC(strcopy(then));
             JMP(strcopy(done));
 
@@ -1137,6 +1679,195 @@ void IFNE(const struct Operand *left, const struct Operand *right, const char *t
     }
 }
 
+// The widest span of keys, from the lowest to the highest, that a jump table
+// covers. Doubled, an index into it still fits in a byte.
+static const unsigned MAX_TABLE_SPAN = 128;
+
+// Bytes of code and data and the cycles to reach each case, added up.
+struct SwitchCost {
+    unsigned bytes;
+    unsigned cycles;
+};
+
+// A CMP and BEQ per case takes 4 cycles to match and 5 to go on.
+static struct SwitchCost chainCost(unsigned count)
+{
+    return (struct SwitchCost) { .bytes = 4 * count + 3, .cycles = 5 * count * (count - 1) / 2 + 4 * count };
+}
+
+// The middle key takes a CMP, BEQ and BCS, which also cost the keys below and
+// above it 6 and 7 cycles. Three keys or fewer are a chain.
+static struct SwitchCost treeCost(unsigned count)
+{
+    if (count <= 3) {
+        return chainCost(count);
+    }
+    unsigned          below = count / 2, above = count - below - 1;
+    struct SwitchCost left = treeCost(below), right = treeCost(above);
+    return (struct SwitchCost) {
+        .bytes  = 6 + left.bytes + right.bytes,
+        .cycles = 5 + left.cycles + 6 * below + right.cycles + 7 * above,
+    };
+}
+
+// The lowest key is subtracted, the value checked against the span, and the
+// 65C02 jumps with JMP (table,X) while the 6502 pushes the address less one
+// from two tables of bytes and returns to it.
+static struct SwitchCost tableCost(const struct Case sorted[], unsigned count)
+{
+    unsigned span   = sorted[count - 1].key - sorted[0].key + 1u;
+    unsigned bytes  = TargetCpu() == CPU_65C02 ? 9 : 14;
+    unsigned cycles = TargetCpu() == CPU_65C02 ? 14 : 26;
+    if (sorted[0].key != 0) {
+        bytes += 3;
+        cycles += 4;
+    }
+    return (struct SwitchCost) { .bytes = bytes + 2 * span, .cycles = cycles * count };
+}
+
+// Returns true if a is better than b for the goal. Balanced won't take more
+// than twice the bytes of a chain for it.
+static bool isCheaper(struct SwitchCost a, struct SwitchCost b, struct SwitchCost chain)
+{
+    switch (OptimizationGoal()) {
+    case GOAL_SIZE:
+        return a.bytes < b.bytes || (a.bytes == b.bytes && a.cycles < b.cycles);
+    case GOAL_BALANCED:
+        if (a.bytes > 2 * chain.bytes) {
+            return false;
+        }
+        break;
+    case GOAL_SPEED:
+        break;
+    }
+    return a.cycles < b.cycles || (a.cycles == b.cycles && a.bytes < b.bytes);
+}
+
+static int byKey(const void *a, const void *b)
+{
+    const struct Case *x = a, *y = b;
+    return (int)x->key - (int)y->key;
+}
+
+static void compareChain(char reg, const struct Case cases[], unsigned count, const char *done)
+{
+    for (unsigned i = 0; i < count; i++) {
+        compareByte(reg, cases[i].operand);
+        BEQ(strcopy(cases[i].label));
+    }
+    JMP(strcopy(done));
+}
+
+static void compareTree(char reg, const struct Case sorted[], unsigned count, const char *done)
+{
+    if (count <= 3) {
+        compareChain(reg, sorted, count, done);
+        return;
+    }
+    unsigned below = count / 2;
+    char    *above = MakeLabel();
+    compareByte(reg, sorted[below].operand);
+    BEQ(strcopy(sorted[below].label));
+    BCS(strcopy(above));
+    compareTree(reg, sorted, below, done);
+    Label(above);
+    compareTree(reg, sorted + below + 1, count - below - 1, done);
+    free(above);
+}
+
+// Adds a table called name with an entry for each key in the span, eight to a
+// line. A key without a case goes to done.
+static void addTable(const char *name, const struct Case sorted[], unsigned count, const char *done,
+    const char *directive, const char *prefix, const char *suffix)
+{
+    char     line[8 * (256 + 8) + 32];
+    size_t   len  = 0;
+    unsigned next = 0;
+    for (unsigned key = sorted[0].key; key <= sorted[count - 1].key; key++) {
+        const char *label = sorted[next].key == key ? sorted[next++].label : done;
+        unsigned    index = key - sorted[0].key;
+        if (index % 8 == 0) {
+            if (len > 0) {
+                ASM(stringf("%.*s\n", (int)len, line));
+            }
+            len = (size_t)snprintf(line, sizeof line, "%s\t%s ", index == 0 ? name : "", directive);
+        } else {
+            line[len++] = ',';
+        }
+        len += (size_t)snprintf(line + len, sizeof line - len, "%s%s%s", prefix, label, suffix);
+    }
+    ASM(stringf("%.*s\n", (int)len, line));
+}
+
+static void jumpTable(const struct Case sorted[], unsigned count, const char *done)
+{
+    unsigned span = sorted[count - 1].key - sorted[0].key + 1u;
+    if (sorted[0].key != 0) {
+        SEC();
+        SBC(stringf("#%s", sorted[0].operand->immlo));
+    }
+    CMP(stringf("#%u", span));
+    BCS(strcopy(done));
+
+    char *table = stringf("%s.table", done);
+    if (TargetCpu() == CPU_65C02) {
+        ASM(stringf("\tASL\n\tTAX\n\tJMP (%s,X)\n", table));
+        addTable(table, sorted, count, done, "DA", "", "");
+    } else {
+        ASM(stringf("\tTAX\n\tLDA %s+%u,X\n\tPHA\n\tLDA %s,X\n\tPHA\n\tRTS\n", table, span, table));
+        addTable(table, sorted, count, done, "DFB", "<", "-1");
+        addTable("", sorted, count, done, "DFB", ">", "-1");
+    }
+    free(table);
+}
+
+// value == the key of a case, or else done
+void SWITCH(const struct Operand *value, const struct Case cases[], unsigned count, const char *done, bool mayUseX)
+{
+    REM(macroString(__func__, value, NULL, NULL));
+
+    struct Case *sorted = calloc(count, sizeof(*sorted));
+    require(sorted, "calloc failed");
+    memcpy(sorted, cases, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), byKey);
+
+    struct SwitchCost chain = chainCost(count), tree = treeCost(count), best = chain;
+    enum { CHAIN, TREE, TABLE } how = CHAIN;
+    if (isCheaper(tree, best, chain)) {
+        best = tree;
+        how  = TREE;
+    }
+    bool isTableable = mayUseX && value->mode != MODE_REGISTER
+        && sorted[count - 1].key - sorted[0].key < (int)MAX_TABLE_SPAN;
+    if (isTableable && isCheaper(tableCost(sorted, count), best, chain)) {
+        how = TABLE;
+    }
+
+    char reg = 'A';
+    if (value->mode == MODE_REGISTER) {
+        reg = regLow(value);
+    } else {
+        loadByte('A', value);
+    }
+    switch (how) {
+    case CHAIN:
+        REM(stringf("  %u cases compared in turn, else %s", count, done));
+        compareChain(reg, cases, count, done);
+        break;
+    case TREE:
+        REM(stringf("  %u cases compared by halves, else %s", count, done));
+        compareTree(reg, sorted, count, done);
+        Tally("if chains made compare trees");
+        break;
+    case TABLE:
+        REM(stringf("  %u cases in a jump table, else %s", count, done));
+        jumpTable(sorted, count, done);
+        Tally("if chains made jump tables");
+        break;
+    }
+    free(sorted);
+}
+
 void LESS(const struct Operand *dst, const struct Operand *src) { mathMacro(&subtract, dst, dst, src); }
 void NOT(const struct Operand *dst, const struct Operand *src) { mathMacro(&bitwiseXor, dst, src, &ONES); }
 
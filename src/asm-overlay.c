@@ -0,0 +1,598 @@
+// Overlays the storage of subroutine variables that are never live together.
+//
+// A2 has no stack frames, so every parameter, output and local of a subroutine
+// has its own bytes for the whole run. Here the calls in the code list are
+// followed into each subroutine and back out of every place it returns from,
+// so a variable is live from where it's stored, through whatever gets called,
+// to where it's last read. Variables that are never stored while another is
+// live share its bytes the way a linker overlays static frames.
+//
+// Recursive subroutines and code that can be entered from outside the calls
+// that are followed, like a label whose address is taken, keep their own
+// bytes.
+//
+// This file is included by asm.c after asm-smc.c.
+
+static const unsigned MAX_OVERLAY_SIZE = 16;
+
+struct FrameVariable {
+    struct Instruction   *at; // its HEX in the data list or NULL once overlaid
+    const char           *name;
+    unsigned              size;
+    unsigned              bit; // of its first byte in the live sets
+    bool                  isEligible;
+    struct FrameVariable *shares;
+};
+
+// What an instruction does with a FrameVariable.
+struct FrameAccess {
+    int      var; // or -1
+    uint32_t uses, kills; // bytes read and bytes stored
+    bool     writes;      // may store any of its bytes
+};
+
+struct Edges {
+    unsigned  len, cap;
+    unsigned *to;
+};
+
+// A JSR, or inline assembly that mentions a subroutine.
+struct CallSite {
+    unsigned site, callee;
+};
+
+static struct {
+    unsigned              len;
+    struct FrameVariable *items;
+    unsigned              bytes;
+    unsigned             *owners; // FrameVariable of each byte
+    unsigned              words;  // per set of bytes
+    uint64_t             *liveIn, *liveOut;
+    struct FrameAccess   *accesses;
+    struct Edges         *edges;   // to the code that runs next in the same subroutine
+    struct Edges         *calls;   // to the subroutines called
+    struct Edges         *returns; // Calls returned from
+    unsigned              callCount;
+    struct CallSite          *callItems;
+    uint64_t            **writes; // memo for writesFrom
+    bool                 *conflicts; // len x len
+} frames;
+
+static void addEdge(struct Edges *edges, unsigned to)
+{
+    for (unsigned i = 0; i < edges->len; i++) {
+        if (edges->to[i] == to) {
+            return;
+        }
+    }
+    if (edges->len == edges->cap) {
+        edges->cap = edges->cap ? edges->cap * 2 : 4;
+        edges->to  = realloc(edges->to, edges->cap * sizeof(*edges->to));
+        require(edges->to, "realloc failed");
+    }
+    edges->to[edges->len++] = to;
+}
+
+static void addCall(unsigned k, unsigned callee)
+{
+    frames.callItems = realloc(frames.callItems, (frames.callCount + 1) * sizeof(*frames.callItems));
+    require(frames.callItems, "realloc failed");
+    frames.callItems[frames.callCount] = (struct CallSite) { k, callee };
+
+    addEdge(&frames.calls[k], callee);
+    for (const long *r = returnsFrom(callee); *r >= 0; r++) {
+        addEdge(&frames.returns[*r], frames.callCount);
+    }
+    frames.callCount++;
+}
+
+static void addCallFromAssembly(struct LabelInfo *info, void *k)
+{
+    info = resolveLabel(info);
+    if (info && isCode(info->at)) {
+        addCall(*(unsigned *)k, info->position);
+    }
+}
+
+static void buildCallGraph(void)
+{
+    frames.edges     = calloc(flow.len + 1, sizeof(*frames.edges));
+    frames.calls     = calloc(flow.len + 1, sizeof(*frames.calls));
+    frames.returns   = calloc(flow.len + 1, sizeof(*frames.returns));
+    frames.writes    = calloc(flow.len + 1, sizeof(*frames.writes));
+    frames.callCount = 0;
+    frames.callItems = NULL;
+    require(frames.edges && frames.calls && frames.returns && frames.writes, "calloc failed");
+
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        if (p->assembly) {
+            forEachLabelIn(p->assembly, addCallFromAssembly, &k);
+        }
+        long callee = !p->assembly && p->op == OP_JSR ? positionOf(p->operand) : -1;
+        if (callee >= 0) {
+            addCall(k, (unsigned)callee);
+        }
+        unsigned succ[2], count = successorsOf(k, succ);
+        for (unsigned i = 0; i < count; i++) {
+            addEdge(&frames.edges[k], succ[i]);
+        }
+    }
+}
+
+// Sets reached for the code that runs from entry until it returns.
+static void reachFrom(unsigned entry, bool *reached)
+{
+    unsigned *stack = calloc(flow.len, sizeof(*stack));
+    unsigned  len   = 0;
+    require(stack, "calloc failed");
+
+    stack[len++]   = entry;
+    reached[entry] = true;
+    while (len > 0) {
+        unsigned k = stack[--len];
+        for (const struct Edges *edges = &frames.edges[k]; edges; edges = edges == &frames.edges[k] ? &frames.calls[k] : NULL) {
+            for (unsigned i = 0; i < edges->len; i++) {
+                if (!reached[edges->to[i]]) {
+                    reached[edges->to[i]] = true;
+                    stack[len++]          = edges->to[i];
+                }
+            }
+        }
+    }
+    free(stack);
+}
+
+static void findFrameVariables(void)
+{
+    frames.len   = 0;
+    frames.items = NULL;
+    frames.bytes = 0;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op != OP_HEX || p->label[0] == '\0') {
+            continue;
+        }
+        const char       *dot = strchr(p->label, '.');
+        struct LabelInfo *sub = dot ? findLabel(p->label, (size_t)(dot - p->label)) : NULL;
+        unsigned          size = (unsigned)strlen(p->operand) / 2;
+        bool              isWhole = !p->next || p->next->op != OP_HEX || p->next->label[0] != '\0';
+        bool              isOwned = dot && ((sub && isCode(sub->at)) || isInlined(p->label, (size_t)(dot - p->label)));
+        if (!isOwned || size > MAX_OVERLAY_SIZE || !isWhole) {
+            continue;
+        }
+
+        frames.items = realloc(frames.items, (frames.len + 1) * sizeof(*frames.items));
+        require(frames.items, "realloc failed");
+        frames.items[frames.len++] = (struct FrameVariable) {
+            .at         = p,
+            .name       = p->label,
+            .size       = size,
+            .bit        = frames.bytes,
+            .isEligible = true,
+        };
+        frames.bytes += size;
+    }
+
+    frames.owners = calloc(frames.bytes + 1, sizeof(*frames.owners));
+    require(frames.owners, "calloc failed");
+    for (unsigned i = 0; i < frames.len; i++) {
+        for (unsigned j = 0; j < frames.items[i].size; j++) {
+            frames.owners[frames.items[i].bit + j] = i;
+        }
+    }
+}
+
+static int findFrameVariable(const char *operand)
+{
+    size_t len = 0;
+    while (isLabelChar(operand[len])) {
+        len++;
+    }
+    for (unsigned i = 0; i < frames.len && len > 0; i++) {
+        if (strncmp(frames.items[i].name, operand, len) == 0 && frames.items[i].name[len] == '\0') {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static struct FrameAccess frameAccessOf(const struct Instruction *p)
+{
+    struct FrameAccess access = { .var = -1 };
+    if (p->assembly || !isCode(p)) {
+        return access;
+    }
+
+    const char *operand = p->operand;
+    if (operand[0] == '#') {
+        int var = findFrameVariable(operand + 1 + (operand[1] == '<' || operand[1] == '>'));
+        if (var >= 0) {
+            frames.items[var].isEligible = false;
+        }
+        return access;
+    }
+
+    bool isIndirect = operand[0] == '(';
+    access.var      = findFrameVariable(operand + isIndirect);
+    if (access.var < 0) {
+        return access;
+    }
+
+    struct FrameVariable *var  = &frames.items[access.var];
+    const char           *rest = operand + isIndirect + strlen(var->name);
+    uint32_t              all  = (uint32_t)((1ull << var->size) - 1);
+    bool isStore  = p->op == OP_STA || p->op == OP_STX || p->op == OP_STY || p->op == OP_STZ;
+    bool isModify = p->op == OP_INC || p->op == OP_DEC || isShift(p->op) || p->op == OP_TSB || p->op == OP_TRB;
+
+    if (isIndirect) {
+        if ((strcmp(rest, "),Y") != 0 && strcmp(rest, ")") != 0) || var->size < 2) {
+            var->isEligible = false;
+        }
+        access.uses = 3;
+        return access;
+    }
+
+    unsigned offset = skipOffset(&rest);
+    if (offset >= var->size) {
+        var->isEligible = false;
+        return access;
+    }
+    if (rest[0] == '\0') {
+        uint32_t byte = 1u << offset;
+        access.uses   = isStore ? 0 : byte;
+        access.kills  = isStore ? byte : 0;
+        access.writes = isStore || isModify;
+        return access;
+    }
+    if (strcmp(rest, ",X") == 0 || strcmp(rest, ",Y") == 0) {
+        access.uses   = isStore ? 0 : all;
+        access.writes = isStore || isModify;
+        return access;
+    }
+    var->isEligible = false;
+    return access;
+}
+
+static bool isLive(const uint64_t *set, unsigned bit) { return (set[bit / 64] >> (bit % 64)) & 1; }
+
+static void setLive(uint64_t *set, unsigned bit) { set[bit / 64] |= 1ull << (bit % 64); }
+
+static void addBytes(uint64_t *set, const struct FrameAccess *access, uint32_t bytes)
+{
+    for (unsigned j = 0; access->var >= 0 && j < frames.items[access->var].size; j++) {
+        if ((bytes >> j) & 1) {
+            setLive(set, frames.items[access->var].bit + j);
+        }
+    }
+}
+
+// Returns the bytes that the subroutine at entry or anything it calls may store.
+static const uint64_t *writesFrom(unsigned entry)
+{
+    if (frames.writes[entry]) {
+        return frames.writes[entry];
+    }
+
+    uint64_t *writes  = calloc(frames.words + 1, sizeof(*writes));
+    bool     *reached = calloc(flow.len + 1, sizeof(*reached));
+    require(writes && reached, "calloc failed");
+    reachFrom(entry, reached);
+    for (unsigned k = 0; k < flow.len; k++) {
+        if (reached[k] && frames.accesses[k].writes) {
+            addBytes(writes, &frames.accesses[k], ~0u);
+        }
+    }
+    free(reached);
+
+    frames.writes[entry] = writes;
+    return writes;
+}
+
+// Computes which bytes are live before and after each instruction. A call
+// needs whatever the subroutine reads before storing it, and a return needs
+// whatever the code after the calls it returns from reads, but only of the
+// bytes that the subroutine could have changed. The rest are the same as
+// before the call, see findFrameConflicts.
+static void computeFrameLiveness(void)
+{
+    frames.liveIn  = calloc((size_t)flow.len * frames.words + 1, sizeof(*frames.liveIn));
+    frames.liveOut = calloc((size_t)flow.len * frames.words + 1, sizeof(*frames.liveOut));
+    uint64_t *uses  = calloc(frames.words + 1, sizeof(*uses));
+    uint64_t *kills = calloc(frames.words + 1, sizeof(*kills));
+    require(frames.liveIn && frames.liveOut && uses && kills, "calloc failed");
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned k = flow.len; k-- > 0;) {
+            uint64_t *in = &frames.liveIn[k * frames.words], *out = &frames.liveOut[k * frames.words];
+            for (unsigned i = 0; i < frames.edges[k].len; i++) {
+                const uint64_t *next = &frames.liveIn[frames.edges[k].to[i] * frames.words];
+                for (unsigned w = 0; w < frames.words; w++) {
+                    out[w] |= next[w];
+                }
+            }
+            for (unsigned i = 0; i < frames.returns[k].len; i++) {
+                const struct CallSite *call = &frames.callItems[frames.returns[k].to[i]];
+                if (call->site + 1 >= flow.len) {
+                    continue;
+                }
+                const uint64_t *next   = &frames.liveIn[(call->site + 1) * frames.words];
+                const uint64_t *writes = writesFrom(call->callee);
+                for (unsigned w = 0; w < frames.words; w++) {
+                    out[w] |= next[w] & writes[w];
+                }
+            }
+
+            memset(uses, 0, (frames.words + 1) * sizeof(*uses));
+            memset(kills, 0, (frames.words + 1) * sizeof(*kills));
+            addBytes(uses, &frames.accesses[k], frames.accesses[k].uses);
+            addBytes(kills, &frames.accesses[k], frames.accesses[k].kills);
+            for (unsigned i = 0; i < frames.calls[k].len; i++) {
+                const uint64_t *callee = &frames.liveIn[frames.calls[k].to[i] * frames.words];
+                for (unsigned w = 0; w < frames.words; w++) {
+                    uses[w] |= callee[w];
+                }
+            }
+            for (unsigned w = 0; w < frames.words; w++) {
+                uint64_t live = uses[w] | (out[w] & ~kills[w]);
+                if (live != in[w]) {
+                    in[w]   = live;
+                    changed = true;
+                }
+            }
+        }
+    }
+    free(uses);
+    free(kills);
+}
+
+static const unsigned ADDRESS_TAKEN = ~0u;
+
+static void markAddressTaken(struct LabelInfo *info, void *arg)
+{
+    info = resolveLabel(info);
+    if (info) {
+        info->segment = ADDRESS_TAKEN;
+    }
+}
+
+static void excludeFrameVariables(void)
+{
+    // Code entered from elsewhere may need what its variables already hold.
+    for (unsigned k = 0; k < flow.len; k++) {
+        if (!isProgramEntry(k)) {
+            continue;
+        }
+        for (unsigned b = 0; b < frames.bytes; b++) {
+            if (isLive(&frames.liveIn[k * frames.words], b)) {
+                frames.items[frames.owners[b]].isEligible = false;
+            }
+        }
+    }
+
+    // A label whose address is taken may be called at any time, like a hook,
+    // and a recursive subroutine has more than one frame at once.
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op && !isData(p)) {
+            forEachLabelIn(p->operand, markAddressTaken, NULL);
+        }
+    }
+    bool *reached = calloc(flow.len + 1, sizeof(*reached));
+    require(reached, "calloc failed");
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p    = flow.items[k];
+        struct LabelInfo         *info = !p->assembly && p->label[0] != '\0' ? labelInfo(p->label) : NULL;
+        if (info && (info->codeRefs > info->jumps || info->segment == ADDRESS_TAKEN)) {
+            reachFrom(k, reached);
+        }
+    }
+    for (unsigned i = 0; i < frames.len; i++) {
+        struct FrameVariable *var = &frames.items[i];
+        const char           *dot = strchr(var->name, '.');
+        struct LabelInfo     *sub = findLabel(var->name, (size_t)(dot - var->name));
+        if (!var->isEligible || !sub) {
+            // An inlined subroutine has no calls to be recursive with.
+            continue;
+        }
+
+        bool *fromSub = calloc(flow.len + 1, sizeof(*fromSub));
+        require(fromSub, "calloc failed");
+        reachFrom(sub->position, fromSub);
+        for (unsigned k = 0; k < flow.len && var->isEligible; k++) {
+            const struct Instruction *p = flow.items[k];
+            bool isCall = fromSub[k] && !p->assembly && p->op == OP_JSR
+                       && positionOf(p->operand) == (long)sub->position;
+            if (isCall || (reached[k] && frames.accesses[k].var == (int)i)) {
+                var->isEligible = false;
+            }
+        }
+        free(fromSub);
+    }
+    free(reached);
+}
+
+static void addConflict(unsigned a, unsigned b)
+{
+    if (a != b) {
+        frames.conflicts[a * frames.len + b] = true;
+        frames.conflicts[b * frames.len + a] = true;
+    }
+}
+
+static void findFrameConflicts(void)
+{
+    frames.conflicts = calloc((size_t)frames.len * frames.len + 1, sizeof(*frames.conflicts));
+    require(frames.conflicts, "calloc failed");
+
+    // Storing one while another is live
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct FrameAccess *access = &frames.accesses[k];
+        if (access->var < 0 || !access->writes) {
+            continue;
+        }
+        const uint64_t *out = &frames.liveOut[k * frames.words];
+        for (unsigned b = 0; b < frames.bytes; b++) {
+            if (isLive(out, b)) {
+                addConflict(frames.owners[b], (unsigned)access->var);
+            }
+        }
+    }
+
+    // Anything stored by a subroutine while one that it doesn't store is live
+    // across the call
+    for (unsigned i = 0; i < frames.callCount; i++) {
+        const struct CallSite *call   = &frames.callItems[i];
+        const uint64_t    *writes = writesFrom(call->callee);
+        if (call->site + 1 >= flow.len) {
+            continue;
+        }
+        const uint64_t *after = &frames.liveIn[(call->site + 1) * frames.words];
+        for (unsigned b = 0; b < frames.bytes; b++) {
+            if (!isLive(after, b) || isLive(writes, b)) {
+                continue;
+            }
+            for (unsigned c = 0; c < frames.bytes; c++) {
+                if (isLive(writes, c)) {
+                    addConflict(frames.owners[b], frames.owners[c]);
+                }
+            }
+        }
+    }
+}
+
+// Sorts the biggest first so each one's bytes are enough for the rest.
+static int bySize(const void *a, const void *b)
+{
+    const struct FrameVariable *const *x = a, *const *y = b;
+    if ((*x)->size != (*y)->size) {
+        return (*x)->size > (*y)->size ? -1 : 1;
+    }
+    return *x < *y ? -1 : *x > *y;
+}
+
+static void overlayFrameVariables(void)
+{
+    struct FrameVariable **order = calloc(frames.len + 1, sizeof(*order));
+    require(order, "calloc failed");
+    unsigned count = 0;
+    for (unsigned i = 0; i < frames.len; i++) {
+        if (frames.items[i].isEligible) {
+            order[count++] = &frames.items[i];
+        }
+    }
+    qsort(order, count, sizeof(*order), bySize);
+
+    for (unsigned i = 0; i < count; i++) {
+        struct FrameVariable *var = order[i];
+        unsigned              v   = (unsigned)(var - frames.items);
+        for (unsigned j = 0; j < i && !var->shares; j++) {
+            struct FrameVariable *head = order[j];
+            if (head->shares) {
+                continue;
+            }
+            bool isFree = true;
+            for (unsigned m = 0; m < i && isFree; m++) {
+                struct FrameVariable *member = order[m];
+                unsigned              u      = (unsigned)(member - frames.items);
+                if (member == head || member->shares == head) {
+                    isFree = !frames.conflicts[u * frames.len + v];
+                }
+            }
+            if (isFree) {
+                var->shares = head;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct FrameVariable *var = order[i];
+        if (!var->shares) {
+            continue;
+        }
+        struct Instruction *prev = &dataHead;
+        while (prev->next != var->at) {
+            prev = prev->next;
+        }
+        struct Instruction *alias = Instruction(var->name, OP_EQU, strcopy(var->shares->name), NULL, NULL);
+        removeNextInstruction(prev);
+        alias->next             = var->shares->at->next;
+        var->shares->at->next   = alias;
+        var->name               = alias->label;
+        var->at                 = NULL;
+    }
+    free(order);
+
+    for (data = &dataHead; data->next; data = data->next) {
+    }
+}
+
+static void OverlayVariables(void)
+{
+    buildFlow();
+    if (flow.isUnknown) {
+        return;
+    }
+    findFrameVariables();
+    buildCallGraph();
+
+    frames.accesses = calloc(flow.len + 1, sizeof(*frames.accesses));
+    require(frames.accesses, "calloc failed");
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        frames.accesses[k]          = frameAccessOf(p);
+        for (unsigned i = 0; p->assembly && i < frames.len; i++) {
+            if (isMentioned(p->assembly, frames.items[i].name)) {
+                frames.items[i].isEligible = false;
+            }
+        }
+    }
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        for (unsigned i = 0; p->op == OP_EQU && i < frames.len; i++) {
+            if (isMentioned(p->operand, frames.items[i].name)) {
+                frames.items[i].isEligible = false;
+            }
+        }
+    }
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        for (unsigned i = 0; p->op && !isData(p) && i < frames.len; i++) {
+            if (isMentioned(p->operand, frames.items[i].name)) {
+                frames.items[i].isEligible = false;
+            }
+        }
+    }
+
+    frames.words = (frames.bytes + 63) / 64;
+    computeFrameLiveness();
+    excludeFrameVariables();
+    findFrameConflicts();
+    overlayFrameVariables();
+
+    for (unsigned k = 0; k < flow.len; k++) {
+        free(frames.edges[k].to);
+        free(frames.calls[k].to);
+        free(frames.returns[k].to);
+        free(frames.writes[k]);
+    }
+    free(frames.edges);
+    free(frames.calls);
+    free(frames.returns);
+    free(frames.writes);
+    free(frames.callItems);
+    free(frames.accesses);
+    free(frames.liveIn);
+    free(frames.liveOut);
+    free(frames.owners);
+    free(frames.conflicts);
+    freeFlow();
+}
+
+static void writeOverlayReport(FILE *fp)
+{
+    for (unsigned i = 0; i < frames.len; i++) {
+        const struct FrameVariable *var = &frames.items[i];
+        if (var->shares) {
+            fprintf(fp, "%s: shares %s\n", var->name, var->shares->name);
+        }
+    }
+}
@@ -0,0 +1,639 @@
+// Register allocation for the local byte variables of subroutines.
+//
+// A variable is kept in X or Y when nothing else needs that register while the
+// variable is live. Liveness is computed over every instruction of the program
+// so a JSR to a subroutine defined here only clobbers the registers it writes
+// and an RTS only needs the registers that subroutines return values in or that
+// a caller still needs after the JSR.
+//
+// This file is included by asm.c after asm-cfg.c.
+
+struct IndexRegister {
+    const char *name;
+    Operation   load, store, compare, increment, decrement, fromA, toA, push, pull;
+    const char *indexed; // suffix of operands indexed by it
+};
+
+static struct IndexRegister indexRegister(char name)
+{
+    if (name == 'X') {
+        return (struct IndexRegister) { "X", OP_LDX, OP_STX, OP_CPX, OP_INX, OP_DEX, OP_TAX, OP_TXA, OP_PHX, OP_PLX, ",X" };
+    }
+    return (struct IndexRegister) { "Y", OP_LDY, OP_STY, OP_CPY, OP_INY, OP_DEY, OP_TAY, OP_TYA, OP_PHY, OP_PLY, ",Y" };
+}
+
+struct Candidate {
+    char       *name;
+    const char *reg;    // or NULL when it stays in memory
+    char       *reason; // why it stays in memory
+    unsigned    uses;
+};
+
+struct Callee {
+    char *name;
+    bool  readsX, readsY;
+};
+
+static struct {
+    unsigned          len;
+    struct Candidate *items;
+    bool              returnsX, returnsY;
+    unsigned          calleeCount;
+    struct Callee    *callees;
+} allocation;
+
+void LocalByte(const char *name)
+{
+    allocation.items = realloc(allocation.items, (allocation.len + 1) * sizeof(*allocation.items));
+    require(allocation.items, "realloc failed");
+    allocation.items[allocation.len++] = (struct Candidate) { .name = strcopy(name) };
+}
+
+void TakesIn(const char *subroutine, const char *registers)
+{
+    allocation.callees = realloc(allocation.callees, (allocation.calleeCount + 1) * sizeof(*allocation.callees));
+    require(allocation.callees, "realloc failed");
+    allocation.callees[allocation.calleeCount++] = (struct Callee) {
+        .name   = strcopy(subroutine),
+        .readsX = strchr(registers, 'X') != NULL,
+        .readsY = strchr(registers, 'Y') != NULL,
+    };
+}
+
+void ReturnsIn(const char *registers)
+{
+    allocation.returnsX = allocation.returnsX || strchr(registers, 'X');
+    allocation.returnsY = allocation.returnsY || strchr(registers, 'Y');
+}
+
+// Instruction-level flow ------------------------------------------------------
+
+static struct {
+    unsigned             len;
+    struct Instruction **items;
+    bool                *varIn, *varOut; // the candidate is live
+    bool                *regIn, *regOut; // something else is in the register
+    bool                *regReturned;    // ...after the RTS returns to a caller
+    uint8_t             *clobbers;       // memo for clobbersFrom
+    long               **returns;        // memo for returnsFrom
+    bool                 isUnknown;      // a branch goes somewhere unmeasured
+} flow;
+
+static void freeFlow(void)
+{
+    for (unsigned k = 0; flow.returns && k < flow.len; k++) {
+        free(flow.returns[k]);
+    }
+    free(flow.items);
+    free(flow.varIn);
+    free(flow.varOut);
+    free(flow.regIn);
+    free(flow.regOut);
+    free(flow.regReturned);
+    free(flow.clobbers);
+    free(flow.returns);
+    memset(&flow, 0, sizeof flow);
+}
+
+static void buildFlow(void)
+{
+    buildBlocks();
+
+    unsigned count = 0;
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        count++;
+    }
+    freeFlow();
+    flow.items       = calloc(count + 1, sizeof(*flow.items));
+    flow.varIn       = calloc(count + 1, sizeof(*flow.varIn));
+    flow.varOut      = calloc(count + 1, sizeof(*flow.varOut));
+    flow.regIn       = calloc(count + 1, sizeof(*flow.regIn));
+    flow.regOut      = calloc(count + 1, sizeof(*flow.regOut));
+    flow.regReturned = calloc(count + 1, sizeof(*flow.regReturned));
+    flow.clobbers    = calloc(count + 1, sizeof(*flow.clobbers));
+    flow.returns     = calloc(count + 1, sizeof(*flow.returns));
+    require(flow.items && flow.varIn && flow.varOut && flow.regIn && flow.regOut && flow.regReturned && flow.clobbers
+            && flow.returns,
+        "calloc failed");
+
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (!isCode(p) && !p->assembly) {
+            continue;
+        }
+        if (isCode(p) && p->label[0] != '\0') {
+            labelInfo(p->label)->position = flow.len;
+        }
+        if (isCode(p) && p->operand[0] == '*' && strcmp(p->operand, "*+2+1") != 0) {
+            flow.isUnknown = true;
+        }
+        flow.items[flow.len++] = p;
+    }
+}
+
+// Returns the position of the code that operand jumps to or calls, or -1 if it
+// isn't in the code list.
+static long positionOf(const char *operand)
+{
+    struct LabelInfo *target = jumpTarget(operand);
+    return target && isCode(target->at) ? (long)target->position : -1;
+}
+
+static unsigned successorsOf(unsigned k, unsigned succ[2])
+{
+    const struct Instruction *p     = flow.items[k];
+    unsigned                  count = 0;
+    if (!p->assembly && isUnconditional(p)) {
+        long target = p->op == OP_JMP ? positionOf(p->operand) : -1;
+        if (target >= 0) {
+            succ[count++] = (unsigned)target;
+        }
+        return count;
+    }
+    if (k + 1 < flow.len) {
+        succ[count++] = k + 1;
+    }
+    if (!p->assembly && isBranch(p->op)) {
+        long target = strcmp(p->operand, "*+2+1") == 0 ? (long)k + 2 : positionOf(p->operand);
+        if (target >= 0 && target < (long)flow.len) {
+            succ[count++] = (unsigned)target;
+        }
+    }
+    return count;
+}
+
+// Returns true if control may enter k from somewhere other than its
+// predecessors in the code list, like a JSR or inline assembly.
+static bool isEntry(unsigned k)
+{
+    const struct Instruction *p = flow.items[k];
+    if (k == 0 || p->assembly || flow.items[k - 1]->assembly) {
+        return true;
+    }
+    if (p->label[0] == '\0') {
+        return false;
+    }
+    struct LabelInfo *info = labelInfo(p->label);
+    return !isLocalLabel(p->label) || info->refs > info->jumps;
+}
+
+static bool isAccess(const struct Instruction *p, const char *name)
+{
+    return isCode(p) && strcmp(p->operand, name) == 0;
+}
+
+static bool writesDirectly(const struct Instruction *p, const struct IndexRegister *reg)
+{
+    return p->op == reg->load || p->op == reg->fromA || p->op == reg->increment || p->op == reg->decrement
+        || p->op == reg->pull;
+}
+
+static bool clobbersFrom(unsigned entry, const struct IndexRegister *reg);
+
+// Returns true if p may change the register.
+static bool writesRegister(unsigned k, const struct IndexRegister *reg)
+{
+    const struct Instruction *p = flow.items[k];
+    if (p->assembly) {
+        return true;
+    }
+    if (p->op == OP_JSR) {
+        long callee = positionOf(p->operand);
+        return callee < 0 || clobbersFrom((unsigned)callee, reg);
+    }
+    return writesDirectly(p, reg);
+}
+
+// Returns true if calling the subroutine outside the code list may need what is
+// in the register.
+static bool readsOnCall(const char *operand, const struct IndexRegister *reg)
+{
+    for (unsigned i = 0; i < allocation.calleeCount; i++) {
+        const struct Callee *callee = &allocation.callees[i];
+        if (strcmp(callee->name, operand) == 0) {
+            return reg->name[0] == 'X' ? callee->readsX : callee->readsY;
+        }
+    }
+    return true;
+}
+
+// Returns true if p may need what is in the register.
+static bool readsRegister(unsigned k, const struct IndexRegister *reg)
+{
+    const struct Instruction *p = flow.items[k];
+    if (p->assembly) {
+        return true;
+    }
+    if (p->op == OP_JSR || p->op == OP_JMP) {
+        long callee = positionOf(p->operand);
+        if (callee >= 0) {
+            return p->op == OP_JSR && flow.regIn[callee];
+        }
+        return readsOnCall(p->operand, reg);
+    }
+    if (p->op == OP_RTS) {
+        return flow.regReturned[k] || (reg->name[0] == 'X' ? allocation.returnsX : allocation.returnsY);
+    }
+    size_t len = strlen(p->operand);
+    return p->op == reg->store || p->op == reg->compare || p->op == reg->toA || p->op == reg->push
+        || p->op == reg->increment || p->op == reg->decrement
+        || (len >= 2 && strcmp(p->operand + len - 2, reg->indexed) == 0)
+        || (reg->name[0] == 'X' && strstr(p->operand, ",X)") != NULL);
+}
+
+enum { CLOBBERS_UNKNOWN, CLOBBERS_VISITING, CLOBBERS_NO, CLOBBERS_YES };
+
+// Returns true if the subroutine at entry may change the register.
+static bool clobbersFrom(unsigned entry, const struct IndexRegister *reg)
+{
+    if (flow.clobbers[entry] == CLOBBERS_VISITING) {
+        return true;
+    }
+    if (flow.clobbers[entry] != CLOBBERS_UNKNOWN) {
+        return flow.clobbers[entry] == CLOBBERS_YES;
+    }
+    flow.clobbers[entry] = CLOBBERS_VISITING;
+
+    bool     *visited = calloc(flow.len, sizeof(*visited));
+    unsigned *stack   = calloc(flow.len, sizeof(*stack));
+    unsigned  len     = 0;
+    bool      result  = false;
+    require(visited && stack, "calloc failed");
+
+    stack[len++]   = entry;
+    visited[entry] = true;
+    while (len > 0 && !result) {
+        unsigned                  k = stack[--len];
+        const struct Instruction *p = flow.items[k];
+        if (writesRegister(k, reg) || (p->op == OP_JMP && positionOf(p->operand) < 0)) {
+            result = true;
+        }
+        unsigned succ[2], count = successorsOf(k, succ);
+        for (unsigned i = 0; i < count; i++) {
+            if (!visited[succ[i]]) {
+                visited[succ[i]] = true;
+                stack[len++]     = succ[i];
+            }
+        }
+    }
+    free(visited);
+    free(stack);
+
+    flow.clobbers[entry] = result ? CLOBBERS_YES : CLOBBERS_NO;
+    return result;
+}
+
+// Returns the positions that the subroutine at entry may return from, ending
+// with -1. A jump out of the code list returns from wherever it goes.
+static const long *returnsFrom(unsigned entry)
+{
+    if (flow.returns[entry]) {
+        return flow.returns[entry];
+    }
+
+    bool     *visited = calloc(flow.len, sizeof(*visited));
+    unsigned *stack   = calloc(flow.len, sizeof(*stack));
+    long     *returns = calloc(flow.len + 1, sizeof(*returns));
+    unsigned  len = 0, count = 0;
+    require(visited && stack && returns, "calloc failed");
+
+    stack[len++]   = entry;
+    visited[entry] = true;
+    while (len > 0) {
+        unsigned k = stack[--len];
+        const struct Instruction *p = flow.items[k];
+        if (p->assembly || p->op == OP_RTS || (p->op == OP_JMP && positionOf(p->operand) < 0)) {
+            returns[count++] = k;
+        }
+        unsigned succ[2], n = successorsOf(k, succ);
+        for (unsigned i = 0; i < n; i++) {
+            if (!visited[succ[i]]) {
+                visited[succ[i]] = true;
+                stack[len++]     = succ[i];
+            }
+        }
+    }
+    returns[count] = -1;
+    free(visited);
+    free(stack);
+
+    flow.returns[entry] = returns;
+    return returns;
+}
+
+// Computes where the variable name and anything else in the register are live.
+static void computeLiveness(const char *name, const struct IndexRegister *reg)
+{
+    memset(flow.varIn, 0, flow.len * sizeof(*flow.varIn));
+    memset(flow.varOut, 0, flow.len * sizeof(*flow.varOut));
+    memset(flow.regIn, 0, flow.len * sizeof(*flow.regIn));
+    memset(flow.regOut, 0, flow.len * sizeof(*flow.regOut));
+    memset(flow.regReturned, 0, flow.len * sizeof(*flow.regReturned));
+    memset(flow.clobbers, 0, flow.len * sizeof(*flow.clobbers));
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned k = flow.len; k-- > 0;) {
+            const struct Instruction *p = flow.items[k];
+
+            unsigned succ[2], count = successorsOf(k, succ);
+            bool     varOut = false, regOut = false;
+            for (unsigned i = 0; i < count; i++) {
+                varOut = varOut || flow.varIn[succ[i]];
+                regOut = regOut || flow.regIn[succ[i]];
+            }
+
+            bool isVarUse = isAccess(p, name) && p->op != OP_STA && p->op != OP_STZ && p->op != reg->store;
+            bool isVarDef = isAccess(p, name) && !isVarUse;
+            bool varIn    = isVarUse || (varOut && !isVarDef);
+            bool regIn    = readsRegister(k, reg) || (regOut && !writesRegister(k, reg));
+
+            changed = changed || varOut != flow.varOut[k] || regOut != flow.regOut[k]
+                   || varIn != flow.varIn[k] || regIn != flow.regIn[k];
+            flow.varOut[k] = varOut;
+            flow.regOut[k] = regOut;
+            flow.varIn[k]  = varIn;
+            flow.regIn[k]  = regIn;
+        }
+
+        // What a caller needs after a JSR is needed at every RTS of the callee.
+        for (unsigned k = 0; k < flow.len; k++) {
+            long callee = flow.items[k]->op == OP_JSR && flow.regOut[k] ? positionOf(flow.items[k]->operand) : -1;
+            for (const long *r = callee >= 0 ? returnsFrom((unsigned)callee) : NULL; r && *r >= 0; r++) {
+                changed              = changed || !flow.regReturned[*r];
+                flow.regReturned[*r] = true;
+            }
+        }
+    }
+}
+
+// Returns true if a branch may test the N and Z flags that p leaves before
+// another instruction sets them.
+static bool areFlagsUsedAfter(struct Instruction *p)
+{
+    Operation setters[] = {
+        OP_ADC, OP_AND, OP_ASL, OP_CMP, OP_CPX, OP_CPY, OP_DEC, OP_DEX, OP_DEY, OP_EOR, OP_INC, OP_INX,
+        OP_INY, OP_LDA, OP_LDX, OP_LDY, OP_LSR, OP_ORA, OP_PLA, OP_ROL, OP_ROR, OP_SBC, OP_TAX, OP_TAY,
+        OP_TXA, OP_TYA,
+    };
+    p = nextCode(p);
+    for (unsigned hops = 0; p && hops < 64; hops++) {
+        if (p->assembly || p->op == OP_BEQ || p->op == OP_BNE || p->op == OP_BMI || p->op == OP_BPL) {
+            return true;
+        }
+        if (p->op == OP_RTS || p->op == OP_JSR) {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof setters / sizeof setters[0]; i++) {
+            if (p->op == setters[i]) {
+                return false;
+            }
+        }
+        if (p->op == OP_JMP) {
+            struct LabelInfo *target = jumpTarget(p->operand);
+            if (!target) {
+                return false;
+            }
+            p = target->at;
+        } else {
+            p = nextCode(p);
+        }
+    }
+    return p != NULL;
+}
+
+// Allocation -----------------------------------------------------------------
+
+static bool isMentioned(const char *text, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *p = strstr(text, name); p; p = strstr(p + 1, name)) {
+        bool isStart = p == text || !isLabelChar(p[-1]);
+        if (isStart && !isLabelChar(p[len])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns why the variable can't be kept in the register or NULL if it can.
+static char *checkUses(struct Candidate *candidate, const struct IndexRegister *reg)
+{
+    const char *name = candidate->name;
+    for (unsigned k = 0; k < flow.len; k++) {
+        struct Instruction *p = flow.items[k];
+        if (p->assembly) {
+            if (isMentioned(p->assembly, name)) {
+                return strcopy("used by inline assembly");
+            }
+            continue;
+        }
+        if (!isMentioned(p->operand, name)) {
+            continue;
+        }
+        if (!isAccess(p, name)) {
+            return stringf("address used by %s %s", p->op, p->operand);
+        }
+        bool isRegister = p->op == reg->load || p->op == reg->store;
+        if (!isRegister && p->op != OP_LDA && p->op != OP_STA && p->op != OP_STZ && p->op != OP_INC
+            && p->op != OP_DEC) {
+            return stringf("used by %s", p->op);
+        }
+        if (k > 0 && isPinned(flow.items[k - 1])) {
+            return stringf("%s is skipped by %s %s", p->op, flow.items[k - 1]->op, flow.items[k - 1]->operand);
+        }
+        if (isRegister && p->label[0] != '\0') {
+            struct Instruction *next = nextCode(p);
+            if (!next || next->assembly || (next->label[0] != '\0' && !isMovable(labelInfo(p->label)))) {
+                return stringf("%s has label %s", p->op, p->label);
+            }
+        }
+        // STA becomes a transfer and STZ a load, which both set the flags.
+        if ((p->op == reg->load || p->op == OP_STA || p->op == OP_STZ) && areFlagsUsedAfter(p)) {
+            return stringf("flags of %s are tested", p->op);
+        }
+    }
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op && !isData(p) && isMentioned(p->operand, name)) {
+            return stringf("used by %s", p->label);
+        }
+    }
+    return NULL;
+}
+
+static char *checkRegister(struct Candidate *candidate, const struct IndexRegister *reg)
+{
+    char *reason = checkUses(candidate, reg);
+    if (reason) {
+        return reason;
+    }
+
+    const char *name = candidate->name;
+    computeLiveness(name, reg);
+    for (unsigned k = 0; k < flow.len; k++) {
+        struct Instruction *p = flow.items[k];
+        if (flow.varIn[k] && isEntry(k)) {
+            return strcopy("may be used before it is set");
+        }
+        if (!isAccess(p, name)) {
+            if (flow.varOut[k] && writesRegister(k, reg)) {
+                return p->assembly ? strcopy("live across inline assembly")
+                                   : stringf("live across %s %s", p->op, p->operand);
+            }
+            continue;
+        }
+        bool isDef = p->op == OP_STA || p->op == OP_STZ || p->op == OP_INC || p->op == OP_DEC;
+        if (isDef && flow.regOut[k]) {
+            return stringf("%s is in use at %s %s", reg->name, p->op, p->operand);
+        }
+    }
+    return NULL;
+}
+
+// Removes p, whose label goes to the code after it.
+static void removeKeepingLabel(struct Instruction *prev, struct Instruction *p)
+{
+    if (p->label[0] != '\0') {
+        struct Instruction *next = nextCode(p);
+        if (next->label[0] == '\0') {
+            strcpy(next->label, p->label);
+        } else {
+            renameJumps(p->label, next->label);
+        }
+    }
+    removeNextInstruction(prev);
+}
+
+static void keepInRegister(struct Candidate *candidate, const struct IndexRegister *reg)
+{
+    const char *name = candidate->name;
+    for (struct Instruction *prev = &codeHead, *p = prev->next; p; p = prev->next) {
+        if (!isAccess(p, name)) {
+            prev = p;
+            continue;
+        }
+        if (p->op == reg->load || p->op == reg->store) {
+            removeKeepingLabel(prev, p);
+            continue;
+        }
+        if (p->op == OP_STZ) {
+            p->op = reg->load;
+            strcpy(p->operand, "#$00");
+            prev = p;
+            continue;
+        }
+        if (p->op == OP_LDA) {
+            p->op = reg->toA;
+        } else if (p->op == OP_STA) {
+            p->op = reg->fromA;
+        } else if (p->op == OP_INC) {
+            p->op = reg->increment;
+        } else if (p->op == OP_DEC) {
+            p->op = reg->decrement;
+        }
+        p->operand[0] = '\0';
+        prev          = p;
+    }
+
+    for (struct Instruction *prev = &dataHead, *p = prev->next; p; prev = p, p = p->next) {
+        if (strcmp(p->label, name) == 0) {
+            removeNextInstruction(prev);
+            break;
+        }
+    }
+    for (data = &dataHead; data->next; data = data->next) {
+    }
+
+    candidate->reg = reg->name;
+}
+
+static unsigned countUses(const char *name, Operation op)
+{
+    unsigned count = 0;
+    for (unsigned k = 0; k < flow.len; k++) {
+        if (isAccess(flow.items[k], name) && (!op || flow.items[k]->op == op)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static int byUses(const void *a, const void *b)
+{
+    const struct Candidate *x = a, *y = b;
+    return (int)y->uses - (int)x->uses;
+}
+
+static void AllocateRegisters(void)
+{
+    buildFlow();
+    if (flow.isUnknown) {
+        return;
+    }
+
+    struct Candidate *order = calloc(allocation.len + 1, sizeof(*order));
+    require(order, "calloc failed");
+    for (unsigned i = 0; i < allocation.len; i++) {
+        allocation.items[i].uses = countUses(allocation.items[i].name, NULL);
+        order[i]                 = allocation.items[i];
+        order[i].uses            = allocation.items[i].uses * allocation.len + allocation.len - i;
+    }
+    qsort(order, allocation.len, sizeof(*order), byUses);
+
+    for (unsigned i = 0; i < allocation.len; i++) {
+        struct Candidate *candidate = NULL;
+        for (unsigned j = 0; j < allocation.len; j++) {
+            if (allocation.items[j].name == order[i].name) {
+                candidate = &allocation.items[j];
+            }
+        }
+        if (candidate->uses == 0) {
+            continue;
+        }
+
+        // Prefer the register that it's already loaded into most.
+        struct IndexRegister first = indexRegister('Y'), second = indexRegister('X');
+        buildFlow();
+        if (countUses(candidate->name, OP_LDX) + countUses(candidate->name, OP_STX)
+            > countUses(candidate->name, OP_LDY) + countUses(candidate->name, OP_STY)) {
+            first  = indexRegister('X');
+            second = indexRegister('Y');
+        }
+
+        char *reason = checkRegister(candidate, &first);
+        if (!reason) {
+            keepInRegister(candidate, &first);
+            continue;
+        }
+        char *otherReason = checkRegister(candidate, &second);
+        if (!otherReason) {
+            free(reason);
+            keepInRegister(candidate, &second);
+            continue;
+        }
+        candidate->reason = stringf("%s: %s; %s: %s", first.name, reason, second.name, otherReason);
+        free(reason);
+        free(otherReason);
+    }
+    free(order);
+    freeFlow();
+}
+
+static void writeZeroPageReport(FILE *fp);
+static void writeOverlayReport(FILE *fp);
+
+void WriteRegisterReport(FILE *fp)
+{
+    for (unsigned i = 0; i < allocation.len; i++) {
+        const struct Candidate *candidate = &allocation.items[i];
+        if (candidate->reg) {
+            fprintf(fp, "%s: %s\n", candidate->name, candidate->reg);
+        } else if (candidate->uses == 0) {
+            fprintf(fp, "%s: unused\n", candidate->name);
+        } else {
+            fprintf(fp, "%s: memory (%s)\n", candidate->name, candidate->reason ? candidate->reason : "?");
+        }
+    }
+    writeZeroPageReport(fp);
+    writeOverlayReport(fp);
+}
@@ -0,0 +1,218 @@
+// Self-modifying code for pointers without a location.
+//
+// With -smc, a pointer that is only dereferenced in a loop deeper than where it
+// is set isn't kept in the zero page. Each LDA (ptr),Y becomes an LDA $FFFF,Y
+// whose operand bytes every store to the pointer also writes, so the loop runs
+// a cycle faster per access and the two bytes of zero page go to something
+// else. When nothing reads the pointer itself, the first of those operands is
+// where it lives and the HEX it had goes away.
+//
+// Patched code can't run from ROM, which is why it has to be asked for.
+//
+// This file is included by asm.c after asm-zp.c.
+
+struct PatchedPointer {
+    unsigned sites;   // dereferences
+    unsigned writes;  // stores, INCs and DECs of either byte
+    unsigned minSite; // loop depth of the shallowest dereference
+    unsigned maxWrite;
+    bool     isRead; // loaded or compared as a number
+    bool     isEligible;
+    bool     isMoved; // into the operand of its first dereference
+};
+
+static bool hasAbsoluteForm(Operation op)
+{
+    return op == OP_LDA || op == OP_STA || op == OP_ADC || op == OP_SBC || op == OP_CMP || op == OP_AND
+        || op == OP_ORA || op == OP_EOR;
+}
+
+static bool isPointerRead(Operation op)
+{
+    return op == OP_LDA || op == OP_LDX || op == OP_LDY || op == OP_ADC || op == OP_SBC || op == OP_CMP
+        || op == OP_CPX || op == OP_CPY || op == OP_AND || op == OP_ORA || op == OP_EOR || op == OP_BIT;
+}
+
+static bool isPointerWrite(Operation op)
+{
+    return op == OP_STA || op == OP_STX || op == OP_STY || op == OP_STZ || op == OP_INC || op == OP_DEC;
+}
+
+// Returns the pointer that p dereferences as (name),Y or (name) or NULL.
+static struct ZeroPageVariable *dereferenceOf(const struct Instruction *p)
+{
+    if (!isCode(p) || p->operand[0] != '(' || !hasAbsoluteForm(p->op)) {
+        return NULL;
+    }
+    struct ZeroPageVariable *var  = findZeroPageVariable(p->operand + 1);
+    const char              *rest = var ? p->operand + 1 + strlen(var->name) : "";
+    return strcmp(rest, "),Y") == 0 || strcmp(rest, ")") == 0 ? var : NULL;
+}
+
+// Returns the pointer that p names as name or name+1 and sets byte to which.
+static struct ZeroPageVariable *pointerByteOf(const struct Instruction *p, unsigned *byte)
+{
+    if (!isCode(p) || p->operand[0] == '(' || p->operand[0] == '#') {
+        return NULL;
+    }
+    struct ZeroPageVariable *var = findZeroPageVariable(p->operand);
+    if (!var) {
+        return NULL;
+    }
+    const char *rest = p->operand + strlen(var->name);
+    *byte            = skipOffset(&rest);
+    return rest[0] == '\0' && *byte < 2 ? var : NULL;
+}
+
+static void notePointerUses(struct PatchedPointer *patches)
+{
+    unsigned *depths = loopDepths();
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        if (p->assembly) {
+            for (unsigned i = 0; i < zeroPage.len; i++) {
+                if (isMentioned(p->assembly, zeroPage.items[i].name)) {
+                    patches[i].isEligible = false;
+                }
+            }
+            continue;
+        }
+        if (!isCode(p)) {
+            continue;
+        }
+
+        unsigned                 byte = 0;
+        struct ZeroPageVariable *var  = dereferenceOf(p);
+        if (var) {
+            struct PatchedPointer *patch = &patches[var - zeroPage.items];
+            if (patch->sites++ == 0 || depths[k] < patch->minSite) {
+                patch->minSite = depths[k];
+            }
+        } else if ((var = pointerByteOf(p, &byte)) && isPointerWrite(p->op)) {
+            struct PatchedPointer *patch = &patches[var - zeroPage.items];
+            if (patch->writes++ == 0 || depths[k] > patch->maxWrite) {
+                patch->maxWrite = depths[k];
+            }
+        } else if (var && isPointerRead(p->op)) {
+            patches[var - zeroPage.items].isRead = true;
+        } else {
+            // Anything else, like (ptr,X), #<ptr or ROL ptr, can't follow it.
+            var = findZeroPageVariable(p->operand + strspn(p->operand, "(#<>"));
+            if (var) {
+                patches[var - zeroPage.items].isEligible = false;
+            }
+        }
+    }
+    free(depths);
+
+    // Aliases and data that refer to it aren't followed.
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        for (unsigned i = 0; i < zeroPage.len && p->op == OP_EQU; i++) {
+            if (isMentioned(p->operand, zeroPage.items[i].name)) {
+                patches[i].isEligible = false;
+            }
+        }
+    }
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        for (unsigned i = 0; i < zeroPage.len && p->op && !isData(p); i++) {
+            if (isMentioned(p->operand, zeroPage.items[i].name)) {
+                patches[i].isEligible = false;
+            }
+        }
+    }
+}
+
+// Returns true if patching the dereferences saves more than mirroring the
+// stores costs. A store in the same loop as the only dereference breaks even
+// on cycles and still frees the zero page.
+static bool isWorthPatching(const struct PatchedPointer *patch)
+{
+    if (!patch->isEligible || patch->sites == 0 || patch->writes == 0) {
+        return false;
+    }
+    return patch->minSite > patch->maxWrite
+        || (patch->sites == 1 && !patch->isRead && patch->minSite == patch->maxWrite);
+}
+
+static void patchPointer(const struct ZeroPageVariable *var, struct PatchedPointer *patch)
+{
+    struct Instruction **sites = calloc(patch->sites, sizeof(*sites));
+    require(sites, "calloc failed");
+    unsigned count = 0;
+    for (unsigned k = 0; k < flow.len; k++) {
+        struct Instruction *p = flow.items[k];
+        if (!p->assembly && dereferenceOf(p) == var) {
+            bool isIndexed = strcmp(p->operand + 1 + strlen(var->name), "),Y") == 0;
+            labelOf(p);
+            strcpy(p->operand, isIndexed ? "$FFFF,Y" : "$FFFF");
+            sites[count++] = p;
+        }
+    }
+
+    // Without anything reading it, the first operand can hold the pointer.
+    struct Instruction *home = patch->isRead ? NULL : sites[0];
+    for (unsigned k = 0; k < flow.len; k++) {
+        struct Instruction *p    = flow.items[k];
+        unsigned            byte = 0;
+        if (p->assembly || pointerByteOf(p, &byte) != var) {
+            continue;
+        }
+        if (home) {
+            setOperand(p, stringf("%s+%u", home->label, byte + 1));
+        }
+        if (!isPointerWrite(p->op)) {
+            continue;
+        }
+        for (unsigned i = count; i-- > 0;) {
+            if (sites[i] != home) {
+                struct Instruction *mirror
+                    = Instruction(NULL, p->op, stringf("%s+%u", sites[i]->label, byte + 1), NULL, NULL);
+                mirror->next = p->next;
+                p->next      = mirror;
+                Tally("stores mirrored into code");
+            }
+        }
+    }
+    free(sites);
+    patch->isMoved = home != NULL;
+    Tally("pointers patched into code");
+}
+
+static void PatchPointers(void)
+{
+    if (!IsSelfModifying() || OptimizationGoal() == GOAL_SIZE) {
+        return;
+    }
+    findZeroPageVariables();
+    buildFlow();
+
+    struct PatchedPointer *patches = calloc(zeroPage.len + 1, sizeof(*patches));
+    require(patches, "calloc failed");
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        patches[i].isEligible = zeroPage.items[i].size == 2;
+    }
+    notePointerUses(patches);
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        if (isWorthPatching(&patches[i])) {
+            patchPointer(&zeroPage.items[i], &patches[i]);
+        }
+    }
+    freeFlow();
+
+    // The names are those of the HEX, so they go once nothing looks for them.
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        for (struct Instruction *prev = &dataHead; patches[i].isMoved && prev->next; prev = prev->next) {
+            if (prev->next == zeroPage.items[i].at) {
+                removeNextInstruction(prev);
+                break;
+            }
+        }
+    }
+    free(patches);
+
+    free(zeroPage.items);
+    zeroPage.items = NULL;
+    zeroPage.len   = 0;
+    for (data = &dataHead; data->next; data = data->next) {
+    }
+}
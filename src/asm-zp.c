@@ -0,0 +1,457 @@
+// Zero page allocation for variables without a location.
+//
+// Zero page accesses are a byte shorter and a cycle faster, and a pointer has
+// to be there to be dereferenced. Variables are ranked by how often the code
+// uses them, weighted by how deeply nested in loops the uses are, and the best
+// ones get the free bytes of the zero page that the program doesn't use itself.
+// Pointers are always placed; the other variables only when zpvars runs, which
+// it does right after.
+//
+// This file is included by asm.c after asm-flags.c.
+
+// Bytes that neither the Monitor nor DOS 3.3 use.
+static const char *const DEFAULT_ZERO_PAGE = "$06-$09,$19-$1F,$CE-$CF,$EB-$EF,$FA-$FD";
+
+static const unsigned MAX_LOOP_WEIGHT = 3; // uses count 8x per level up to this
+
+struct ZeroPageVariable {
+    struct Instruction *at; // its HEX in the data list or NULL once moved
+    const char         *name;
+    unsigned            size;
+    unsigned            weight;
+    bool                isPointer; // dereferenced with (name),Y
+    bool                isEligible;
+    bool                needsZero; // may be read before it's set
+    unsigned            address;
+};
+
+static struct {
+    bool                     isSet;
+    bool                     isFree[256];
+    struct Instruction      *last; // EQU of the last variable moved
+    unsigned                 len;
+    struct ZeroPageVariable *items;
+} zeroPage;
+
+void ZeroPage(const char *ranges)
+{
+    zeroPage.isSet = true;
+    memset(zeroPage.isFree, 0, sizeof zeroPage.isFree);
+    if (strcmp(ranges, "none") == 0) {
+        return;
+    }
+
+    for (const char *p = ranges; *p != '\0';) {
+        char         *end   = NULL;
+        unsigned long first = strtoul(p + (*p == '$'), &end, 16), last = first;
+        require(end != p + (*p == '$'), "invalid zero page range: %s", ranges);
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtoul(p + (*p == '$'), &end, 16);
+            require(end != p + (*p == '$'), "invalid zero page range: %s", ranges);
+        }
+        require(first <= last && last <= 0xFF, "invalid zero page range: %s", ranges);
+        for (unsigned long i = first; i <= last; i++) {
+            zeroPage.isFree[i] = true;
+        }
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else {
+            require(*p == '\0', "invalid zero page range: %s", ranges);
+        }
+    }
+}
+
+// Returns the zero page address in text if it starts with one or -1.
+static long zeroPageAddress(const char *text)
+{
+    if (*text != '$' || !isxdigit((unsigned char)text[1])) {
+        return -1;
+    }
+    unsigned long value = strtoul(text + 1, NULL, 16);
+    return value <= 0xFF ? (long)value : -1;
+}
+
+// Returns true unless the only uses of the constant are as immediate values.
+static bool isAddress(const char *name)
+{
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        const char *text = p->assembly ? p->assembly : p->op ? p->operand : "";
+        if (isMentioned(text, name) && (p->assembly || p->op == OP_EQU || text[0] != '#')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Takes the bytes that the program refers to by address out of the free map.
+// A byte that is used might be the first of a pointer, so the next one goes
+// too.
+static void reserveUsedZeroPage(void)
+{
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->assembly) {
+            for (const char *ch = strchr(p->assembly, '$'); ch; ch = strchr(ch + 1, '$')) {
+                long addr = ch > p->assembly && ch[-1] == '#' ? -1 : zeroPageAddress(ch);
+                if (addr >= 0) {
+                    zeroPage.isFree[addr] = false;
+                    zeroPage.isFree[(addr + 1) & 0xFF] = false;
+                }
+            }
+            continue;
+        }
+        if (!p->op) {
+            continue;
+        }
+        long addr = zeroPageAddress(p->operand + (p->operand[0] == '('));
+        if (addr >= 0 && (p->op != OP_EQU || isAddress(p->label))) {
+            zeroPage.isFree[addr] = false;
+            zeroPage.isFree[(addr + 1) & 0xFF] = false;
+        }
+    }
+}
+
+static void findZeroPageVariables(void)
+{
+    zeroPage.len   = 0;
+    zeroPage.items = NULL;
+    struct ZeroPageVariable *last = NULL;
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op != OP_HEX) {
+            last = NULL;
+            continue;
+        }
+        if (p->label[0] == '\0') {
+            if (last) {
+                last->size += (unsigned)strlen(p->operand) / 2;
+            }
+            continue;
+        }
+        zeroPage.items = realloc(zeroPage.items, (zeroPage.len + 1) * sizeof(*zeroPage.items));
+        require(zeroPage.items, "realloc failed");
+        last  = &zeroPage.items[zeroPage.len++];
+        *last = (struct ZeroPageVariable) {
+            .at         = p,
+            .name       = p->label,
+            .size       = (unsigned)strlen(p->operand) / 2,
+            .isEligible = true,
+        };
+    }
+}
+
+static struct ZeroPageVariable *findZeroPageVariable(const char *operand)
+{
+    size_t len = 0;
+    while (isLabelChar(operand[len])) {
+        len++;
+    }
+    for (unsigned i = 0; i < zeroPage.len && len > 0; i++) {
+        if (strncmp(zeroPage.items[i].name, operand, len) == 0 && zeroPage.items[i].name[len] == '\0') {
+            return &zeroPage.items[i];
+        }
+    }
+    return NULL;
+}
+
+// Skips the offset at the start of text, like +1 or +$01, and returns it.
+static unsigned skipOffset(const char **text)
+{
+    if ((*text)[0] != '+') {
+        return 0;
+    }
+    bool     isHex  = (*text)[1] == '$';
+    char    *end    = NULL;
+    unsigned offset = (unsigned)strtoul(*text + 1 + isHex, &end, isHex ? 16 : 10);
+    *text           = end;
+    return offset;
+}
+
+// Returns the variable that p mentions and sets offset to the byte it stores,
+// or -1 if it reads it.
+static struct ZeroPageVariable *accessOf(const struct Instruction *p, int *offset)
+{
+    const char *operand = p->operand;
+    *offset             = -1;
+    if (!isCode(p)) {
+        return NULL;
+    }
+    if (operand[0] == '(') {
+        struct ZeroPageVariable *var  = findZeroPageVariable(operand + 1);
+        const char              *rest = var ? operand + 1 + strlen(var->name) : "";
+        if (var && (strcmp(rest, "),Y") == 0 || strcmp(rest, ")") == 0)) {
+            var->isPointer = true;
+        } else if (var) {
+            var->isEligible = false;
+        }
+        return var;
+    }
+    if (operand[0] == '#') {
+        struct ZeroPageVariable *var = findZeroPageVariable(operand + 1 + (operand[1] == '<' || operand[1] == '>'));
+        if (var) {
+            var->isEligible = false;
+        }
+        return var;
+    }
+
+    struct ZeroPageVariable *var = findZeroPageVariable(operand);
+    if (!var) {
+        return NULL;
+    }
+    const char *rest    = operand + strlen(var->name);
+    bool        isStore = p->op == OP_STA || p->op == OP_STX || p->op == OP_STY || p->op == OP_STZ;
+    unsigned    byte    = skipOffset(&rest);
+    if (isStore && rest[0] == '\0' && byte < var->size) {
+        *offset = (int)byte;
+    }
+    return var;
+}
+
+// Returns the number of loops around each position in the code.
+static unsigned *loopDepths(void)
+{
+    int *starts = calloc(flow.len + 1, sizeof(*starts));
+    require(starts, "calloc failed");
+    for (unsigned k = 0; k < flow.len; k++) {
+        unsigned succ[2], count = successorsOf(k, succ);
+        for (unsigned i = 0; i < count; i++) {
+            if (succ[i] <= k) {
+                starts[succ[i]]++;
+                starts[k + 1]--;
+            }
+        }
+    }
+
+    unsigned *depths = calloc(flow.len + 1, sizeof(*depths));
+    require(depths, "calloc failed");
+    int depth = 0;
+    for (unsigned k = 0; k < flow.len; k++) {
+        depth += starts[k];
+        depths[k] = (unsigned)depth;
+    }
+    free(starts);
+    return depths;
+}
+
+// Returns true if control may enter k without going through a JSR or jump in
+// the code list.
+static bool isProgramEntry(unsigned k)
+{
+    const struct Instruction *p = flow.items[k];
+    if (k == 0 || p->assembly || flow.items[k - 1]->assembly) {
+        return true;
+    }
+    struct LabelInfo *info = p->label[0] != '\0' ? labelInfo(p->label) : NULL;
+    return info && info->refs > info->jumps;
+}
+
+// Returns true if every path from where the program starts stores each byte of
+// var before reading it, so it doesn't need the 0 it starts with.
+static bool isSetBeforeUse(const struct ZeroPageVariable *var)
+{
+    const uint8_t all = (uint8_t)((1u << var->size) - 1);
+
+    uint8_t *set = calloc(flow.len, sizeof(*set));
+    require(set, "calloc failed");
+    for (unsigned k = 0; k < flow.len; k++) {
+        set[k] = isProgramEntry(k) ? 0 : all;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned k = 0; k < flow.len; k++) {
+            const struct Instruction *p = flow.items[k];
+
+            int      offset = -1;
+            uint8_t  out    = set[k];
+            if (!p->assembly && accessOf(p, &offset) == var && offset >= 0) {
+                out |= (uint8_t)(1u << offset);
+            }
+
+            // Whatever the subroutine sets is set when it returns.
+            uint8_t outs[3] = { out, out, out };
+            long    callee  = p->op == OP_JSR ? positionOf(p->operand) : -1;
+            if (callee >= 0) {
+                uint8_t returned = all;
+                for (const long *r = returnsFrom((unsigned)callee); *r >= 0; r++) {
+                    returned &= set[*r];
+                }
+                outs[0] |= returned;
+            }
+
+            unsigned succ[3], count = successorsOf(k, succ);
+            if (callee >= 0) {
+                succ[count++] = (unsigned)callee;
+            }
+            for (unsigned i = 0; i < count; i++) {
+                if ((set[succ[i]] & outs[i]) != set[succ[i]]) {
+                    set[succ[i]] &= outs[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool result = true;
+    for (unsigned k = 0; k < flow.len && result; k++) {
+        const struct Instruction *p = flow.items[k];
+
+        int offset = -1;
+        if (!p->assembly && accessOf(p, &offset) == var && offset < 0) {
+            result = set[k] == all;
+        }
+    }
+    free(set);
+    return result;
+}
+
+// Sorts pointers first and then by the weight of each byte.
+static int byWeight(const void *a, const void *b)
+{
+    const struct ZeroPageVariable *x = a, *y = b;
+    if (x->isPointer != y->isPointer) {
+        return x->isPointer ? -1 : 1;
+    }
+    unsigned long lhs = (unsigned long)x->weight * y->size, rhs = (unsigned long)y->weight * x->size;
+    return lhs > rhs ? -1 : lhs < rhs ? 1 : 0;
+}
+
+static long findFreeZeroPage(unsigned size)
+{
+    for (unsigned addr = 0; addr + size <= 0x100; addr++) {
+        bool isFree = true;
+        for (unsigned i = 0; i < size; i++) {
+            isFree = isFree && zeroPage.isFree[addr + i];
+        }
+        if (isFree) {
+            return addr;
+        }
+    }
+    return -1;
+}
+
+static void moveToZeroPage(struct ZeroPageVariable *var)
+{
+    // Its EQU has to come before any use so the assembler knows it's in the
+    // zero page.
+    struct Instruction *equ = Instruction(var->name, OP_EQU, stringf("$%.2X", var->address), NULL, NULL);
+    equ->next               = zeroPage.last->next;
+    zeroPage.last->next     = equ;
+    zeroPage.last           = equ;
+    var->name               = equ->label;
+
+    for (struct Instruction *prev = &dataHead, *p = prev->next; p; prev = p, p = p->next) {
+        if (p != var->at) {
+            continue;
+        }
+        removeNextInstruction(prev);
+        while (prev->next && prev->next->op == OP_HEX && prev->next->label[0] == '\0') {
+            removeNextInstruction(prev);
+        }
+        break;
+    }
+    var->at = NULL;
+}
+
+// Moves the eligible variables that are pointers, or those that aren't, to the
+// free bytes in order of rank.
+static void placeVariables(bool isPointers)
+{
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        struct ZeroPageVariable *var = &zeroPage.items[i];
+        if (var->isPointer != isPointers || !var->isEligible || var->needsZero) {
+            continue;
+        }
+        long addr = findFreeZeroPage(var->size);
+        if (addr < 0) {
+            require(!var->isPointer, "no zero page left for pointer %s; give it a location", var->name);
+            continue;
+        }
+        for (unsigned j = 0; j < var->size; j++) {
+            zeroPage.isFree[(unsigned)addr + j] = false;
+        }
+        var->address = (unsigned)addr;
+        moveToZeroPage(var);
+    }
+
+    for (data = &dataHead; data->next; data = data->next) {
+    }
+}
+
+static void AllocateZeroPage(void)
+{
+    if (!zeroPage.isSet) {
+        ZeroPage(DEFAULT_ZERO_PAGE);
+    }
+    reserveUsedZeroPage();
+    findZeroPageVariables();
+    zeroPage.last = &codeHead;
+    buildFlow();
+
+    unsigned *depths = loopDepths();
+    for (unsigned k = 0; k < flow.len; k++) {
+        const struct Instruction *p = flow.items[k];
+        if (p->assembly) {
+            for (unsigned i = 0; i < zeroPage.len; i++) {
+                if (isMentioned(p->assembly, zeroPage.items[i].name)) {
+                    zeroPage.items[i].isEligible = false;
+                }
+            }
+            continue;
+        }
+        int                      offset = -1;
+        struct ZeroPageVariable *var    = accessOf(p, &offset);
+        if (var) {
+            var->weight += 1u << (3 * (depths[k] < MAX_LOOP_WEIGHT ? depths[k] : MAX_LOOP_WEIGHT));
+        }
+    }
+    free(depths);
+
+    // Aliases and data that refer to it aren't followed.
+    for (struct Instruction *p = codeHead.next; p; p = p->next) {
+        if (p->op == OP_EQU) {
+            for (unsigned i = 0; i < zeroPage.len; i++) {
+                if (isMentioned(p->operand, zeroPage.items[i].name)) {
+                    zeroPage.items[i].isEligible = false;
+                }
+            }
+        }
+    }
+    for (struct Instruction *p = dataHead.next; p; p = p->next) {
+        if (p->op && !isData(p)) {
+            for (unsigned i = 0; i < zeroPage.len; i++) {
+                if (isMentioned(p->operand, zeroPage.items[i].name)) {
+                    zeroPage.items[i].isEligible = false;
+                }
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        struct ZeroPageVariable *var = &zeroPage.items[i];
+        if (var->size > 2 || var->weight == 0) {
+            var->isEligible = false;
+        }
+        var->needsZero = var->isEligible && !var->isPointer && !isSetBeforeUse(var);
+    }
+    freeFlow();
+
+    if (zeroPage.len > 0) {
+        qsort(zeroPage.items, zeroPage.len, sizeof(*zeroPage.items), byWeight);
+    }
+    placeVariables(true);
+}
+
+// Places the ranked variables that aren't pointers.
+static void PlaceBusyVariables(void) { placeVariables(false); }
+
+static void writeZeroPageReport(FILE *fp)
+{
+    for (unsigned i = 0; i < zeroPage.len; i++) {
+        const struct ZeroPageVariable *var = &zeroPage.items[i];
+        if (!var->at) {
+            fprintf(fp, "%s: $%.2X\n", var->name, var->address);
+        }
+    }
+}
@@ -18,6 +18,8 @@ struct Instruction {
     char *assembly;
     char *comment;
 
+    bool isReserved; // by VAR, so it only has to start out as zeros
+
     struct Instruction *next;
 };
 
@@ -28,8 +30,13 @@ static Operation OP_ADC = "ADC",
                  OP_BCC = "BCC",
                  OP_BCS = "BCS",
                  OP_BEQ = "BEQ",
+                 OP_BIT = "BIT",
+                 OP_BMI = "BMI",
                  OP_BNE = "BNE",
+                 OP_BPL = "BPL",
+                 OP_BRA = "BRA",
                  OP_BVC = "BVC",
+                 OP_BVS = "BVS",
                  OP_CLC = "CLC",
                  OP_CLV = "CLV",
                  OP_CMP = "CMP",
@@ -38,6 +45,7 @@ static Operation OP_ADC = "ADC",
                  OP_DEC = "DEC",
                  OP_DEX = "DEX",
                  OP_DEY = "DEY",
+                 OP_DS  = "DS",
                  OP_EOR = "EOR",
                  OP_EQU = "EQU",
                  OP_INC = "INC",
@@ -49,18 +57,28 @@ static Operation OP_ADC = "ADC",
                  OP_LDA = "LDA",
                  OP_LDX = "LDX",
                  OP_LDY = "LDY",
+                 OP_LSR = "LSR",
                  OP_NOP = "NOP",
                  OP_ORA = "ORA",
                  OP_PHA = "PHA",
+                 OP_PHX = "PHX",
+                 OP_PHY = "PHY",
                  OP_PLA = "PLA",
+                 OP_PLX = "PLX",
+                 OP_PLY = "PLY",
+                 OP_ROL = "ROL",
+                 OP_ROR = "ROR",
                  OP_RTS = "RTS",
                  OP_SBC = "SBC",
                  OP_SEC = "SEC",
                  OP_STA = "STA",
                  OP_STX = "STX",
                  OP_STY = "STY",
+                 OP_STZ = "STZ",
                  OP_TAX = "TAX",
                  OP_TAY = "TAY",
+                 OP_TRB = "TRB",
+                 OP_TSB = "TSB",
                  OP_TXA = "TXA",
                  OP_TYA = "TYA";
 
@@ -119,8 +137,39 @@ static void removeNextInstruction(struct Instruction *instruction)
     struct Instruction *removed = instruction->next;
     instruction->next           = removed->next;
     freeInstruction(removed);
+    free(removed);
+}
+
+// Replaces the operand of instruction with operand, which is freed.
+static void setOperand(struct Instruction *instruction, char *operand)
+{
+    require(strlen(operand) < sizeof instruction->operand, "operand is too long: %s", operand);
+    strcpy(instruction->operand, operand);
+    free(operand);
+}
+
+// Associates the remaining unusedLabel with a NOP so that it stays with the code
+// before it rather than going to whatever is added next.
+static void endLabel(void)
+{
+    if (unusedLabel[0] != '\0') {
+        code = code->next = Instruction(unusedLabel, OP_NOP, NULL, NULL, NULL);
+        unusedLabel[0] = '\0';
+    }
 }
 
+#include "asm-cfg.c"
+#include "asm-reg.c"
+#include "asm-inline.c"
+#include "asm-licm.c"
+#include "asm-flags.c"
+#include "asm-zp.c"
+#include "asm-smc.c"
+#include "asm-overlay.c"
+#include "asm-math.c"
+#include "asm-layout.c"
+#include "asm-cycles.c"
+
 static void addCode(const char *label, const char *op, char *operand)
 {
     if (unusedLabel[0] == '\0') {
@@ -136,7 +185,7 @@ static void addCode(const char *label, const char *op, char *operand)
 
 void ADC(char *operand) { addCode(NULL, OP_ADC, operand); }
 void AND(char *operand) { addCode(NULL, OP_AND, operand); }
-void ASL(void) { addCode(NULL, OP_ASL, NULL); }
+void ASL(char *operand) { addCode(NULL, OP_ASL, operand); }
 
 void ASM(char *assembly)
 {
@@ -149,7 +198,10 @@ void ASM(char *assembly)
 void BCC(char *operand) { addCode(NULL, OP_BCC, operand); }
 void BCS(char *operand) { addCode(NULL, OP_BCS, operand); }
 void BEQ(char *operand) { addCode(NULL, OP_BEQ, operand); }
+void BIT(char *operand) { addCode(NULL, OP_BIT, operand); }
 void BNE(char *operand) { addCode(NULL, OP_BNE, operand); }
+void BPL(char *operand) { addCode(NULL, OP_BPL, operand); }
+void BRA(char *operand) { addCode(NULL, OP_BRA, operand); }
 void BVC(char *operand) { addCode(NULL, OP_BVC, operand); }
 void CLC(void) { addCode(NULL, OP_CLC, NULL); }
 void CLV(void) { addCode(NULL, OP_CLV, NULL); }
@@ -166,6 +218,22 @@ void EQU(const char *name, char *operand)
     code = code->next = Instruction(name, OP_EQU, operand, NULL, NULL);
 }
 
+void HEX(const char *name, const uint8_t *bytes, uint16_t size)
+{
+    static const unsigned maxPerLine = 16;
+    require(size > 0, "Data %s cannot have size 0", name);
+    for (unsigned at = 0; at < size; at += maxPerLine) {
+        unsigned count = size - at < maxPerLine ? size - at : maxPerLine;
+        char    *hex   = calloc(2 * count + 1, sizeof(*hex));
+        require(hex, "calloc failed");
+        for (unsigned i = 0; i < count; i++) {
+            snprintf(&hex[2 * i], 3, "%02X", bytes[at + i]);
+        }
+        data = data->next = Instruction(name, OP_HEX, hex, NULL, NULL);
+        name              = NULL;
+    }
+}
+
 void INC(char *operand) { addCode(NULL, OP_INC, operand); }
 void INX(void) { addCode(NULL, OP_INX, NULL); }
 void INY(void) { addCode(NULL, OP_INY, NULL); }
@@ -184,16 +252,63 @@ void Label(const char *label)
 void LDA(char *operand) { addCode(NULL, OP_LDA, operand); }
 void LDX(char *operand) { addCode(NULL, OP_LDX, operand); }
 void LDY(char *operand) { addCode(NULL, OP_LDY, operand); }
+void LSR(char *operand) { addCode(NULL, OP_LSR, operand); }
 
-void Optimize(void)
+static enum Goal goal = GOAL_BALANCED;
+
+void      OptimizeFor(enum Goal newGoal) { goal = newGoal; }
+enum Goal OptimizationGoal(void) { return goal; }
+
+static enum Cpu cpu = CPU_6502;
+
+void     GenerateFor(enum Cpu target) { cpu = target; }
+enum Cpu TargetCpu(void) { return cpu; }
+
+static enum Storage storage = STORAGE_IN_IMAGE;
+
+void         StoreVariables(enum Storage where) { storage = where; }
+enum Storage VariableStorage(void) { return storage; }
+
+static bool isSelfModifying = false;
+
+void SelfModify(bool allowed) { isSelfModifying = allowed; }
+bool IsSelfModifying(void) { return isSelfModifying; }
+
+struct Stat {
+    const char *what;
+    unsigned    count;
+};
+
+static struct {
+    unsigned     len;
+    struct Stat *items;
+} stats;
+
+void Tally(const char *what) { TallyBy(what, 1); }
+
+void TallyBy(const char *what, unsigned count)
 {
-    // Associates the remaining unusedLabel with a NOP. This is not really an
-    // optimization; rather, it's required for proper execution of the code.
-    if (unusedLabel[0] != '\0') {
-        code = code->next = Instruction(unusedLabel, OP_NOP, NULL, NULL, NULL);
-        unusedLabel[0] = '\0';
+    for (unsigned i = 0; i < stats.len; i++) {
+        if (strcmp(stats.items[i].what, what) == 0) {
+            stats.items[i].count += count;
+            return;
+        }
+    }
+    stats.items = realloc(stats.items, (stats.len + 1) * sizeof(*stats.items));
+    require(stats.items, "realloc failed");
+    stats.items[stats.len++] = (struct Stat) { .what = what, .count = count };
+}
+
+void WriteStats(FILE *fp)
+{
+    for (unsigned i = 0; i < stats.len; i++) {
+        fprintf(fp, "%6u %s\n", stats.items[i].count, stats.items[i].what);
     }
+}
 
+// JSR + RTS => JMP, and RTS + RTS => RTS.
+static void CombineReturns(void)
+{
     struct Instruction *pred = NULL, *curr = NULL, *succ = NULL;
 
     curr = codeHead.next;
@@ -245,18 +360,121 @@ next:
     }
 }
 
+// The passes of the optimizer, in the order they run, and the choices made as
+// the code is generated, which have no run. Those required for the program to
+// work can't be turned off.
+struct Pass {
+    const char *name;
+    void (*run)(void);
+    bool isRequired;
+    bool isDisabled;
+    bool isPrinted; // after it runs
+};
+
+static struct Pass passes[] = {
+    { .name = "constants" },
+    { .name = "counted" },
+    { .name = "rotate" },
+    { .name = "unroll" },
+    { .name = "steps" },
+    { .name = "switch" },
+    { .name = "inline", .run = InlineSubroutines },
+    { .name = "peephole", .run = CombineReturns },
+    { .name = "cfg", .run = OptimizeControlFlow },
+    { .name = "regalloc", .run = AllocateRegisters },
+    { .name = "cfg2", .run = OptimizeControlFlow },
+    { .name = "licm", .run = HoistInvariants },
+    { .name = "flags", .run = OptimizeFlags },
+    { .name = "smc", .run = PatchPointers },
+    { .name = "zp", .run = AllocateZeroPage, .isRequired = true },
+    { .name = "zpvars", .run = PlaceBusyVariables },
+    { .name = "overlay", .run = OverlayVariables },
+    { .name = "branches", .run = FinishControlFlow, .isRequired = true },
+    { .name = "pool", .run = PoolText },
+    { .name = "layout", .run = LayOutData, .isRequired = true },
+};
+
+bool DisablePass(const char *name)
+{
+    bool isFound = false;
+    for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+        if (strcmp(passes[i].name, name) == 0 && !passes[i].isRequired) {
+            passes[i].isDisabled = true;
+            isFound              = true;
+        }
+    }
+    return isFound;
+}
+
+void DisableOptimizations(void)
+{
+    for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+        passes[i].isDisabled = !passes[i].isRequired;
+    }
+}
+
+bool IsPassEnabled(const char *name)
+{
+    for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+        if (strcmp(passes[i].name, name) == 0) {
+            return !passes[i].isDisabled;
+        }
+    }
+    fatalf("%s: unknown pass %s", __func__, name);
+}
+
+bool PrintAfter(const char *name)
+{
+    bool isFound = false;
+    for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+        if (strcmp(passes[i].name, name) == 0 && passes[i].run) {
+            passes[i].isPrinted = true;
+            isFound             = true;
+        }
+    }
+    return isFound;
+}
+
+void Optimize(void)
+{
+    // This is not really an optimization; rather, it's required for proper
+    // execution of the code.
+    endLabel();
+
+    for (size_t i = 0; i < sizeof passes / sizeof passes[0]; i++) {
+        const struct Pass *pass = &passes[i];
+        if (!pass->run || pass->isDisabled) {
+            continue;
+        }
+        pass->run();
+        if (pass->isPrinted) {
+            fprintf(stderr, "* After %s\n", pass->name);
+            WriteInstructions(stderr);
+        }
+    }
+}
+
 void ORA(char *operand) { addCode(NULL, OP_ORA, operand); }
 void PHA(void) { addCode(NULL, OP_PHA, NULL); }
+void PHX(void) { addCode(NULL, OP_PHX, NULL); }
+void PHY(void) { addCode(NULL, OP_PHY, NULL); }
 void PLA(void) { addCode(NULL, OP_PLA, NULL); }
+void PLX(void) { addCode(NULL, OP_PLX, NULL); }
+void PLY(void) { addCode(NULL, OP_PLY, NULL); }
 void REM(char *comment) { code = code->next = Instruction(NULL, NULL, NULL, NULL, comment); }
+void ROL(char *operand) { addCode(NULL, OP_ROL, operand); }
+void ROR(char *operand) { addCode(NULL, OP_ROR, operand); }
 void RTS(void) { addCode(NULL, OP_RTS, NULL); }
 void SBC(char *operand) { addCode(NULL, OP_SBC, operand); }
 void SEC(void) { addCode(NULL, OP_SEC, NULL); }
 void STA(char *operand) { addCode(NULL, OP_STA, operand); }
 void STX(char *operand) { addCode(NULL, OP_STX, operand); }
 void STY(char *operand) { addCode(NULL, OP_STY, operand); }
+void STZ(char *operand) { addCode(NULL, OP_STZ, operand); }
 void TAX(void) { addCode(NULL, OP_TAX, NULL); }
 void TAY(void) { addCode(NULL, OP_TAY, NULL); }
+void TRB(char *operand) { addCode(NULL, OP_TRB, operand); }
+void TSB(char *operand) { addCode(NULL, OP_TSB, operand); }
 void TXA(void) { addCode(NULL, OP_TXA, NULL); }
 void TYA(void) { addCode(NULL, OP_TYA, NULL); }
 
@@ -282,10 +500,12 @@ void VAR(const char *name, uint16_t size)
     unsigned zeros = size * 2;
     while (zeros > maxPerLine) {
         data = data->next = Instruction(name, OP_HEX, stringf("%.*x", maxPerLine, 0), NULL, NULL);
+        data->isReserved  = true;
         name              = NULL;
         zeros -= maxPerLine;
     }
     data = data->next = Instruction(name, OP_HEX, stringf("%.*x", zeros, 0), NULL, NULL);
+    data->isReserved  = true;
 }
 
 static void WriteInstruction(FILE *fp, struct Instruction *p)
@@ -310,6 +530,10 @@ static void WriteInstruction(FILE *fp, struct Instruction *p)
 
 void WriteInstructions(FILE *fp)
 {
+    // Merlin only takes the 65C02 instructions after XC.
+    if (cpu == CPU_65C02) {
+        fputs("\tXC\n", fp);
+    }
     for (struct Instruction *p = codeHead.next; p; p = p->next) {
         WriteInstruction(fp, p);
     }
@@ -4,7 +4,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
-// 6502 mneumonics
+// 6502 mneumonics, and the ones that only a 65C02 has: BRA, BIT #imm, PHX, PHY,
+// PLX, PLY, STZ, TRB, TSB and the INC A, DEC A and (zp) modes
 void JMP(char *location);
 void JSR(char *name);
 void RTS(void);
@@ -12,9 +13,11 @@ void RTS(void);
 typedef void (*Branch)(char *);
 void BEQ(char *label);
 void BNE(char *label);
+void BPL(char *label);
 void BCC(char *label);
 void BCS(char *label);
 void BVC(char *label);
+void BRA(char *label);
 
 typedef void (*Compare)(char *);
 void CMP(char *operand);
@@ -27,11 +30,17 @@ void CLC(void);
 void CLV(void);
 void SEC(void);
 
+void BIT(char *operand);
+
 void AND(char *operand);
 void ORA(char *operand);
 void EOR(char *operand);
 
-void ASL(void);
+// The shifts and rotates change A when the operand is NULL.
+void ASL(char *operand);
+void LSR(char *operand);
+void ROL(char *operand);
+void ROR(char *operand);
 
 void INC(char *operand);
 void INX(void);
@@ -43,6 +52,10 @@ void DEY(void);
 
 void PHA(void);
 void PLA(void);
+void PHX(void);
+void PLX(void);
+void PHY(void);
+void PLY(void);
 
 typedef void (*Load)(char *);
 void LDA(char *operand);
@@ -53,6 +66,10 @@ typedef void (*Store)(char *);
 void STA(char *operand);
 void STX(char *operand);
 void STY(char *operand);
+void STZ(char *operand);
+
+void TRB(char *operand);
+void TSB(char *operand);
 
 void TAX(void);
 void TAY(void);
@@ -67,18 +84,99 @@ void TXT(const char *name, const char *ascii);
 void VAR(const char *name, uint16_t size);
 
 void EQU(const char *name, char *operand);
+void HEX(const char *name, const uint8_t *bytes, uint16_t size);
+
+// Keeps the data named by a TXT, VAR or HEX within one page, so that indexing
+// it never takes the extra cycle of crossing into the next, or starts it on a
+// page if isAligned.
+void PAGE(const char *name, bool isAligned);
 
 // Add a label.
 void Label(const char *label);
 // Returns a copy of the label that was last added only if it doesn't have instructions.
 char *UnusedLabel(void);
 
+// Hints for the register allocator
+// Marks a byte variable that only the subroutine defining it uses.
+void LocalByte(const char *name);
+// Records the only registers that the subroutine reads its inputs from.
+void TakesIn(const char *subroutine, const char *registers);
+// Records that some subroutine returns a value in the registers named.
+void ReturnsIn(const char *registers);
+
+// Hints for the inliner
+// Marks a subroutine to be inlined at every call that it can be.
+void AlwaysInline(const char *subroutine);
+// Marks a subroutine that must keep being called.
+void NeverInline(const char *subroutine);
+
+// Sets the bytes of the zero page that variables without a location may use,
+// like "$06-$09,$EB-$EF", or "none".
+void ZeroPage(const char *ranges);
+
+// What the optimizer favors when bytes and cycles trade off.
+enum Goal {
+    GOAL_BALANCED,
+    GOAL_SIZE,
+    GOAL_SPEED,
+};
+void      OptimizeFor(enum Goal goal);
+enum Goal OptimizationGoal(void);
+
+// The optimizer runs passes by name, like "inline" or "cfg", and the code is
+// generated with choices by name, like "unroll" and "switch". Any of them that
+// the program works without can be turned off.
+bool DisablePass(const char *name);
+void DisableOptimizations(void);
+bool IsPassEnabled(const char *name);
+// Writes the instructions out to stderr each time the pass name runs.
+bool PrintAfter(const char *name);
+
+// The processor that the code runs on. The 65C02 of the enhanced Apple IIe and
+// the IIc adds BRA, STZ, INC A, PHX, (zp) and a few more.
+enum Cpu {
+    CPU_6502,
+    CPU_65C02,
+};
+void     GenerateFor(enum Cpu cpu);
+enum Cpu TargetCpu(void);
+
+// Where VAR puts the variables. In the image, they're zeros that the program
+// loads with; reserved, they follow the image without taking any of it, and
+// are cleared when the program starts or left with whatever memory held.
+enum Storage {
+    STORAGE_IN_IMAGE,
+    STORAGE_CLEARED,
+    STORAGE_RESERVED,
+};
+void         StoreVariables(enum Storage where);
+enum Storage VariableStorage(void);
+
+// Whether the code may patch its own operands, like those of a loop that reads
+// through a pointer. Code in ROM can't.
+void SelfModify(bool allowed);
+bool IsSelfModifying(void);
+
 // Run the Asembly-level optimizer
 void Optimize(void);
 
+// Counts one more of something an optimization did, like "loops unrolled fully".
+void Tally(const char *what);
+// Counts count more of something, like "bytes of text saved by sharing".
+void TallyBy(const char *what, unsigned count);
+// Write how many of each thing the optimizations did out to fp.
+void WriteStats(FILE *fp);
+
+// Write where each LocalByte ended up and why out to fp.
+void WriteRegisterReport(FILE *fp);
+
 // Write all the instructions out to fp.
 void WriteInstructions(FILE *fp);
 
+// Write all the instructions out to fp with the bytes and cycles each takes,
+// and the fewest and most cycles each subroutine takes.
+void WriteCycles(FILE *fp);
+
 // Constructors for the various types of Operands.
 struct Operand;
 
@@ -97,6 +195,10 @@ void FreeOperand(struct Operand *operand);
 
 // dst := src
 void COPY(const struct Operand *dst, const struct Operand *src);
+// dst := src for the size bytes of an array or group
+void COPYBLOCK(const char *dst, const char *src, uint16_t size);
+// Sets each item of width bytes in the size bytes at dst to value.
+void FILL(const char *dst, uint16_t size, uint16_t value, uint8_t width);
 // dst += src
 void PLUS(const struct Operand *dst, const struct Operand *src);
 // dst -= src
@@ -109,6 +211,24 @@ void OR(const struct Operand *dst, const struct Operand *src);
 void XOR(const struct Operand *dst, const struct Operand *src);
 // dst != src
 void NOT(const struct Operand *dst, const struct Operand *src);
+// dst *= src
+void TIMES(const struct Operand *dst, const struct Operand *src);
+// dst /= src, where dividing by 0 gives all ones
+void DIVIDE(const struct Operand *dst, const struct Operand *src);
+// dst %= src, where dividing by 0 leaves dst
+void MODULO(const struct Operand *dst, const struct Operand *src);
+// dst <<= src
+void SHIFTL(const struct Operand *dst, const struct Operand *src);
+// dst >>= src
+void SHIFTR(const struct Operand *dst, const struct Operand *src);
+// dst <<<= src, where the bits shifted out come back in at the bottom
+void ROTL(const struct Operand *dst, const struct Operand *src);
+// dst >>>= src, where the bits shifted out come back in at the top
+void ROTR(const struct Operand *dst, const struct Operand *src);
+
+// Appends the runtime routines that the code calls, like the multiply that
+// TIMES uses for variables.
+void LinkRuntime(void);
 
 typedef void (*COND)(const struct Operand *, const struct Operand *, const char *, const char *);
 // left == right
@@ -126,5 +246,17 @@ void IFGT(const struct Operand *left, const struct Operand *right, const char *t
 // true
 void IFTT(const struct Operand *left, const struct Operand *right, const char *then, const char *done);
 
+// A byte that a SWITCH goes somewhere for. The operand is the immediate that
+// names it, like #ESCAPE.
+struct Case {
+    uint8_t         key;
+    struct Operand *operand;
+    char           *label;
+};
+// Goes to the label of the case that value is, or to done, by a chain or a tree
+// of compares or a jump table, whichever the goal favors. The keys must differ.
+// Only a table changes X, and only if mayUseX and value isn't in a register.
+void SWITCH(const struct Operand *value, const struct Case cases[], unsigned count, const char *done, bool mayUseX);
+
 // pointer := src
 void ADDR(const char *pointer, const struct Operand *src);
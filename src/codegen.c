@@ -29,6 +29,9 @@ struct Scope *Scope(const struct String *subr, const char *loop, const char *don
 static struct Scope  global;
 static struct Scope *scope = &global;
 
+// The statements of the subroutine being generated
+static const struct Block *subroutineBody;
+
 static inline void enterLoop(const char *loop, const char *done) { scope = Scope(NULL, loop, done, scope); }
 static inline void enterSubroutine(const struct String *subr) { scope = Scope(subr, NULL, NULL, scope); }
 
@@ -65,6 +68,352 @@ static inline struct Symbol *getsym(const struct String *name)
     return LookupScoped(subroutineName(), name);
 }
 
+// Like getsym, but returns NULL for names that are not (yet) declared.
+static struct Symbol *trygetsym(const struct String *name)
+{
+    struct Symbol *sym = NULL;
+    char          *key = NULL;
+    if (subroutineName()) {
+        key = qualify(subroutineName(), name);
+        sym = TryLookup(key);
+        free(key);
+    }
+    if (!sym) {
+        key = string(name);
+        sym = TryLookup(key);
+        free(key);
+    }
+    return sym;
+}
+
+// Constant propagation
+//
+// While generating straight-line code, the values of variables assigned from
+// compile-time constants are remembered so that later arithmetic and
+// comparisons on them can be folded. Only variables stored in memory the
+// compiler allocated are tracked. Anything that could write memory behind the
+// compiler's back (calls, inline assembly, stores through pointers or to fixed
+// locations) forgets everything.
+
+struct Constants {
+    unsigned len;
+    struct {
+        const struct Symbol *sym;
+        uint16_t             value;
+    } items[64];
+};
+
+static struct Constants constants;
+
+static inline void forgetAll(void) { constants.len = 0; }
+
+static void forget(const struct Symbol *sym)
+{
+    for (unsigned i = 0; i < constants.len; i++) {
+        if (constants.items[i].sym == sym) {
+            constants.items[i] = constants.items[--constants.len];
+            return;
+        }
+    }
+}
+
+static void remember(const struct Symbol *sym, uint16_t value)
+{
+    forget(sym);
+    if (constants.len == sizeof constants.items / sizeof *constants.items || !IsPassEnabled("constants")) {
+        return;
+    }
+    constants.items[constants.len].sym   = sym;
+    constants.items[constants.len].value = GetSize(sym) == 1 ? (uint8_t)value : value;
+    constants.len++;
+}
+
+static bool recall(const struct Symbol *sym, uint16_t *outValue)
+{
+    for (unsigned i = 0; i < constants.len; i++) {
+        if (constants.items[i].sym == sym) {
+            *outValue = constants.items[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Keeps only the constants that are the same in both states.
+static void intersect(const struct Constants *other)
+{
+    for (unsigned i = 0; i < constants.len;) {
+        bool same = false;
+        for (unsigned j = 0; j < other->len; j++) {
+            if (other->items[j].sym == constants.items[i].sym) {
+                same = other->items[j].value == constants.items[i].value;
+                break;
+            }
+        }
+        if (same) {
+            i++;
+        } else {
+            constants.items[i] = constants.items[--constants.len];
+        }
+    }
+}
+
+// Returns true if sym is a scalar variable whose value can be tracked.
+static bool isTrackable(const struct Symbol *sym)
+{
+    if (!sym || !IsVariable(sym) || HasLocation(sym)) {
+        return false;
+    }
+    if (IsPointer(sym) || IsGroup(sym) || GetItemCount(sym) >= 0) {
+        return false;
+    }
+    uint16_t size = GetSize(sym);
+    return size == 1 || size == 2;
+}
+
+// Returns true and sets outValue if value is known at compile time.
+static bool valueOf(const struct Value *value, uint16_t *outValue)
+{
+    switch (value->type) {
+    case VAL_NUMBER:
+        *outValue = (uint16_t)value->Number;
+        return true;
+    case VAL_CHAR:
+        *outValue = (uint8_t)value->Char | 0x80;
+        return true;
+    case VAL_IDENT: {
+        if (value->IdentPhrase.subscript || value->IdentPhrase.field) {
+            return false;
+        }
+        const struct Symbol *sym = trygetsym(&value->IdentPhrase.identifier.String);
+        if (TryGetValue(sym, outValue)) {
+            return true;
+        }
+        return isTrackable(sym) && recall(sym, outValue);
+    }
+    default:
+        return false;
+    }
+}
+
+// Updates what is known after lhs is stored to. Pass NULL if the stored value
+// isn't known at compile time.
+static void assigned(const struct IdentPhrase *lhs, const uint16_t *value)
+{
+    const struct Symbol *sym = trygetsym(&lhs->identifier.String);
+    if (!sym || GetRegister(sym) != REG_NONE) {
+        return;
+    }
+    if (!lhs->subscript && !lhs->field && isTrackable(sym)) {
+        if (value) {
+            remember(sym, *value);
+        } else {
+            forget(sym);
+        }
+        return;
+    }
+    if (!HasLocation(sym) && !IsPointer(sym)) {
+        // Element or member of compiler-allocated storage
+        return;
+    }
+    forgetAll();
+}
+
+// Forgets every constant that stmt could change. This is used where control
+// flow merges, like the top of a loop.
+static void forgetStatement(const struct Statement *stmt)
+{
+    switch (stmt->type) {
+    case STMT_ASSIGN:
+        if (stmt->Assignment.value.type == VAL_CALL) {
+            forgetAll();
+        } else {
+            assigned(&stmt->Assignment.ident, NULL);
+        }
+        return;
+    case STMT_COND:
+    case STMT_LOOP:
+        for (unsigned i = 0; i < stmt->Conditional.then.len; i++) {
+            forgetStatement(&stmt->Conditional.then.statements[i]);
+        }
+        return;
+    case STMT_CALL:
+    case STMT_ASSEMBLY:
+        forgetAll();
+        return;
+    case STMT_DECLARATION:
+    case STMT_VARIABLE:
+    case STMT_DEFINITION:
+    case STMT_RETURN:
+    case STMT_STOP:
+    case STMT_REPEAT:
+    case STMT_UNKNOWN:
+        return;
+    }
+}
+
+static void forgetBlock(const struct Block *block)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        forgetStatement(&block->statements[i]);
+    }
+}
+
+// Returns true if control can reach the end of block.
+static bool fallsThrough(const struct Block *block)
+{
+    if (block->len == 0) {
+        return true;
+    }
+    switch (block->statements[block->len - 1].type) {
+    case STMT_RETURN:
+    case STMT_STOP:
+    case STMT_REPEAT:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Returns true if block declares or defines names that later code may use.
+static bool hasDeclarations(const struct Block *block)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        switch (stmt->type) {
+        case STMT_DECLARATION:
+        case STMT_VARIABLE:
+        case STMT_DEFINITION:
+            return true;
+        case STMT_COND:
+        case STMT_LOOP:
+            if (hasDeclarations(&stmt->Conditional.then)) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+static bool compareConstants(enum Compare compare, uint16_t left, uint16_t right)
+{
+    switch (compare) {
+    case COMP_EQUAL:
+        return left == right;
+    case COMP_NOTEQUAL:
+        return left != right;
+    case COMP_LESS:
+        return left < right;
+    case COMP_LESSEQUAL:
+        return left <= right;
+    case COMP_GREATER:
+        return left > right;
+    case COMP_GREATEREQUAL:
+        return left >= right;
+    case COMP_ALWAYS:
+        return true;
+    }
+    fatalf("%s: unhandled comparison: %d", __func__, compare);
+}
+
+// Returns true if the outcome of the condition is known at compile time and
+// sets isTrue to it. Values are unsigned, so nothing is less than zero; that is
+// folded even without the constants pass since the branches can't test it.
+static bool knownOutcome(const struct Conditional *cond, bool *isTrue)
+{
+    uint16_t     lval, rval;
+    bool         isLeftKnown  = valueOf(&cond->left, &lval),
+                 isRightKnown = valueOf(&cond->right, &rval);
+    enum Compare compare      = cond->compare;
+    if (isLeftKnown && isRightKnown && IsPassEnabled("constants")) {
+        *isTrue = compareConstants(compare, lval, rval);
+        return true;
+    }
+    if (isRightKnown && rval == 0 && (compare == COMP_GREATEREQUAL || compare == COMP_LESS)) {
+        *isTrue = compare == COMP_GREATEREQUAL;
+        return true;
+    }
+    if (isLeftKnown && lval == 0 && (compare == COMP_LESSEQUAL || compare == COMP_GREATER)) {
+        *isTrue = compare == COMP_LESSEQUAL;
+        return true;
+    }
+    return false;
+}
+
+// Returns the operator of an assignment without its '='.
+static const char *operatorOf(char kind)
+{
+    switch (kind) {
+    case '<':
+        return "<<";
+    case '>':
+        return ">>";
+    case '{':
+        return "<<<";
+    case '}':
+        return ">>>";
+    }
+    static char op[2];
+    op[0] = kind;
+    return op;
+}
+
+// Returns left changed by right, where left is size bytes.
+static uint16_t foldArithmetic(char kind, uint16_t left, uint16_t right, uint16_t size)
+{
+    unsigned bits = 8u * size;
+    switch (kind) {
+    case '+':
+        return (uint16_t)(left + right);
+    case '-':
+        return (uint16_t)(left - right);
+    case '&':
+        return left & right;
+    case '|':
+        return left | right;
+    case '^':
+        return left ^ right;
+    case '!':
+        return (uint16_t)~right;
+    case '*':
+        return (uint16_t)(left * right);
+    case '/':
+        // Like the routine, dividing by zero gives all ones.
+        return right ? left / right : (uint16_t)(size == 1 ? 0xFF : 0xFFFF);
+    case '%':
+        return right ? left % right : left;
+    case '<':
+        return (uint16_t)(right < 16 ? left << right : 0);
+    case '>':
+        return (uint16_t)(right < 16 ? left >> right : 0);
+    case '{':
+        right = (uint16_t)(right % bits);
+        return (uint16_t)(left << right | left >> (bits - right) % bits);
+    case '}':
+        right = (uint16_t)(right % bits);
+        return (uint16_t)(left >> right | left << (bits - right) % bits);
+    }
+    fatalf("%s: unexpected kind: %s=", __func__, operatorOf(kind));
+}
+
+// Returns the size in bytes of a value with a known compile-time value.
+static uint16_t sizeOf(const struct Value *value, uint16_t known)
+{
+    if (value->type == VAL_IDENT) {
+        return GetSize(trygetsym(&value->IdentPhrase.identifier.String));
+    }
+    return known > 0xFF ? 2 : 1;
+}
+
+// Returns the operand for a constant that will be stored into sym.
+static struct Operand *constantFor(const struct Symbol *sym, uint16_t value)
+{
+    return OpImmediateNumber(GetSize(sym) == 1 ? (uint8_t)value : value);
+}
+
 // Converts an IdentPhrase to an Operand.
 static struct Operand *reduce(const struct IdentPhrase *id)
 {
@@ -114,6 +463,10 @@ static struct Operand *reduce(const struct IdentPhrase *id)
             if (IsLiteral(indexsym)) {
                 return OpOffset(GetName(identsym), hex4(GetNumber(indexsym)), false, size);
             }
+            uint16_t known;
+            if (isTrackable(indexsym) && recall(indexsym, &known)) {
+                return OpOffset(GetName(identsym), hex4(known), false, size);
+            }
             return OpOffset(GetName(identsym), strcopy(GetName(indexsym)), IsVariable(indexsym), size);
             // fallthrough
         case NUM_NUMBER:
@@ -167,6 +520,20 @@ static struct Operand *reduceSimpleValue(const struct Value *value)
     fatalf("%s: unhandled value type: %d", __func__, value->type);
 }
 
+// Like reduceSimpleValue, but uses an immediate for variables whose value is
+// known at compile time.
+static struct Operand *reduceKnownValue(const struct Value *value)
+{
+    uint16_t known;
+    if (value->type == VAL_IDENT && valueOf(value, &known)) {
+        const struct Symbol *sym = getsym(&value->IdentPhrase.identifier.String);
+        if (IsVariable(sym)) {
+            return constantFor(sym, known);
+        }
+    }
+    return reduceSimpleValue(value);
+}
+
 // Convenience function to call generateSet using a String (param).
 static void setArgument(const char *param, const struct Value *arg)
 {
@@ -178,8 +545,15 @@ static void setArgument(const char *param, const struct Value *arg)
     generateSet(&phrase, arg);
 }
 
+// Requires that the name of a table kept in a page is that of a var or let.
+static void requireAnywhere(enum Placement placement, const struct String *name)
+{
+    require(placement == PLACE_ANYWHERE, "only var and let tables can be kept in a page: %.*s", name->len, name->text);
+}
+
 void declareParameters(struct Symbol *subsym, const struct Parameters *params)
 {
+    char registers[8] = { 0 };
     for (unsigned i = 0; i < params->len; i++) {
         struct Parameter *param = &params->parameters[i];
         struct Symbol    *sym   = AddParameter(
@@ -187,6 +561,7 @@ void declareParameters(struct Symbol *subsym, const struct Parameters *params)
             string(&param->name.String),
             typeinfo(&param->type),
             location(&param->loc));
+        requireAnywhere(param->placement, &param->name.String);
 
         if (!HasLocation(sym)) {
             VAR(GetName(sym), GetSize(sym));
@@ -196,8 +571,11 @@ void declareParameters(struct Symbol *subsym, const struct Parameters *params)
         const char *addr = GetAddress(sym);
         if (addr) {
             EQU(GetName(sym), strcopy(addr));
+        } else if (strlen(registers) + 2 < sizeof registers) {
+            strcat(registers, RegisterName(GetRegister(sym)));
         }
     }
+    TakesIn(GetName(subsym), registers);
 }
 
 void declareOutputs(struct Symbol *subsym, const struct Parameters *params)
@@ -209,6 +587,7 @@ void declareOutputs(struct Symbol *subsym, const struct Parameters *params)
         param = &params->parameters[i];
         loc   = location(&param->loc);
         p     = AddOutput(subsym, string(&param->name.String), typeinfo(&param->type), loc);
+        requireAnywhere(param->placement, &param->name.String);
         switch (loc.type) {
         case LOC_NONE:
             VAR(GetName(p), GetSize(p));
@@ -217,6 +596,7 @@ void declareOutputs(struct Symbol *subsym, const struct Parameters *params)
             EQU(GetName(p), strcopy(loc.addr));
             break;
         case LOC_REGISTER:
+            ReturnsIn(RegisterName(loc.reg));
             break;
         case LOC_OFFSET:
             fatalf("Outputs cannot have relative locations: %s", GetName(p));
@@ -239,6 +619,7 @@ void defineGroup(const struct String *name, const struct Parameters *members)
 
     for (unsigned i = 0; i < members->len; i++) {
         struct Parameter *member = &members->parameters[i];
+        requireAnywhere(member->placement, &member->name.String);
 
         loc = location(&member->loc);
         switch (loc.type) {
@@ -278,9 +659,18 @@ void defineSubroutine(const struct String *name, const struct Subroutine *subr)
             subname);
         REM(strcopy("TODO: warn if declaration differs from definition"));
     }
+    if (subr->inlining == INLINE_ALWAYS) {
+        AlwaysInline(subname);
+    } else if (subr->inlining == INLINE_NEVER) {
+        NeverInline(subname);
+    }
     Label(subname);
+    forgetAll();
+    subroutineBody = &subr->block;
     generateBlock(&subr->block);
+    subroutineBody = NULL;
     RTS();
+    forgetAll();
     free(subname);
 
     leaveScope();
@@ -327,12 +717,41 @@ void defineType(const struct String *name, const struct Type *type)
 
 void generateArithmetic(const struct IdentPhrase *lhs, const struct Value *rhs, char kind)
 {
+    const struct Symbol *dstsym = lhs->subscript || lhs->field
+        ? NULL
+        : trygetsym(&lhs->identifier.String);
+
+    uint16_t left = 0, right;
+    if ((kind == '/' || kind == '%') && rhs->type == VAL_NUMBER && rhs->Number == 0) {
+        fatalf("division by zero: %s %c= 0", phrase(lhs), kind);
+    }
+    bool isShift = kind == '<' || kind == '>' || kind == '{' || kind == '}';
+    if (isShift && rhs->type == VAL_IDENT && !valueOf(rhs, &right)) {
+        const struct Symbol *countsym = getsym(&rhs->IdentPhrase.identifier.String);
+        require(rhs->IdentPhrase.subscript || rhs->IdentPhrase.field || GetSize(countsym) == 1,
+            "shift count is not byte size: %s",
+            phrase(&rhs->IdentPhrase));
+    }
+    if (isTrackable(dstsym) && valueOf(rhs, &right)
+        && sizeOf(rhs, right) <= GetSize(dstsym)
+        && (kind == '!' || recall(dstsym, &left))) {
+        uint16_t        result = foldArithmetic(kind, left, right, GetSize(dstsym));
+        struct Operand *dst    = reduce(lhs),
+                       *src    = constantFor(dstsym, result);
+        REM(stringf("Folded %s %s= into a constant", GetName(dstsym), operatorOf(kind)));
+        COPY(dst, src);
+        remember(dstsym, result);
+        FreeOperand(src);
+        FreeOperand(dst);
+        return;
+    }
+
     struct Operand *dst = reduce(lhs),
                    *src = NULL;
 
     switch (rhs->type) {
     case VAL_IDENT:
-        src = reduce(&rhs->IdentPhrase);
+        src = reduceKnownValue(rhs);
         break;
 
     case VAL_CHAR:
@@ -381,10 +800,26 @@ void generateArithmetic(const struct IdentPhrase *lhs, const struct Value *rhs,
         XOR(dst, src);
     } else if (kind == '!') {
         NOT(dst, src);
+    } else if (kind == '*') {
+        TIMES(dst, src);
+    } else if (kind == '/') {
+        DIVIDE(dst, src);
+    } else if (kind == '%') {
+        MODULO(dst, src);
+    } else if (kind == '<') {
+        SHIFTL(dst, src);
+    } else if (kind == '>') {
+        SHIFTR(dst, src);
+    } else if (kind == '{') {
+        ROTL(dst, src);
+    } else if (kind == '}') {
+        ROTR(dst, src);
     } else {
-        fatalf("%s: unexpected kind: %c=", __func__, kind);
+        fatalf("%s: unexpected kind: %s=", __func__, operatorOf(kind));
     }
 
+    assigned(lhs, NULL);
+
     FreeOperand(src);
     FreeOperand(dst);
 }
@@ -392,6 +827,7 @@ void generateArithmetic(const struct IdentPhrase *lhs, const struct Value *rhs,
 void generateAssembly(const struct Assembly *assembly)
 {
     ASM(string(&assembly->String));
+    forgetAll();
 }
 
 void generateAssignment(const struct Assignment *assign)
@@ -406,17 +842,31 @@ void generateAssignment(const struct Assignment *assign)
     case '|': // ORA
     case '^': // EOR
     case '!': // (bitwise not) EOR #%11111111
+    case '*':
+    case '/':
+    case '%':
+    case '<': // <<=
+    case '>': // >>=
+    case '{': // <<<=
+    case '}': // >>>=
         generateArithmetic(&assign->ident, &assign->value, assign->kind);
         return;
     }
 
-    fatalf("%s: unhandled assignment type: %c=", __func__, assign->kind);
+    fatalf("%s: unhandled assignment type: %s=", __func__, operatorOf(assign->kind));
 }
 
+static unsigned generateSwitch(const struct Block *block, unsigned start);
+
 void generateBlock(const struct Block *block)
 {
     for (unsigned i = 0; i < block->len; i++) {
-        generateStatement(&block->statements[i]);
+        unsigned cases = generateSwitch(block, i);
+        if (cases > 0) {
+            i += cases - 1;
+        } else {
+            generateStatement(&block->statements[i]);
+        }
     }
 }
 
@@ -437,6 +887,7 @@ void generateCall(const struct Call *call)
         arg               = &call->args.arguments[i];
         param             = GetParameter(subsym, &arg->name.String, i);
         enum Register reg = GetRegister(param);
+        requireAnywhere(arg->placement, &arg->name.String);
         if (reg == REG_NONE) {
             setArgument(GetName(param), &arg->value);
         }
@@ -453,17 +904,458 @@ void generateCall(const struct Call *call)
     }
 
     JSR(string(subname));
+    forgetAll();
+}
+
+// Counted loops
+//
+// A loop like `loop if i < N { ... i += 1 }`, where i starts below N and the
+// body doesn't otherwise change it, runs N - i times. If nothing in the
+// subroutine reads i besides such loops, it counts down to zero with DEC and
+// BNE at the bottom. Otherwise, it counts up with INC and is compared to N at
+// the bottom. Either way there's no test at the top and no JMP back. A loop
+// with a `repeat` isn't counted since that skips the step.
+
+static bool isSameName(const struct String *a, const struct String *b)
+{
+    return a->len == b->len && strncmp(a->text, b->text, a->len) == 0;
+}
+
+static bool isName(const struct IdentPhrase *id, const struct String *name)
+{
+    return !id->subscript && !id->field && isSameName(&id->identifier.String, name);
+}
+
+static bool isPhraseMentioning(const struct IdentPhrase *id, const struct String *name)
+{
+    const struct Numerical *subscript = id->subscript;
+    return isSameName(&id->identifier.String, name)
+        || (subscript && subscript->type == NUM_IDENT && isSameName(&subscript->Identifier.String, name));
+}
+
+static bool isValueMentioning(const struct Value *value, const struct String *name);
+
+static bool areArgumentsMentioning(const struct Arguments *args, const struct String *name)
+{
+    for (unsigned i = 0; i < args->len; i++) {
+        if (isValueMentioning(&args->arguments[i].value, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isValueMentioning(const struct Value *value, const struct String *name)
+{
+    switch (value->type) {
+    case VAL_IDENT:
+        return isPhraseMentioning(&value->IdentPhrase, name);
+    case VAL_CALL:
+        return areArgumentsMentioning(&value->Call.args, name);
+    case VAL_TUPLE:
+        return areArgumentsMentioning(&value->Tuple, name);
+    default:
+        return false;
+    }
+}
+
+static bool isAssemblyMentioning(const struct Assembly *assembly, const struct String *name)
+{
+    char *text = string(&assembly->String), *key = string(name);
+    bool  found = strstr(text, key) != NULL;
+    free(key);
+    free(text);
+    return found;
+}
+
+// Returns true if stmt, not counting the statements it contains, mentions name.
+static bool isStatementMentioning(const struct Statement *stmt, const struct String *name)
+{
+    switch (stmt->type) {
+    case STMT_ASSIGN:
+        return isPhraseMentioning(&stmt->Assignment.ident, name)
+            || isValueMentioning(&stmt->Assignment.value, name);
+    case STMT_COND:
+    case STMT_LOOP:
+        return isValueMentioning(&stmt->Conditional.left, name)
+            || isValueMentioning(&stmt->Conditional.right, name);
+    case STMT_CALL:
+        return areArgumentsMentioning(&stmt->Call.args, name);
+    case STMT_ASSEMBLY:
+        return isAssemblyMentioning(&stmt->Assembly, name);
+    default:
+        return false;
+    }
+}
+
+static bool isBlockMentioning(const struct Block *block, const struct String *name)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        if (isStatementMentioning(stmt, name)) {
+            return true;
+        }
+        if ((stmt->type == STMT_COND || stmt->type == STMT_LOOP)
+            && isBlockMentioning(&stmt->Conditional.then, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if block might change name. Passing it to a subroutine counts
+// since that may pass its address.
+static bool isBlockChanging(const struct Block *block, const struct String *name)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        switch (stmt->type) {
+        case STMT_ASSIGN:
+            if (isSameName(&stmt->Assignment.ident.identifier.String, name)
+                || (stmt->Assignment.value.type == VAL_CALL && isValueMentioning(&stmt->Assignment.value, name))) {
+                return true;
+            }
+            break;
+        case STMT_COND:
+        case STMT_LOOP:
+            if (isBlockChanging(&stmt->Conditional.then, name)) {
+                return true;
+            }
+            break;
+        case STMT_CALL:
+        case STMT_ASSEMBLY:
+            if (isStatementMentioning(stmt, name)) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+// Returns true if block has a repeat for the loop that it's in.
+static bool isRepeating(const struct Block *block)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        if (stmt->type == STMT_REPEAT || (stmt->type == STMT_COND && isRepeating(&stmt->Conditional.then))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the statements of a counted loop before its increment, or an empty
+// block if cond isn't one. Sets outIndex to the name of what it counts.
+static struct Block countedBody(const struct Conditional *cond, const struct String **outIndex)
+{
+    struct Block body = { 0 };
+    if (cond->compare != COMP_LESS && cond->compare != COMP_NOTEQUAL) {
+        return body;
+    }
+    if (cond->left.type != VAL_IDENT || cond->then.len == 0) {
+        return body;
+    }
+    const struct IdentPhrase *index = &cond->left.IdentPhrase;
+    const struct Statement   *last  = &cond->then.statements[cond->then.len - 1];
+    if (index->subscript || index->field || last->type != STMT_ASSIGN) {
+        return body;
+    }
+    const struct String     *name = &index->identifier.String;
+    const struct Assignment *step = &last->Assignment;
+    if (!isName(&step->ident, name) || step->kind != '+' || step->value.type != VAL_NUMBER || step->value.Number != 1) {
+        return body;
+    }
+
+    body.len        = cond->then.len - 1;
+    body.statements = cond->then.statements;
+    if (isValueMentioning(&cond->right, name) || isBlockChanging(&body, name) || isRepeating(&body)) {
+        return (struct Block) { 0 };
+    }
+    *outIndex = name;
+    return body;
+}
+
+// Returns true if something in block besides the loop except reads name other
+// than the counted loops over it or stores a constant to it.
+static bool isIndexRead(const struct Block *block, const struct String *name, const struct Conditional *except)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        if (stmt->type == STMT_LOOP && &stmt->Conditional == except) {
+            continue;
+        }
+        if (stmt->type == STMT_LOOP) {
+            const struct String *index = NULL;
+            struct Block         body  = countedBody(&stmt->Conditional, &index);
+            if (index && isSameName(index, name)) {
+                if (isBlockMentioning(&body, name)) {
+                    return true;
+                }
+                continue;
+            }
+        }
+        if (stmt->type == STMT_ASSIGN && stmt->Assignment.kind == ':' && isName(&stmt->Assignment.ident, name)
+            && (stmt->Assignment.value.type == VAL_NUMBER || stmt->Assignment.value.type == VAL_CHAR)) {
+            continue;
+        }
+        if (isStatementMentioning(stmt, name)) {
+            return true;
+        }
+        if ((stmt->type == STMT_COND || stmt->type == STMT_LOOP) && isIndexRead(&stmt->Conditional.then, name, except)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Loop unrolling
+//
+// A counted loop whose body is small enough for its trip count becomes a copy
+// of the body for each pass, with the index known in each one so that its
+// subscripts and tests fold. The index is only stored in the copies when they
+// might read it from memory. When optimizing for speed, a loop too big for that
+// gets two or four copies of its body per pass instead.
+
+// The most statements that fully unrolling a loop may make, by goal.
+static const unsigned MAX_UNROLLED_STATEMENTS[] = {
+    [GOAL_BALANCED] = 8,
+    [GOAL_SIZE]     = 2,
+    [GOAL_SPEED]    = 32,
+};
+
+static unsigned statementsIn(const struct Block *block)
+{
+    unsigned count = block->len;
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        if (stmt->type == STMT_COND || stmt->type == STMT_LOOP) {
+            count += statementsIn(&stmt->Conditional.then);
+        }
+    }
+    return count;
+}
+
+// Returns true if block has a stop or repeat for the loop that it's in.
+static bool isLeavingLoop(const struct Block *block)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        if (stmt->type == STMT_STOP || stmt->type == STMT_REPEAT) {
+            return true;
+        }
+        if (stmt->type == STMT_COND && isLeavingLoop(&stmt->Conditional.then)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns true if id is a pointer subscripted by name, which uses the name as
+// it is rather than what is known about it.
+static bool isFoldingPrevented(const struct IdentPhrase *id, const struct String *name)
+{
+    const struct Symbol *sym = trygetsym(&id->identifier.String);
+    return sym && IsPointer(sym) && id->subscript && isPhraseMentioning(id, name);
+}
+
+// Returns true if block may read name from memory even while it's known.
+static bool isIndexLoaded(const struct Block *block, const struct String *name)
+{
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        switch (stmt->type) {
+        case STMT_CALL:
+        case STMT_ASSEMBLY:
+            return true;
+        case STMT_ASSIGN: {
+            const struct Assignment *assign = &stmt->Assignment;
+            const struct Symbol     *sym    = trygetsym(&assign->ident.identifier.String);
+            if (assign->value.type == VAL_CALL || (sym && (HasLocation(sym) || IsPointer(sym)))
+                || isFoldingPrevented(&assign->ident, name)
+                || (assign->value.type == VAL_IDENT && isFoldingPrevented(&assign->value.IdentPhrase, name))) {
+                return true;
+            }
+        } break;
+        case STMT_COND:
+        case STMT_LOOP: {
+            const struct Conditional *cond = &stmt->Conditional;
+            if ((cond->left.type == VAL_IDENT && isFoldingPrevented(&cond->left.IdentPhrase, name))
+                || (cond->right.type == VAL_IDENT && isFoldingPrevented(&cond->right.IdentPhrase, name))
+                || isIndexLoaded(&cond->then, name)) {
+                return true;
+            }
+        } break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+// Generates a copy of body for each value of the index from start up to limit
+// if that is small enough, and returns true if it did.
+static bool unrollLoop(const struct Conditional *cond, const struct Block *body, uint16_t start, uint16_t limit)
+{
+    const struct IdentPhrase *index = &cond->left.IdentPhrase;
+    const struct String *name  = &index->identifier.String;
+    const struct Symbol *sym   = trygetsym(name);
+    unsigned             count = limit - start;
+    if (!IsPassEnabled("unroll") || count * statementsIn(body) > MAX_UNROLLED_STATEMENTS[OptimizationGoal()]
+        || hasDeclarations(body) || isLeavingLoop(body)) {
+        return false;
+    }
+
+    bool isStored = isBlockMentioning(body, name) && isIndexLoaded(body, name);
+    REM(stringf("Unrolled loop of %u", count));
+    for (uint16_t value = start; value < limit; value++) {
+        remember(sym, value);
+        uint16_t known;
+        if (isStored || !recall(sym, &known)) {
+            struct Operand *dst = reduce(index), *src = constantFor(sym, value);
+            COPY(dst, src);
+            FreeOperand(src);
+            FreeOperand(dst);
+        }
+        generateBlock(body);
+    }
+    if (isIndexRead(subroutineBody, name, cond)) {
+        struct Operand *dst = reduce(index), *src = constantFor(sym, limit);
+        COPY(dst, src);
+        FreeOperand(src);
+        FreeOperand(dst);
+    }
+    remember(sym, limit);
+    Tally("loops unrolled fully");
+    return true;
+}
+
+// Returns how many copies of body each pass of a counted loop gets.
+static unsigned unrollFactor(const struct Block *body, unsigned count)
+{
+    if (OptimizationGoal() != GOAL_SPEED || !IsPassEnabled("unroll") || hasDeclarations(body)
+        || isLeavingLoop(body)) {
+        return 1;
+    }
+    for (unsigned factor = 4; factor > 1; factor /= 2) {
+        if (count % factor == 0 && count / factor > 1
+            && factor * statementsIn(body) <= MAX_UNROLLED_STATEMENTS[GOAL_SPEED]) {
+            Tally(factor == 4 ? "loops unrolled by 4" : "loops unrolled by 2");
+            return factor;
+        }
+    }
+    return 1;
+}
+
+// Generates cond if it is a counted loop and returns true, otherwise it
+// generates nothing and returns false.
+static bool generateCountedLoop(const struct Conditional *cond)
+{
+    const struct String *name = NULL;
+    struct Block         body = countedBody(cond, &name);
+    if (!name || !subroutineBody) {
+        return false;
+    }
+    struct Symbol *sym = trygetsym(name);
+    if (!isTrackable(sym) || !IsLocal(sym) || GetSize(sym) != 1) {
+        return false;
+    }
+
+    struct Constants before = constants;
+    uint16_t         start, limit;
+    if (!valueOf(&cond->left, &start)) {
+        return false;
+    }
+    forgetBlock(&cond->then);
+    if (!valueOf(&cond->right, &limit) || start >= limit || limit > 0xFF) {
+        constants = before;
+        return false;
+    }
+
+    // Unrolled copies are straight-line code, so what was known still is.
+    struct Constants loop = constants;
+    constants             = before;
+    if (unrollLoop(cond, &body, start, limit)) {
+        return true;
+    }
+    if (!IsPassEnabled("counted")) {
+        return false;
+    }
+    constants = loop;
+
+    unsigned factor      = unrollFactor(&body, limit - start);
+    bool     isCountdown = !isIndexRead(subroutineBody, name, NULL);
+    if (isCountdown) {
+        struct Operand *index = reduce(&cond->left.IdentPhrase),
+                       *count = constantFor(sym, (uint16_t)((limit - start) / factor));
+        REM(stringf("Counted loop of %u", limit - start));
+        Tally("loops counted down");
+        COPY(index, count);
+        FreeOperand(count);
+        FreeOperand(index);
+    }
+
+    char *lblLoop = MakeLocalLabel(subroutineName()),
+         *lblDone = MakeLocalLabel(subroutineName());
+    Label(lblLoop);
+    enterLoop(lblLoop, lblDone);
+
+    struct Constants top = constants;
+    for (unsigned i = 0; i < factor; i++) {
+        if (i > 0 && !isCountdown) {
+            INC(strcopy(GetName(sym)));
+        }
+        generateBlock(&body);
+    }
+    if (isCountdown) {
+        DEC(strcopy(GetName(sym)));
+        BNE(strcopy(lblLoop));
+    } else {
+        struct Operand *index = reduce(&cond->left.IdentPhrase), *end = constantFor(sym, limit);
+        INC(strcopy(GetName(sym)));
+        IFNE(index, end, lblLoop, lblDone);
+        FreeOperand(end);
+        FreeOperand(index);
+    }
+    Label(lblDone);
+
+    leaveScope();
+    constants = top;
+    free(lblDone);
+    free(lblLoop);
+    return true;
 }
 
 static void alwaysBranch(const struct Operand *_left,
     const struct Operand *_right, const char *then, const char *_done)
 {
-    // TODO: Check for 65c02 and use BRA.
+    // The 65C02's BRA can't reach as far as a JMP, so the optimizer makes this a
+    // BRA once it knows how far the label is.
+    if (TargetCpu() == CPU_65C02) {
+        JMP(strcopy(then));
+        return;
+    }
     REM(stringf("BRA %s", then));
     CLV();
     BVC(strcopy(then));
 }
 
+// Returns true if value is a byte that can be compared without indexing.
+static bool isPlainByte(const struct Value *value)
+{
+    uint16_t known;
+    if (valueOf(value, &known)) {
+        return known <= 0xFF;
+    }
+    if (value->type != VAL_IDENT || value->IdentPhrase.subscript || value->IdentPhrase.field) {
+        return false;
+    }
+    struct Symbol *sym = trygetsym(&value->IdentPhrase.identifier.String);
+    return sym && IsVariable(sym) && GetSize(sym) == 1;
+}
+
 void generateConditional(const struct Conditional *cond, bool isLoop)
 {
     static const COND IFxx[] = {
@@ -476,10 +1368,46 @@ void generateConditional(const struct Conditional *cond, bool isLoop)
         [COMP_ALWAYS]       = alwaysBranch,
     };
 
-    char *lblLoop = UnusedLabel();
+    if (isLoop && generateCountedLoop(cond)) {
+        return;
+    }
+
+    // A loop that is known to run at least once needs no test before it.
+    struct Constants before    = constants;
+    enum Compare     compare   = cond->compare;
+    bool             isTrue    = false;
+    bool             isEntered = compare == COMP_ALWAYS || (knownOutcome(cond, &isTrue) && isTrue);
+    if (isLoop) {
+        // Only what the body leaves unchanged is known at the top of a loop.
+        forgetBlock(&cond->then);
+    }
+
+    if (compare != COMP_ALWAYS && knownOutcome(cond, &isTrue)) {
+        if (!isTrue && !hasDeclarations(&cond->then)) {
+            REM(stringf("Optimized out %s that is never true", isLoop ? "loop" : "if"));
+            constants = before;
+            return;
+        }
+        if (isTrue && !isLoop) {
+            REM(strcopy("Optimized out if that is always true"));
+            generateBlock(&cond->then);
+            return;
+        }
+        if (isTrue) {
+            compare = COMP_ALWAYS;
+        }
+    }
+
+    // A loop with a test is rotated so that it is made at the bottom and the
+    // body branches back to the top. A byte test is copied to guard the entry
+    // and anything bigger is jumped to instead.
+    bool  isRotated = isLoop && compare != COMP_ALWAYS && IsPassEnabled("rotate");
+    char *lblLoop   = isRotated ? NULL : UnusedLabel();
     if (!lblLoop) {
         lblLoop = MakeLocalLabel(subroutineName());
-        Label(lblLoop);
+        if (!isRotated) {
+            Label(lblLoop);
+        }
     }
 
     char *lblThen = MakeLocalLabel(subroutineName()),
@@ -489,15 +1417,32 @@ void generateConditional(const struct Conditional *cond, bool isLoop)
         enterLoop(lblLoop, lblDone);
     }
 
-    struct Operand *left  = reduceSimpleValue(&cond->left),
-                   *right = reduceSimpleValue(&cond->right);
+    struct Operand *left  = NULL,
+                   *right = NULL;
+    if (compare != COMP_ALWAYS) {
+        left  = reduceKnownValue(&cond->left);
+        right = reduceKnownValue(&cond->right);
+    }
+
+    if (!isRotated) {
+        IFxx[compare](left, right, lblThen, lblDone);
+    } else if (isEntered) {
+        REM(strcopy("Loop is entered without a test"));
+    } else if (isPlainByte(&cond->left) && isPlainByte(&cond->right)) {
+        IFxx[compare](left, right, lblThen, lblDone);
+    } else {
+        JMP(strcopy(lblLoop));
+    }
 
-    IFxx[cond->compare](left, right, lblThen, lblDone);
+    struct Constants head = constants;
 
     Label(lblThen);
     generateBlock(&cond->then);
 
-    if (isLoop) {
+    if (isRotated) {
+        Label(lblLoop);
+        IFxx[compare](left, right, lblThen, lblDone);
+    } else if (isLoop) {
         JMP(strcopy(lblLoop));
     }
 
@@ -505,6 +1450,11 @@ void generateConditional(const struct Conditional *cond, bool isLoop)
 
     if (isLoop) {
         leaveScope();
+        constants = head;
+    } else if (fallsThrough(&cond->then)) {
+        intersect(&head);
+    } else {
+        constants = head;
     }
 
     free(lblDone);
@@ -514,9 +1464,177 @@ void generateConditional(const struct Conditional *cond, bool isLoop)
     FreeOperand(left);
 }
 
+// A2 has no switch, so a run of ifs that each test the same byte for a
+// different constant, and leave unless they're the last, makes one. Reading a
+// key and acting on it is the usual case.
+static const unsigned MIN_SWITCH_CASES = 3;
+
+// Returns true if id names a variable kept in reg, alone or in a pair.
+static bool isKeptIn(const struct IdentPhrase *id, enum Register reg)
+{
+    const struct Numerical *subscript = id->subscript;
+    const struct Symbol    *sym       = trygetsym(&id->identifier.String), *index = NULL;
+    if (subscript && subscript->type == NUM_IDENT) {
+        index = trygetsym(&subscript->Identifier.String);
+    }
+    return RegisterLow(GetRegister(sym)) == reg || RegisterHigh(GetRegister(sym)) == reg
+        || RegisterLow(GetRegister(index)) == reg;
+}
+
+static bool isValueKeptIn(const struct Value *value, enum Register reg);
+
+static bool areArgumentsKeptIn(const struct Arguments *args, enum Register reg)
+{
+    for (unsigned i = 0; i < args->len; i++) {
+        if (isValueKeptIn(&args->arguments[i].value, reg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isValueKeptIn(const struct Value *value, enum Register reg)
+{
+    switch (value->type) {
+    case VAL_IDENT:
+        return isKeptIn(&value->IdentPhrase, reg);
+    case VAL_CALL:
+        return areArgumentsKeptIn(&value->Call.args, reg);
+    case VAL_TUPLE:
+        return areArgumentsKeptIn(&value->Tuple, reg);
+    default:
+        return false;
+    }
+}
+
+// Returns true if block may need what is in reg: it mentions a variable kept
+// there or has inline assembly.
+static bool isRegisterUsed(const struct Block *block, enum Register reg)
+{
+    if (!block) {
+        return true;
+    }
+    for (unsigned i = 0; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+        switch (stmt->type) {
+        case STMT_ASSIGN:
+            if (isKeptIn(&stmt->Assignment.ident, reg) || isValueKeptIn(&stmt->Assignment.value, reg)) {
+                return true;
+            }
+            break;
+        case STMT_COND:
+        case STMT_LOOP:
+            if (isValueKeptIn(&stmt->Conditional.left, reg) || isValueKeptIn(&stmt->Conditional.right, reg)
+                || isRegisterUsed(&stmt->Conditional.then, reg)) {
+                return true;
+            }
+            break;
+        case STMT_CALL:
+            if (areArgumentsKeptIn(&stmt->Call.args, reg)) {
+                return true;
+            }
+            break;
+        case STMT_ASSEMBLY:
+            return true;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+// Returns the byte that cond tests for equality with a constant and sets key
+// to the constant, or returns NULL.
+static const struct Value *switchedValue(const struct Conditional *cond, uint16_t *key)
+{
+    uint16_t known;
+    if (cond->compare != COMP_EQUAL) {
+        return NULL;
+    }
+    if (valueOf(&cond->right, key) && *key <= 0xFF && !valueOf(&cond->left, &known) && isPlainByte(&cond->left)) {
+        return &cond->left;
+    }
+    if (valueOf(&cond->left, key) && *key <= 0xFF && !valueOf(&cond->right, &known) && isPlainByte(&cond->right)) {
+        return &cond->right;
+    }
+    return NULL;
+}
+
+// Generates the run of ifs at start as a SWITCH if they make one and returns
+// how many there were, or 0.
+static unsigned generateSwitch(const struct Block *block, unsigned start)
+{
+    const struct Value *value = NULL;
+    uint16_t            keys[256];
+    unsigned            count = 0;
+    for (unsigned i = start; i < block->len; i++) {
+        const struct Statement *stmt = &block->statements[i];
+
+        uint16_t            key    = 0;
+        const struct Value *tested = stmt->type == STMT_COND ? switchedValue(&stmt->Conditional, &key) : NULL;
+        if (!tested
+            || (value && !isSameName(&tested->IdentPhrase.identifier.String, &value->IdentPhrase.identifier.String))) {
+            break;
+        }
+        bool isRepeated = false;
+        for (unsigned j = 0; j < count; j++) {
+            isRepeated = isRepeated || keys[j] == key;
+        }
+        if (isRepeated) {
+            break;
+        }
+        value         = tested;
+        keys[count++] = key;
+        if (fallsThrough(&stmt->Conditional.then)) {
+            break;
+        }
+    }
+    if (count < MIN_SWITCH_CASES || !IsPassEnabled("switch")) {
+        return 0;
+    }
+
+    const struct Statement *stmts = &block->statements[start];
+    struct Case            *cases = calloc(count, sizeof(*cases));
+    require(cases, "calloc failed");
+    for (unsigned i = 0; i < count; i++) {
+        const struct Conditional *cond = &stmts[i].Conditional;
+        const struct Value       *key  = switchedValue(cond, &keys[i]) == &cond->left ? &cond->right : &cond->left;
+        cases[i].key                   = (uint8_t)keys[i];
+        cases[i].operand               = reduceKnownValue(key);
+        cases[i].label                 = MakeLocalLabel(subroutineName());
+    }
+    char            *lblDone = MakeLocalLabel(subroutineName());
+    struct Operand  *operand = reduceKnownValue(value);
+    struct Constants before  = constants;
+
+    SWITCH(operand, cases, count, lblDone, !isRegisterUsed(subroutineBody, REG_X));
+    for (unsigned i = 0; i < count; i++) {
+        constants = before;
+        Label(cases[i].label);
+        generateBlock(&stmts[i].Conditional.then);
+    }
+    Label(lblDone);
+
+    if (fallsThrough(&stmts[count - 1].Conditional.then)) {
+        intersect(&before);
+    } else {
+        constants = before;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        FreeOperand(cases[i].operand);
+        free(cases[i].label);
+    }
+    free(cases);
+    FreeOperand(operand);
+    free(lblDone);
+    return count;
+}
+
 void generateDeclaration(const struct Parameter *decl)
 {
     const struct String *name = &decl->name.String;
+    requireAnywhere(decl->placement, name);
 
     {
         struct Location loc = location(&decl->loc);
@@ -573,14 +1691,21 @@ void generateDeclarations(const struct Declaration *declaration)
 void generateDefinition(const struct Argument *def)
 {
     const struct String *name = &def->name.String;
+    if (def->value.type != VAL_TEXT) {
+        requireAnywhere(def->placement, name);
+    }
 
     switch (def->value.type) {
     case VAL_NUMBER:
         generateLiteralNumber(name, def->value.Number);
         return;
-    case VAL_TEXT:
-        defineText(name, &def->value.Text);
+    case VAL_TEXT: {
+        const char *label = defineText(name, &def->value.Text);
+        if (def->placement != PLACE_ANYWHERE) {
+            PAGE(label, def->placement == PLACE_ON_PAGE);
+        }
         return;
+    }
     case VAL_CHAR:
         generateLiteralChar(name, def->value.Char);
         return;
@@ -689,6 +1814,84 @@ static inline bool isPhrasePointer(const struct IdentPhrase *id)
         : IsPointer(getsym(&id->identifier.String));
 }
 
+// Returns the location of the array or group that id names as a whole, or NULL
+// if it names something that fits in a register, and sets the bytes it takes
+// and the bytes of each of its items.
+static char *blockOf(const struct IdentPhrase *id, uint16_t *size, uint16_t *itemSize)
+{
+    const struct Symbol *sym = getsym(&id->identifier.String);
+    if (id->subscript || IsPointer(sym) || IsLiteral(sym) || GetRegister(sym) != REG_NONE) {
+        return NULL;
+    }
+    const struct Symbol *block = id->field ? GetMember(sym, &id->field->String, 0) : sym;
+    if (GetItemCount(block) <= 0 && GetSize(block) <= 2) {
+        return NULL;
+    }
+    *size     = GetSize(block);
+    *itemSize = GetBaseSize(block);
+    if (id->field) {
+        return stringf("%s+%u", GetName(sym), GetOffset(block));
+    }
+    return strcopy(GetName(sym));
+}
+
+// Sets the items of the array or group that lhs names from the tuple, in order
+// or by the names of the members. Like subscripts, the items of an array are
+// found by their offsets in bytes.
+static void generateTupleSet(const struct IdentPhrase *lhs, const struct Arguments *tuple)
+{
+    require(!lhs->subscript && !lhs->field, "tuples can only be assigned to whole variables: %s", phrase(lhs));
+    const struct Symbol *sym   = getsym(&lhs->identifier.String);
+    int32_t              count = GetItemCount(sym);
+    for (unsigned i = 0; i < tuple->len; i++) {
+        const struct Argument *arg   = &tuple->arguments[i];
+        struct IdentPhrase     item  = { .identifier = lhs->identifier };
+        struct Numerical       index = { .type = NUM_NUMBER, .Number = (int)(i * GetBaseSize(sym)) };
+        struct Identifier      field;
+        requireAnywhere(arg->placement, &arg->name.String);
+        if (count > 0) {
+            require(arg->name.String.len == 0, "the items of array %s cannot be named", GetName(sym));
+            require((int32_t)i < count, "too many items for %s: %u", GetName(sym), tuple->len);
+            item.subscript = &index;
+        } else {
+            const struct Symbol *member = GetMember(sym, &arg->name.String, (uint16_t)i);
+            field.String.text           = GetMemberName(member);
+            field.String.len            = (unsigned)strlen(field.String.text);
+            item.field                  = &field;
+        }
+        generateSet(&item, &arg->value);
+    }
+}
+
+// Assigns rhs to the array or group at dst that lhs names. One the same size is
+// copied over it and a value known at compile time is stored in every item.
+static void generateBlockSet(
+    const struct IdentPhrase *lhs, const char *dst, uint16_t size, uint16_t itemSize, const struct Value *rhs)
+{
+    uint16_t srcSize, srcItemSize, known;
+    char    *src = rhs->type == VAL_IDENT ? blockOf(&rhs->IdentPhrase, &srcSize, &srcItemSize) : NULL;
+    if (src) {
+        require(srcSize == size, "cannot assign the %u bytes of %s to the %u bytes of %s",
+            srcSize, phrase(&rhs->IdentPhrase), size, phrase(lhs));
+        if (strcmp(src, dst) == 0) {
+            warnf("optimized out assigning %s to itself", src);
+        } else {
+            COPYBLOCK(dst, src, size);
+        }
+        free(src);
+    } else if (valueOf(rhs, &known)) {
+        uint8_t width = itemSize == 2 ? 2 : 1;
+        if (width == 1 && known > 0xFF) {
+            warnf("right-hand side will be truncated to a byte");
+            REM(strcopy("WARNING: VALUE TRUNCATED"));
+        }
+        FILL(dst, size, known, width);
+    } else {
+        fatalf("only an array or group of the same size, a tuple or a constant can be assigned to %s", phrase(lhs));
+    }
+    assigned(lhs, NULL);
+}
+
 void generateSet(const struct IdentPhrase *lhs, const struct Value *rhs)
 {
     bool isSrcPointer = rhs->type == VAL_IDENT && isPhrasePointer(&rhs->IdentPhrase);
@@ -698,24 +1901,41 @@ void generateSet(const struct IdentPhrase *lhs, const struct Value *rhs)
         if (!isSrcPointer) {
             // ptr := nonPTR
             generatePoint(GetName(dst), rhs);
+            assigned(lhs, NULL);
             return;
         }
         struct Symbol *src = getsym(&rhs->IdentPhrase.identifier.String);
         // ptr := ptr
-        if (strcmp(GetAddress(dst), GetAddress(src)) == 0) {
+        const char *dstAddress = GetAddress(dst), *srcAddress = GetAddress(src);
+        if (dst == src || (dstAddress && srcAddress && strcmp(dstAddress, srcAddress) == 0)) {
             warnf("optimized out assigning pointer to itself: %s := %s",
                 GetName(dst), GetName(src));
             return;
         }
     }
 
+    if (rhs->type == VAL_TUPLE) {
+        generateTupleSet(lhs, &rhs->Tuple);
+        return;
+    }
+    uint16_t size, itemSize;
+    char    *block = blockOf(lhs, &size, &itemSize);
+    if (block) {
+        generateBlockSet(lhs, block, size, itemSize, rhs);
+        free(block);
+        return;
+    }
+
+    uint16_t known;
+    bool     isKnown = valueOf(rhs, &known);
+
     struct Operand *dst = reduce(lhs),
                    *src = NULL;
 
     // Special handling
     switch (rhs->type) {
     case VAL_IDENT:
-        src = reduce(&rhs->IdentPhrase);
+        src = reduceKnownValue(rhs);
         break;
 
     case VAL_CHAR:
@@ -741,9 +1961,9 @@ void generateSet(const struct IdentPhrase *lhs, const struct Value *rhs)
     } break;
 
     case VAL_TEXT:
-    case VAL_TUPLE:
-        fatalf("TODO: handle text and tuple assignments");
+        fatalf("TODO: handle text assignments");
 
+    case VAL_TUPLE:
     case VAL_GROUPTYPE:
     case VAL_TYPE:
     case VAL_SUB:
@@ -756,6 +1976,8 @@ void generateSet(const struct IdentPhrase *lhs, const struct Value *rhs)
 
     COPY(dst, src);
 
+    assigned(lhs, isKnown ? &known : NULL);
+
     FreeOperand(src);
     FreeOperand(dst);
 }
@@ -821,9 +2043,18 @@ void generateVariable(const struct Parameter *var)
     if (!HasLocation(sym)) {
         require(GetSize(sym) > 0, "Variable size cannot be 0: %*s", var->name.String.len, var->name.String.text);
         VAR(GetName(sym), GetSize(sym));
+        if (var->placement != PLACE_ANYWHERE) {
+            PAGE(GetName(sym), var->placement == PLACE_ON_PAGE);
+        }
+        if (subroutineName() && GetSize(sym) == 1 && !IsGroup(sym) && !IsPointer(sym)) {
+            LocalByte(GetName(sym));
+        }
         return;
     }
 
+    require(var->placement == PLACE_ANYWHERE,
+        "Variable %.*s has a location, so it cannot be kept in a page",
+        var->name.String.len, var->name.String.text);
     const char *addr = GetAddress(sym);
     if (addr) {
         EQU(GetName(sym), strcopy(addr));
@@ -939,6 +2170,7 @@ void Generate(FILE *fp, struct Program *program)
 
     generateBlock(&program->block);
 
+    LinkRuntime();
     Optimize();
 
     WriteInstructions(fp);
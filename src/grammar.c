@@ -78,12 +78,18 @@ const char *Argument(const char *text, struct Argument *outArg)
     if ((remaining = Identifier(text, &outArg->name))) {
         if ((remaining = consume(remaining, '='))) {
             if ((remaining = Value(remaining, &outArg->value))) {
+                const char *remaining2;
+                if ((remaining2 = Placement(remaining, &outArg->placement))) {
+                    return remaining2;
+                }
+                outArg->placement = PLACE_ANYWHERE;
                 return remaining;
             }
         }
     }
     if ((remaining = Value(text, &outArg->value))) {
         outArg->name.String.len = 0;
+        outArg->placement       = PLACE_ANYWHERE;
         return remaining;
     }
     return NoParse;
@@ -178,6 +184,9 @@ const char *Assignment(const char *text, struct Assignment *outAssign)
         case '|':
         case '^':
         case '!':
+        case '*':
+        case '/':
+        case '%':
             outAssign->kind = *text;
             text++;
             if ((text = consume(text, '='))) {
@@ -185,6 +194,25 @@ const char *Assignment(const char *text, struct Assignment *outAssign)
                     return text;
                 }
             }
+            break;
+        case '<':
+        case '>':
+            // <<= and >>= shift, and <<<= and >>>= rotate.
+            if (text[1] != *text) {
+                break;
+            }
+            outAssign->kind = *text;
+            text += 2;
+            if (*text == outAssign->kind) {
+                outAssign->kind = outAssign->kind == '<' ? '{' : '}';
+                text++;
+            }
+            if ((text = consume(text, '='))) {
+                if ((text = Value(text, &outAssign->value))) {
+                    return text;
+                }
+            }
+            break;
         default:
             break;
         }
@@ -488,9 +516,14 @@ const char *Parameter(const char *text, struct Parameter *outParam)
         if ((text = Type(text, &outParam->type))) {
             const char *remaining;
             if ((remaining = Location(text, &outParam->loc))) {
+                text = remaining;
+            } else {
+                outParam->loc.type = NUM_NONE;
+            }
+            if ((remaining = Placement(text, &outParam->placement))) {
                 return remaining;
             }
-            outParam->loc.type = NUM_NONE;
+            outParam->placement = PLACE_ANYWHERE;
             return text;
         }
     }
@@ -545,6 +578,24 @@ const char *Parameters(const char *text, struct Parameters *outParams)
     return NoParse;
 }
 
+// Unlike other keywords, page and align may also name the variable of the next
+// statement, which goes on with a call, subscript, field or assignment.
+const char *Placement(const char *text, enum Placement *outPlacement)
+{
+    const char *remaining;
+    if ((remaining = consumeToken(text, "page", false)) && !isIdentCont(text[4])) {
+        *outPlacement = PLACE_IN_PAGE;
+    } else if ((remaining = consumeToken(text, "align", false)) && !isIdentCont(text[5])) {
+        *outPlacement = PLACE_ON_PAGE;
+    } else {
+        return NoParse;
+    }
+    if (remaining[0] != '\0' && strchr(":+-&|^!*/%<>(_.", remaining[0])) {
+        return NoParse;
+    }
+    return remaining;
+}
+
 const char *Pointer(const char *text, struct Identifier *outType)
 {
     struct Numerical num;
@@ -675,8 +726,16 @@ const char *Subroutine(const char *text, struct Subroutine *outSub)
 {
     memset(outSub, 0, sizeof *outSub);
 
+    const char *remaining;
+    if ((remaining = consumeToken(text, "inline", true))) {
+        outSub->inlining = INLINE_ALWAYS;
+        text             = remaining;
+    } else if ((remaining = consumeToken(text, "noinline", true))) {
+        outSub->inlining = INLINE_NEVER;
+        text             = remaining;
+    }
+
     if ((text = consumeToken(text, "sub", false))) {
-        const char *remaining;
         if ((remaining = consumeToken(text, "<-", false))) {
             text = Parameters(remaining, &outSub->input);
             if (!text) {
@@ -40,6 +40,7 @@ const char *Numerical(const char *text, struct Numerical *outNumerical);
 const char *Subroutine(const char *text, struct Subroutine *outSub);
 const char *Call(const char *text, struct Call *outCall);
 const char *Location(const char *text, struct Numerical *outNumerical);
+const char *Placement(const char *text, enum Placement *outPlacement);
 const char *Number(const char *text, int *outNumber);
 const char *TextLiteral(const char *text, struct String *outText);
 const char *CharLiteral(const char *text, char *outChar);
@@ -7,7 +7,7 @@
 
 static struct Program program;
 
-static bool writeAST, dumpInstructions, dumpSymbols;
+static bool writeAST, dumpInstructions, listCycles, dumpSymbols, reportRegisters, reportStats, isForRom;
 
 static void onexit(void)
 {
@@ -20,16 +20,47 @@ static void onexit(void)
     if (dumpInstructions) {
         WriteInstructions(stderr);
     }
+    if (listCycles) {
+        WriteCycles(stderr);
+    }
+    if (reportRegisters) {
+        WriteRegisterReport(stderr);
+    }
+    if (reportStats) {
+        WriteStats(stderr);
+    }
 }
 
 static void usage(void)
 {
     puts("Compile an A2 file into 6502 assembly\n");
-    puts("usage: compile [-h|--help] [-asm] [-ast] [-sym] file|-");
+    puts("usage: compile [-h|--help] [-asm] [-cycles] [-ast] [-sym] [-regalloc-report] [-stats] [-O0|-Os|-O2] [-fno-pass] [-print-after=pass] [-target cpu] [-zp ranges] [-bss how] [-smc|-rom] file|-");
     puts("   --help|-h  Display this help message");
     puts("   -asm       Write assembly to stderr");
+    puts("   -cycles    Write assembly to stderr with the bytes and cycles of each");
+    puts("              instruction and the fewest and most cycles of each subroutine");
     puts("   -ast       Show the parsed, Abstract Syntax Tree");
     puts("   -sym       Dump the Symbol Table");
+    puts("   -regalloc-report");
+    puts("              Show which variables were kept in registers or zero page");
+    puts("   -stats     Show how many times each optimization was done");
+    puts("   -O0        Don't optimize");
+    puts("   -Os        Optimize for fewer bytes");
+    puts("   -O2        Optimize for fewer cycles and warn where loops cross a page");
+    puts("   -fno-pass  Turn off a pass: constants, counted, rotate, unroll, steps, switch,");
+    puts("              inline, peephole, cfg, regalloc, cfg2, licm, flags, smc, zpvars,");
+    puts("              overlay or pool");
+    puts("   -print-after=pass");
+    puts("              Write the instructions to stderr after each time the pass runs,");
+    puts("              which may also be zp, branches or layout");
+    puts("   -target cpu");
+    puts("              Generate code for a 6502 (default) or a 65c02");
+    puts("   -zp ranges Zero page bytes free for variables, like $06-$09,$EB-$EF");
+    puts("   -bss how   Reserve variables after the program instead of storing their zeros,");
+    puts("              and clear them when it starts or keep what memory held");
+    puts("   -smc       Patch the operands of loops that read through a pointer instead of");
+    puts("              keeping it in zero page");
+    puts("   -rom       The code will run from ROM, so it may not patch itself");
     puts("   file|-     Input file path or '-' to read from stdin");
 }
 
@@ -49,8 +80,48 @@ int main(int argc, const char *argv[argc])
             writeAST = true;
         } else if (strcmp("-asm", argv[i]) == 0) {
             dumpInstructions = true;
+        } else if (strcmp("-cycles", argv[i]) == 0) {
+            listCycles = true;
         } else if (strcmp("-sym", argv[i]) == 0) {
             dumpSymbols = true;
+        } else if (strcmp("-regalloc-report", argv[i]) == 0) {
+            reportRegisters = true;
+        } else if (strcmp("-stats", argv[i]) == 0) {
+            reportStats = true;
+        } else if (strcmp("-O0", argv[i]) == 0) {
+            DisableOptimizations();
+        } else if (strncmp("-fno-", argv[i], 5) == 0) {
+            require(DisablePass(argv[i] + 5), "%s is not a pass that can be turned off", argv[i] + 5);
+        } else if (strncmp("-print-after=", argv[i], 13) == 0) {
+            require(PrintAfter(argv[i] + 13), "%s is not a pass over the instructions", argv[i] + 13);
+        } else if (strcmp("-Os", argv[i]) == 0) {
+            OptimizeFor(GOAL_SIZE);
+        } else if (strcmp("-O2", argv[i]) == 0) {
+            OptimizeFor(GOAL_SPEED);
+        } else if (strcmp("-target", argv[i]) == 0 && i + 1 < argc) {
+            const char *cpu = argv[++i];
+            if (strcmp("65c02", cpu) == 0 || strcmp("65C02", cpu) == 0) {
+                GenerateFor(CPU_65C02);
+            } else if (strcmp("6502", cpu) == 0) {
+                GenerateFor(CPU_6502);
+            } else {
+                fatalf("unknown target %s; expected 6502 or 65c02", cpu);
+            }
+        } else if (strcmp("-zp", argv[i]) == 0 && i + 1 < argc) {
+            ZeroPage(argv[++i]);
+        } else if (strcmp("-bss", argv[i]) == 0 && i + 1 < argc) {
+            const char *how = argv[++i];
+            if (strcmp("clear", how) == 0) {
+                StoreVariables(STORAGE_CLEARED);
+            } else if (strcmp("keep", how) == 0) {
+                StoreVariables(STORAGE_RESERVED);
+            } else {
+                fatalf("unknown bss %s; expected clear or keep", how);
+            }
+        } else if (strcmp("-smc", argv[i]) == 0) {
+            SelfModify(true);
+        } else if (strcmp("-rom", argv[i]) == 0) {
+            isForRom = true;
         } else if (strcmp("-h", argv[i]) == 0 || strcmp("--help", argv[i]) == 0) {
             usage();
             return 0;
@@ -62,6 +133,7 @@ int main(int argc, const char *argv[argc])
     }
 
     require(path, "no input file specified");
+    require(!isForRom || !IsSelfModifying(), "-smc patches the code, which can't be done in ROM");
 
     const char *contents = ReadFile(path);
     require(contents, "failed to read file: %s", path);
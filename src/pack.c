@@ -0,0 +1,452 @@
+// Packs an Apple DOS 3.3 binary so it loads from a floppy in fewer sectors,
+// with a stub after it that unpacks the program where it was and runs it.
+//
+// The packed stream is a run of tokens, each read from a byte:
+//
+//     $00          the end
+//     $01-$7F      that many bytes follow, copied as they are
+//     %10nnnnnn o  copies n+3 bytes from o+1 bytes back
+//     %11nnnnnn oo copies n+3 bytes from o+1 bytes back, o's high byte first
+//
+// Every token is whole bytes, so the stub never shifts bits, and copying one
+// takes a loop over Y that runs at 18 cycles a byte, whichever kind it is.
+//
+// The stream is loaded so that it ends just past where the program ends, and
+// unpacked forward over itself, which is safe while what's left to read stays
+// ahead of what's been written. The file starts with a JMP to the stub, since
+// BRUN starts at the first byte, and the stub comes last so that nothing
+// unpacked reaches it.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    MAX_LITERALS = 0x7F,
+    MIN_MATCH    = 3,
+    MAX_MATCH    = 0x3F + MIN_MATCH,
+    NEAR         = 0x100,   // farthest back a match can be with one byte
+    MAX_CHAIN    = 1024,    // earlier matches tried at each byte
+    SECTOR       = 0x100,
+    HIMEM        = 0x9600,  // where DOS 3.3 starts, with three buffers
+    SECTOR_TICKS = 102300,  // DOS 3.3 reads about ten sectors a second
+};
+
+// The zero page bytes the stub uses, which the Monitor and DOS leave free.
+enum {
+    SRC  = 0x06,
+    DST  = 0x08,
+    FROM = 0xEB,
+};
+
+// LDA/STA the packed data's address and the ORG, then unpack. The operands
+// marked are filled in by pack, and the branches are all relative so the rest
+// runs wherever it's put.
+static const uint8_t stub[] = {
+    0xA9, 0x00,       // 00        LDA #<data
+    0x85, SRC,        // 02        STA SRC
+    0xA9, 0x00,       // 04        LDA #>data
+    0x85, SRC + 1,    // 06        STA SRC+1
+    0xA9, 0x00,       // 08        LDA #<org
+    0x85, DST,        // 0A        STA DST
+    0xA9, 0x00,       // 0C        LDA #>org
+    0x85, DST + 1,    // 0E        STA DST+1
+    0xA0, 0x00,       // 10        LDY #0
+    0xB1, SRC,        // 12 TOKEN  LDA (SRC),Y
+    0xF0, 0x63,       // 14        BEQ DONE
+    0xAA,             // 16        TAX
+    0x30, 0x26,       // 17        BMI MATCH
+    0xE6, SRC,        // 19        INC SRC
+    0xD0, 0x02,       // 1B        BNE LIT
+    0xE6, SRC + 1,    // 1D        INC SRC+1
+    0xB1, SRC,        // 1F LIT    LDA (SRC),Y
+    0x91, DST,        // 21        STA (DST),Y
+    0xC8,             // 23        INY
+    0xCA,             // 24        DEX
+    0xD0, 0xF8,       // 25        BNE LIT
+    0x98,             // 27        TYA
+    0x18,             // 28        CLC
+    0x65, SRC,        // 29        ADC SRC
+    0x85, SRC,        // 2B        STA SRC
+    0x90, 0x02,       // 2D        BCC ADVANCE
+    0xE6, SRC + 1,    // 2F        INC SRC+1
+    0x98,             // 31 ADVANCE TYA
+    0x18,             // 32        CLC
+    0x65, DST,        // 33        ADC DST
+    0x85, DST,        // 35        STA DST
+    0x90, 0x02,       // 37        BCC NEXT
+    0xE6, DST + 1,    // 39        INC DST+1
+    0xA0, 0x00,       // 3B NEXT   LDY #0
+    0xF0, 0xD3,       // 3D        BEQ TOKEN
+    0xA9, 0xFF,       // 3F MATCH  LDA #$FF
+    0xE0, 0xC0,       // 41        CPX #$C0
+    0x90, 0x05,       // 43        BCC SHORT
+    0xC8,             // 45        INY
+    0xB1, SRC,        // 46        LDA (SRC),Y
+    0x49, 0xFF,       // 48        EOR #$FF
+    0x85, FROM + 1,   // 4A SHORT  STA FROM+1
+    0xC8,             // 4C        INY
+    0xB1, SRC,        // 4D        LDA (SRC),Y
+    0x49, 0xFF,       // 4F        EOR #$FF
+    0x18,             // 51        CLC
+    0x65, DST,        // 52        ADC DST
+    0x85, FROM,       // 54        STA FROM
+    0xA5, FROM + 1,   // 56        LDA FROM+1
+    0x65, DST + 1,    // 58        ADC DST+1
+    0x85, FROM + 1,   // 5A        STA FROM+1
+    0x98,             // 5C        TYA
+    0x38,             // 5D        SEC
+    0x65, SRC,        // 5E        ADC SRC
+    0x85, SRC,        // 60        STA SRC
+    0x90, 0x02,       // 62        BCC COUNT
+    0xE6, SRC + 1,    // 64        INC SRC+1
+    0x8A,             // 66 COUNT  TXA
+    0x29, 0x3F,       // 67        AND #$3F
+    0x18,             // 69        CLC
+    0x69, MIN_MATCH,  // 6A        ADC #3
+    0xAA,             // 6C        TAX
+    0xA0, 0x00,       // 6D        LDY #0
+    0xB1, FROM,       // 6F COPY   LDA (FROM),Y
+    0x91, DST,        // 71        STA (DST),Y
+    0xC8,             // 73        INY
+    0xCA,             // 74        DEX
+    0xD0, 0xF8,       // 75        BNE COPY
+    0xF0, 0xB8,       // 77        BEQ ADVANCE
+    0x4C, 0x00, 0x00, // 79 DONE   JMP org
+};
+
+enum {
+    STUB_DATA = 0x01,
+    STUB_ORG  = 0x09,
+    STUB_DONE = 0x7A,
+};
+
+// How a byte of the program is best reached, working back from the end.
+struct Step {
+    unsigned long cost;   // of the rest: bytes packed, then tokens to break ties
+    unsigned      length; // of the token that starts here
+    unsigned      offset; // back, if it's a match, or else 0
+};
+
+struct Packed {
+    uint8_t *bytes;
+    size_t   len;
+    size_t   slack; // past the program's end that the stream has to end
+};
+
+static inline uint16_t u16le(const uint8_t val[2])
+{
+    return ((uint16_t)val[0]) | ((((uint16_t)val[1]) << 8) & 0xFF00);
+}
+
+static void put16le(uint8_t *out, size_t val)
+{
+    out[0] = (uint8_t)(val & 0xFF);
+    out[1] = (uint8_t)(val >> 8 & 0xFF);
+}
+
+static unsigned hash3(const uint8_t *bytes)
+{
+    return ((unsigned)bytes[0] << 8 ^ (unsigned)bytes[1] << 4 ^ bytes[2]) & 0xFFFF;
+}
+
+// Finds the longest match at each byte, and the longest one near enough for a
+// one-byte offset, looking back along a chain of the bytes that start alike.
+static void findMatches(const uint8_t *image, size_t len, unsigned (*near)[2], unsigned (*far)[2])
+{
+    static size_t heads[0x10000];
+    size_t       *chain = calloc(len + 1, sizeof(*chain));
+    if (!chain) {
+        perror("calloc");
+        exit(1);
+    }
+    memset(heads, 0, sizeof heads);
+
+    for (size_t i = 0; i < len; i++) {
+        near[i][0] = far[i][0] = 0;
+        near[i][1] = far[i][1] = 0;
+        if (i + MIN_MATCH > len) {
+            continue;
+        }
+        unsigned hash = hash3(&image[i]);
+        size_t   most = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+        unsigned tried = 0;
+        for (size_t j = heads[hash]; j > 0 && tried < MAX_CHAIN; j = chain[j - 1], tried++) {
+            size_t   from   = j - 1;
+            unsigned length = 0;
+            while (length < most && image[from + length] == image[i + length]) {
+                length++;
+            }
+            unsigned offset = (unsigned)(i - from);
+            if (length > far[i][0]) {
+                far[i][0] = length;
+                far[i][1] = offset;
+            }
+            if (offset <= NEAR && length > near[i][0]) {
+                near[i][0] = length;
+                near[i][1] = offset;
+            }
+        }
+        chain[i]    = heads[hash];
+        heads[hash] = i + 1;
+    }
+    free(chain);
+}
+
+// Chooses the tokens that pack the image the smallest, and the fewest of them
+// of those, by working back from the end.
+static struct Step *parse(const uint8_t *image, size_t len)
+{
+    unsigned(*near)[2] = calloc(len + 1, sizeof(*near));
+    unsigned(*far)[2]  = calloc(len + 1, sizeof(*far));
+    struct Step *steps = calloc(len + 1, sizeof(*steps));
+    if (!near || !far || !steps) {
+        perror("calloc");
+        exit(1);
+    }
+    findMatches(image, len, near, far);
+
+    for (size_t i = len; i-- > 0;) {
+        struct Step *step = &steps[i];
+        step->cost        = (unsigned long)-1;
+        for (unsigned count = 1; count <= MAX_LITERALS && i + count <= len; count++) {
+            unsigned long cost = (count + 1) * 256ul + 1 + steps[i + count].cost;
+            if (cost < step->cost) {
+                *step = (struct Step) { cost, count, 0 };
+            }
+        }
+        for (unsigned length = MIN_MATCH; length <= far[i][0]; length++) {
+            bool          isNear = length <= near[i][0];
+            unsigned long cost   = (isNear ? 2 : 3) * 256ul + 1 + steps[i + length].cost;
+            if (cost < step->cost) {
+                *step = (struct Step) { cost, length, isNear ? near[i][1] : far[i][1] };
+            }
+        }
+    }
+    free(near);
+    free(far);
+    return steps;
+}
+
+// Packs the image into tokens and works out how far past the image they must
+// reach so that unpacking never writes over what it hasn't read.
+static struct Packed pack(const uint8_t *image, size_t len)
+{
+    struct Step   *steps  = parse(image, len);
+    struct Packed packed = { malloc(len + len / MAX_LITERALS + 2), 0, 0 };
+    if (!packed.bytes) {
+        perror("malloc");
+        exit(1);
+    }
+
+    size_t ahead = 0;
+    for (size_t i = 0; i < len; i += steps[i].length) {
+        const struct Step *step = &steps[i];
+        if (step->offset == 0) {
+            packed.bytes[packed.len++] = (uint8_t)step->length;
+            memcpy(&packed.bytes[packed.len], &image[i], step->length);
+            packed.len += step->length;
+        } else if (step->offset <= NEAR) {
+            packed.bytes[packed.len++] = (uint8_t)(0x80 | (step->length - MIN_MATCH));
+            packed.bytes[packed.len++] = (uint8_t)(step->offset - 1);
+        } else {
+            packed.bytes[packed.len++] = (uint8_t)(0xC0 | (step->length - MIN_MATCH));
+            packed.bytes[packed.len++] = (uint8_t)((step->offset - 1) >> 8);
+            packed.bytes[packed.len++] = (uint8_t)((step->offset - 1) & 0xFF);
+        }
+        size_t written = i + step->length;
+        if (written > packed.len && written - packed.len > ahead) {
+            ahead = written - packed.len;
+        }
+    }
+    packed.bytes[packed.len++] = 0x00;
+    free(steps);
+
+    // The stream ends at the image's end plus the slack, so it starts len -
+    // packed.len + slack after the image does, and that must never be less
+    // than how far ahead the writing got.
+    size_t shrunk = len > packed.len ? len - packed.len : 0;
+    packed.slack  = ahead > shrunk ? ahead - shrunk : 0;
+    return packed;
+}
+
+// Adds a cycle when indexing count bytes past address crosses a page.
+static unsigned crossing(size_t address, size_t count)
+{
+    return (address & 0xFF) + count >= 0x100;
+}
+
+// Counts the cycles the stub takes to unpack, as it would run at data.
+static unsigned long unpackTicks(const struct Packed *packed, size_t data, size_t org)
+{
+    unsigned long ticks = 3 + 22; // JMP, then setting up the pointers
+    size_t        src = data, dst = org;
+    for (size_t at = 0;;) {
+        uint8_t  token = packed->bytes[at];
+        unsigned count;
+        if (token == 0) {
+            return ticks + 5 + 3 + 3;
+        }
+        if (token < 0x80) {
+            count = token;
+            src++;
+            ticks += 11 + ((src & 0xFF) ? 8u : 12u);
+            for (unsigned i = 0; i < count; i++) {
+                ticks += 18 + crossing(src, i);
+            }
+            ticks += 13 - 1 + 4 * crossing(src, count);
+            src += count;
+            at += 1u + count;
+        } else {
+            unsigned size   = token >= 0xC0 ? 3 : 2;
+            unsigned offset = size == 3 ? ((unsigned)packed->bytes[at + 1] << 8 | packed->bytes[at + 2]) + 1
+                                        : (unsigned)packed->bytes[at + 1] + 1;
+            size_t   from   = dst - offset;
+            count           = (token & 0x3F) + MIN_MATCH;
+            ticks += 12 + (size == 3 ? 15 + crossing(src, 1) : 7) + 29 + crossing(src, size - 1);
+            ticks += 13 + 4 * crossing(src, size) + 12;
+            for (unsigned i = 0; i < count; i++) {
+                ticks += 18 + crossing(from, i);
+            }
+            ticks += 3 - 1;
+            src += size;
+            at += size;
+        }
+        // ADVANCE and NEXT
+        ticks += 13 + 4 * crossing(dst, count) + 5;
+        dst += count;
+    }
+}
+
+static unsigned long loadTicks(size_t len)
+{
+    // Its bytes and the 4 of the header, then the track/sector list.
+    return ((len + 4 + SECTOR - 1) / SECTOR + 1) * SECTOR_TICKS;
+}
+
+static void usage(FILE *out, const char *exepath)
+{
+    fprintf(out, "usage: %s [flags] binfile [packedfile]\n", exepath);
+    fprintf(out, "  --help     displays this message\n");
+    fprintf(out, "  --quiet    skips the report of how much smaller it got\n");
+    fprintf(out, "Packs binfile in place unless packedfile is given.\n");
+}
+
+int main(int argc, char *argv[argc])
+{
+    if (argc == 0)
+        return 42;
+
+    const char *filename = NULL;
+    const char *outname  = NULL;
+    bool        quiet    = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool helpWanted = strcmp("-h", argv[i]) == 0
+            || strcmp("--help", argv[i]) == 0
+            || strcmp("/?", argv[i]) == 0;
+        if (helpWanted) {
+            usage(stdout, argv[0]);
+            return 0;
+        }
+        if (strcmp("--quiet", argv[i]) == 0) {
+            quiet = true;
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            fprintf(stderr, "error: unknown flag: %s\n", argv[i]);
+            usage(stderr, argv[0]);
+            return 2;
+        }
+        if (!filename) {
+            filename = argv[i];
+        } else {
+            outname = argv[i];
+        }
+    }
+    if (!filename) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+    if (!outname) {
+        outname = filename;
+    }
+
+    FILE *binfile = fopen(filename, "rb");
+    if (!binfile) {
+        perror("fopen");
+        return 1;
+    }
+
+    uint8_t buf[4];
+    if (fread(buf, sizeof *buf, sizeof buf, binfile) != 4) {
+        perror("fread: expected 4 bytes");
+        return 1;
+    }
+
+    uint16_t org = u16le(&buf[0]),
+             len = u16le(&buf[2]);
+
+    uint8_t *image = malloc(len + 1u);
+    if (!image || fread(image, sizeof *image, len, binfile) != len) {
+        perror("fread");
+        return 1;
+    }
+    fclose(binfile);
+
+    struct Packed packed = pack(image, len);
+    size_t        data   = (size_t)org + len + packed.slack - packed.len;
+    size_t        start  = data - 3;
+    size_t        size   = 3 + packed.len + sizeof stub;
+    if (start < org || size >= len) {
+        fprintf(stderr, "error: packing %s wouldn't make it any smaller\n", filename);
+        free(packed.bytes);
+        free(image);
+        return 1;
+    }
+    if (start + size > HIMEM) {
+        fprintf(stderr, "warning: packed, %s reaches $%04zX, past DOS at $%04X\n", filename, start + size, HIMEM);
+    }
+
+    uint8_t *out = malloc(4 + size);
+    if (!out) {
+        perror("malloc");
+        return 1;
+    }
+    size_t unpacker = data + packed.len;
+    put16le(&out[0], start);
+    put16le(&out[2], size);
+    out[4] = 0x4C; // JMP
+    put16le(&out[5], unpacker);
+    memcpy(&out[7], packed.bytes, packed.len);
+
+    uint8_t *code = &out[7 + packed.len];
+    memcpy(code, stub, sizeof stub);
+    code[STUB_DATA]     = (uint8_t)(data & 0xFF);
+    code[STUB_DATA + 4] = (uint8_t)(data >> 8);
+    code[STUB_ORG]      = (uint8_t)(org & 0xFF);
+    code[STUB_ORG + 4]  = (uint8_t)(org >> 8);
+    put16le(&code[STUB_DONE], org);
+
+    FILE *outfile = fopen(outname, "wb");
+    if (!outfile || fwrite(out, 1, 4 + size, outfile) != 4 + size || fclose(outfile) != 0) {
+        perror("fwrite");
+        return 1;
+    }
+
+    if (!quiet) {
+        unsigned long unpacking = unpackTicks(&packed, data, org);
+        printf("unpacked: %5u bytes at $%04X, about %lu cycles to load\n", len, org, loadTicks(len));
+        printf("  packed: %5zu bytes at $%04zX, about %lu cycles to load and %lu to unpack\n",
+            size, start, loadTicks(size), unpacking);
+        printf("   ratio: %.1f%%, saving about %ld cycles\n", 100.0 * (double)size / len,
+            (long)loadTicks(len) - (long)(loadTicks(size) + unpacking));
+    }
+
+    free(out);
+    free(packed.bytes);
+    free(image);
+    return 0;
+}
@@ -128,6 +128,18 @@ static void printValue(struct Value *value, unsigned indent)
     }
 }
 
+static void printPlacement(enum Placement placement, unsigned indent)
+{
+    static const char *placements[] = {
+        [PLACE_ANYWHERE] = NULL,
+        [PLACE_IN_PAGE]  = "Placement page",
+        [PLACE_ON_PAGE]  = "Placement align",
+    };
+    if (placements[placement]) {
+        output(indent, "%s\n", placements[placement]);
+    }
+}
+
 static void printArguments(struct Arguments *args, const char *prefix, unsigned indent)
 {
     for (unsigned i = 0; i < args->len; i++) {
@@ -140,6 +152,7 @@ static void printArguments(struct Arguments *args, const char *prefix, unsigned
             output(indent + 1, "%s\n", "Name (none)");
         }
         printValue(&arg->value, indent + 1);
+        printPlacement(arg->placement, indent + 1);
     }
 }
 
@@ -151,6 +164,7 @@ static void printParameters(struct Parameters *params, const char *prefix, unsig
         printString(name, "Name", indent + 1);
         printType(&params->parameters[p].type, indent + 1);
         printNumerical(&params->parameters[p].loc, "Location", indent + 1);
+        printPlacement(params->parameters[p].placement, indent + 1);
     }
 }
 
@@ -231,7 +245,12 @@ static void printBlock(struct Block *block, unsigned indent)
 
 static void printSubroutine(struct Subroutine *subr, unsigned indent)
 {
-    output(indent, "%s\n", "Subroutine");
+    static const char *inlining[] = {
+        [INLINE_AUTO]   = "",
+        [INLINE_ALWAYS] = " inline",
+        [INLINE_NEVER]  = " noinline",
+    };
+    output(indent, "Subroutine%s\n", inlining[subr->inlining]);
     printParameters(&subr->input, "<-", indent + 1);
     printParameters(&subr->output, "->", indent + 1);
     printBlock(&subr->block, indent + 1);
@@ -48,10 +48,17 @@ struct Program {
     struct Block block;
 };
 
+enum Inlining {
+    INLINE_AUTO,   // the optimizer decides
+    INLINE_ALWAYS, // inline
+    INLINE_NEVER,  // noinline
+};
+
 struct Subroutine {
     struct Parameters input;
     struct Parameters output;
     struct Block      block;
+    enum Inlining     inlining;
 };
 
 enum NumericalType {
@@ -102,10 +109,17 @@ struct Type {
     };
 };
 
+enum Placement {
+    PLACE_ANYWHERE, // the assembler decides
+    PLACE_IN_PAGE,  // page
+    PLACE_ON_PAGE,  // align
+};
+
 struct Parameter {
     struct Identifier name;
     struct Type       type;
     struct Numerical  loc;
+    enum Placement    placement;
 };
 
 enum ValueType {
@@ -139,12 +153,13 @@ struct Value {
 struct Argument {
     struct Identifier name;
     struct Value      value;
+    enum Placement    placement;
     const char       *_text;
 };
 
 struct Assignment {
     struct IdentPhrase ident;
-    char               kind;
+    char               kind; // of operator, like '+' for +=, or '{' and '}' for <<<= and >>>=
     struct Value       value;
 };
 
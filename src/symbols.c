@@ -153,7 +153,7 @@ static struct Symbol *makeMember(
     }
     member->members = sym;
 
-    if (sym->isPointer) {
+    if (sym->isPointer && loc.type != LOC_NONE) {
         require(loc.type == LOC_FIXED,
             "%s: pointers must be in Zero Page",
             sym->name);
@@ -200,7 +200,7 @@ struct Symbol *AddConstant(struct Symbol *sub, char *name, struct TypeInfo type,
     sym->count     = type.count;
     sym->isGroup   = sym->type->isGroup;
 
-    if (sym->isPointer) {
+    if (sym->isPointer && loc.type != LOC_NONE) {
         require(loc.type == LOC_FIXED,
             "%s: pointers must be in Zero Page",
             sym->name);
@@ -614,6 +614,25 @@ const char *GetText(const struct Symbol *sym)
 
 bool HasLocation(const struct Symbol *sym) { return sym && sym->loc.type != LOC_NONE; }
 
+bool TryGetValue(const struct Symbol *sym, uint16_t *outValue)
+{
+    if (!sym) {
+        return false;
+    }
+    switch (sym->literal) {
+    case LIT_NUM:
+        *outValue = sym->number;
+        return true;
+    case LIT_CHAR:
+        *outValue = (uint8_t)sym->character | 0x80;
+        return true;
+    case LIT_TEXT:
+    case LIT_NONE:
+        break;
+    }
+    return false;
+}
+
 void InitializeSymbols(void)
 {
     // Fundamental data types
@@ -665,6 +684,8 @@ bool IsPointer(const struct Symbol *sym)
     return false;
 }
 
+bool IsLocal(const struct Symbol *sym) { return sym->isVariable && sym->subroutine && sym->paramType == PARAM_NO; }
+
 bool IsVariable(const struct Symbol *sym) { return sym->isVariable; }
 
 bool IsWord(const struct Symbol *sym)
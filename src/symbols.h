@@ -94,6 +94,8 @@ bool          IsCallable(const struct Symbol *sym);
 bool          IsChar(const struct Symbol *sym);
 bool          IsGroup(const struct Symbol *sym);
 bool          IsLiteral(const struct Symbol *sym);
+// Returns true if sym is a variable declared inside of a subroutine.
+bool          IsLocal(const struct Symbol *sym);
 bool          IsPointer(const struct Symbol *sym);
 bool          IsVariable(const struct Symbol *sym);
 bool          IsWord(const struct Symbol *sym);
@@ -107,6 +109,8 @@ uint16_t      GetItemSize(const struct Symbol *sym);
 uint16_t      GetSize(const struct Symbol *sym);
 const char   *GetText(const struct Symbol *sym);
 bool          HasLocation(const struct Symbol *sym);
+// Returns true and sets outValue if sym is a number or (High-ASCII) char literal.
+bool          TryGetValue(const struct Symbol *sym, uint16_t *outValue);
 
 struct Symbol *TryLookup(const char *name);
 struct Symbol *Lookup(const char *name);
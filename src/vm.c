@@ -15,6 +15,7 @@ const static uint16_t EXIT   = 0x03D0,
                       PRBYTE = 0xFDDA;
 
 const static uint16_t SYSTEM = 0x03F5;  // Ampersand (&) Command Vector (JMP)
+const static uint16_t CLOCK  = 0x03F8;  // Ctrl-Y Vector (JMP)
 
 const static uint8_t RTS = 0x60;
 
@@ -30,6 +31,122 @@ void write6502(uint16_t address, uint8_t value)
     mem[address] = value;
 }
 
+// The 65C02 instructions and addressing modes go over the opcodes that are
+// NOPs on the 6502. Each runs fake6502's operation for it, if there is one, and
+// then makes the cycles that exec6502 counted the 65C02's.
+
+static void (*operations[256])(void);
+static uint8_t cmosticks[256];
+
+static void cmos(void)
+{
+    operations[opcode]();
+    clockticks6502 += cmosticks[opcode] - ticktable[opcode];
+}
+
+static void install(uint8_t code, void (*mode)(void), void (*operation)(void), uint8_t ticks)
+{
+    addrtable[code]  = mode;
+    optable[code]    = cmos;
+    operations[code] = operation;
+    cmosticks[code]  = ticks;
+}
+
+// (zp)
+static void zpi(void)
+{
+    uint16_t eahelp  = (uint16_t)read6502(pc++);
+    uint16_t eahelp2 = (eahelp & 0xFF00) | ((eahelp + 1) & 0x00FF);
+    ea = (uint16_t)read6502(eahelp) | (uint16_t)((uint16_t)read6502(eahelp2) << 8);
+}
+
+// (abs,X)
+static void ainx(void)
+{
+    uint16_t eahelp = (uint16_t)(((uint16_t)read6502(pc) | (uint16_t)((uint16_t)read6502(pc + 1) << 8)) + x);
+    ea = (uint16_t)read6502(eahelp) | (uint16_t)((uint16_t)read6502((uint16_t)(eahelp + 1)) << 8);
+    pc += 2;
+}
+
+static void bra(void)
+{
+    oldpc = pc;
+    pc += reladdr;
+    if ((oldpc & 0xFF00) != (pc & 0xFF00)) {
+        clockticks6502++;
+    }
+}
+
+static void bitimm(void)
+{
+    value = getvalue();
+    zerocalc(value & a);
+}
+
+static void phx(void) { push8(x); }
+static void phy(void) { push8(y); }
+
+static void plx(void)
+{
+    x = pull8();
+    zerocalc(x);
+    signcalc(x);
+}
+
+static void ply(void)
+{
+    y = pull8();
+    zerocalc(y);
+    signcalc(y);
+}
+
+static void stz(void) { putvalue(0); }
+
+static void trb(void)
+{
+    value = getvalue();
+    zerocalc(value & a);
+    putvalue((uint16_t)(value & ~a));
+}
+
+static void tsb(void)
+{
+    value = getvalue();
+    zerocalc(value & a);
+    putvalue(value | a);
+}
+
+static void install65c02(void)
+{
+    install(0x80, rel, bra, 3);
+    install(0x89, imm, bitimm, 2);
+    install(0x34, zpx, bit, 4);
+    install(0x3C, absx, bit, 4);
+    install(0x1A, acc, inc, 2);
+    install(0x3A, acc, dec, 2);
+    install(0x7C, ainx, jmp, 6);
+    install(0xDA, imp, phx, 3);
+    install(0x5A, imp, phy, 3);
+    install(0xFA, imp, plx, 4);
+    install(0x7A, imp, ply, 4);
+    install(0x64, zp, stz, 3);
+    install(0x74, zpx, stz, 4);
+    install(0x9C, abso, stz, 4);
+    install(0x9E, absx, stz, 5);
+    install(0x14, zp, trb, 5);
+    install(0x1C, abso, trb, 6);
+    install(0x04, zp, tsb, 5);
+    install(0x0C, abso, tsb, 6);
+    install(0x12, zpi, ora, 5);
+    install(0x32, zpi, and, 5);
+    install(0x52, zpi, eor, 5);
+    install(0x72, zpi, adc, 5);
+    install(0x92, zpi, sta, 5);
+    install(0xB2, zpi, lda, 5);
+    install(0xD2, zpi, cmp, 5);
+    install(0xF2, zpi, sbc, 5);
+}
+
 static inline uint16_t u16le(uint8_t val[2])
 {
     return ((uint16_t)val[0]) | ((((uint16_t)val[1]) << 8) & 0xFF00);
@@ -85,6 +202,11 @@ static void ontick(void)
         fprintf(stderr, "system(\"%s\") $%06X => %d\n", cmd, u16le(addr), error);
         break;
     }
+    case CLOCK:
+        // Returns the clock ticks so far in XA for a test to time some code.
+        a = (uint8_t)clockticks6502;
+        x = (uint8_t)(clockticks6502 >> 8);
+        break;
     default:
         return;
     }
@@ -95,6 +217,7 @@ static void usage(FILE *out, const char *exepath)
 {
     fprintf(out, "usage: %s [flags] binfile\n", exepath);
     fprintf(out, "  --help     displays this message\n");
+    fprintf(out, "  --65c02    runs the instructions that only a 65C02 has\n");
     fprintf(out, "  --quiet    prevents output to stderr (default)\n");
     fprintf(out, "  --verbose  writes out the CPU status every cycle\n");
 }
@@ -111,6 +234,7 @@ int main(int argc, char *argv[argc])
 
     const char *filename = "";
     bool        verbose  = false;
+    bool        is65c02  = false;
 
     for (int i = 1; i < argc; i++) {
         bool helpWanted = strcmp("-h", argv[i]) == 0
@@ -124,6 +248,10 @@ int main(int argc, char *argv[argc])
             verbose = true;
             continue;
         }
+        if (strcmp("--65c02", argv[i]) == 0) {
+            is65c02 = true;
+            continue;
+        }
         if (strcmp("--quiet", argv[i]) == 0) {
             verbose = false;
             continue;
@@ -168,6 +296,9 @@ int main(int argc, char *argv[argc])
 
     fprintf(stderr, "starting execution at: $%4X\n", org);
 
+    if (is65c02) {
+        install65c02();
+    }
     hookexternal((void *)ontick);
     reset6502();
     exec6502(org);
@@ -4,9 +4,33 @@ cd $(dirname $0)
 
 mkdir -p output
 
+# Tests named for the 65C02 are built for it.
+function target
+{
+    case $1 in
+        *65c02*) echo -target 65c02 ;;
+    esac
+}
+
+# Tests named for the BSS reserve their variables and clear them.
+function storage
+{
+    case $1 in
+        *bss*) echo -bss clear ;;
+    esac
+}
+
+# Tests named for self-modifying code patch it.
+function patching
+{
+    case $1 in
+        *smc*) echo -smc ;;
+    esac
+}
+
 for each in `ls -1 *.a2`
 do
-    ../compile "$each" 2>output/"$each".err >output/"$each".out
+    ../compile $(target "$each") $(storage "$each") $(patching "$each") "$each" 2>output/"$each".err >output/"$each".out
     if [ $? -eq 0 ]
     then
         echo " ✅  $each"
@@ -33,8 +57,9 @@ then
     echo Running some tests using fake6502
     for each in `grep --files-with-matches FAIL tests/*.a2`
     do
-        ./a2 build "$each" 2>&1 >/dev/null
-        ./vm OUT.6502 --quiet | grep --quiet FAIL
+        flags=$(target "$each")
+        ./a2 build $flags $(storage "$each") $(patching "$each") "$each" 2>&1 >/dev/null
+        ./vm ${flags:+--65c02} OUT.6502 --quiet | grep --quiet FAIL
         if [ $? -eq 0 ]
         then
             echo " ❌  $each"